@@ -28,8 +28,10 @@
 #include <vector>
 #include <stdint.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "lzip.h"
+#include "decoder.h"
 #include "mtester.h"
 
 
@@ -78,19 +80,12 @@ bool validate_ds( unsigned * const dictionary_size )
   return true;
   }
 
-} // end namespace
 
+enum { lzma_header_size = 13 };
 
-int alone_to_lz( const int infd, const Pretty_print & pp )
+// Return 0 if the header of the .lzma file is valid, else 2.
+int check_lzma_header( const uint8_t * const buffer, const Pretty_print & pp )
   {
-  enum { lzma_header_size = 13, offset = lzma_header_size - Lzip_header::size };
-  long file_size = 0;
-  uint8_t * const buffer = read_file( infd, &file_size, pp.name() );
-  if( !buffer ) return 1;
-  if( file_size < lzma_header_size )
-    { show_file_error( pp.name(), "Input file is too short." );
-      std::free( buffer ); return 2; }
-
   if( buffer[0] != 93 )			// (45 * 2) + (9 * 0) + 3
     {
     const Lzip_header & header = *(const Lzip_header *)buffer;
@@ -98,16 +93,117 @@ int alone_to_lz( const int infd, const Pretty_print & pp )
       show_file_error( pp.name(), "Input file is already in lzip format." );
     else
       show_file_error( pp.name(), "Input file has non-default LZMA properties." );
-    std::free( buffer ); return 2;
+    return 2;
     }
   for( int i = 5; i < 13; ++i ) if( buffer[i] != 0xFF )
-    { show_file_error( pp.name(), "Input file is non-streamed." );
-      std::free( buffer ); return 2; }
+    { show_file_error( pp.name(), "Input file is non-streamed." ); return 2; }
+  return 0;
+  }
 
-  if( verbosity >= 1 ) pp();
+
+unsigned lzma_dictionary_size( const uint8_t * const buffer )
+  {
   unsigned dictionary_size = 0;
   for( int i = 4; i > 0; --i )
     { dictionary_size <<= 8; dictionary_size += buffer[i]; }
+  return dictionary_size;
+  }
+
+
+/* Convert the region [start,end) of the seekable file infd with memory
+   bounded by the dictionary size. The LZMA stream is decoded once to
+   compute the trailer and the dictionary size actually used, once more to
+   check the conversion, and then copied to outfd after the lzip header. */
+int stream_alone_to_lz( const int infd, const long long start,
+                        const long long end, const Pretty_print & pp )
+  {
+  uint8_t lzma_header[lzma_header_size];
+  if( end - start < lzma_header_size )
+    { show_file_error( pp.name(), "Input file is too short." ); return 2; }
+  if( preadblock( infd, lzma_header, lzma_header_size, start ) !=
+      lzma_header_size )
+    { show_file_error( pp.name(), "Error reading input file", errno );
+      return 1; }
+  const int hret = check_lzma_header( lzma_header, pp );
+  if( hret != 0 ) return hret;
+
+  if( verbosity >= 1 ) pp();
+  unsigned dictionary_size = lzma_dictionary_size( lzma_header );
+  const unsigned orig_dictionary_size = dictionary_size;
+  validate_ds( &dictionary_size );
+  const long long lzma_pos = start + lzma_header_size;
+  unsigned crc;
+  unsigned long long data_size, lzma_size;
+  // compute trailer
+  {
+  Range_decoder rdec( infd, lzma_pos, end );
+  LZ_decoder decoder( rdec, dictionary_size, -1 );
+  const int result = decoder.decode_member( Cl_options(), Pretty_print( "" ),
+                                            true );
+  if( result == 1 && orig_dictionary_size > max_dictionary_size )
+    { pp( "dictionary size is too large" ); return 2; }
+  if( result != 0 || !rdec.finished() )
+    { pp( "file is corrupt" ); return 2; }
+  if( decoder.max_distance() < dictionary_size &&
+      dictionary_size > min_dictionary_size )
+    dictionary_size =
+      std::max( decoder.max_distance(), (unsigned)min_dictionary_size );
+  crc = decoder.crc();
+  data_size = decoder.data_position();
+  lzma_size = rdec.member_position();
+  }
+  // check conversion
+  {
+  Range_decoder rdec( infd, lzma_pos, end );
+  LZ_decoder decoder( rdec, dictionary_size, -1 );
+  if( decoder.decode_member( Cl_options(), Pretty_print( "" ), true ) != 0 ||
+      !rdec.finished() || decoder.crc() != crc ||
+      decoder.data_position() != data_size )
+    { pp( "conversion failed" ); return 2; }
+  }
+  Lzip_header header;
+  header.set_magic();
+  header.dictionary_size( dictionary_size );
+  Lzip_trailer trailer;
+  trailer.data_crc( crc );
+  trailer.data_size( data_size );
+  trailer.member_size( header.size + lzma_size + trailer.size );
+  if( writeblock( outfd, header.data, header.size ) != header.size )
+    { show_error( "Error writing output file", errno ); return 1; }
+  if( lseek( infd, lzma_pos, SEEK_SET ) != lzma_pos )
+    { show_file_error( pp.name(), "Seek error", errno ); return 1; }
+  if( !copy_file( infd, outfd, lzma_size ) ) return 1;
+  if( writeblock( outfd, trailer.data, trailer.size ) != trailer.size )
+    { show_error( "Error writing output file", errno ); return 1; }
+  if( verbosity >= 1 ) std::fputs( "done\n", stderr );
+  return 0;
+  }
+
+} // end namespace
+
+
+/* Regular files are converted by stream_alone_to_lz. Other files are read
+   into memory. */
+int alone_to_lz( const int infd, const Pretty_print & pp )
+  {
+  struct stat st;
+  if( fstat( infd, &st ) == 0 && S_ISREG( st.st_mode ) )
+    {
+    const long long start = lseek( infd, 0, SEEK_CUR );
+    if( start >= 0 && start <= st.st_size )
+      return stream_alone_to_lz( infd, start, st.st_size, pp );
+    }
+  enum { offset = lzma_header_size - Lzip_header::size };
+  long file_size = 0;
+  uint8_t * const buffer = read_file( infd, &file_size, pp.name() );
+  if( !buffer ) return 1;
+  if( file_size < lzma_header_size )
+    { show_file_error( pp.name(), "Input file is too short." );
+      std::free( buffer ); return 2; }
+  if( check_lzma_header( buffer, pp ) != 0 ) { std::free( buffer ); return 2; }
+
+  if( verbosity >= 1 ) pp();
+  unsigned dictionary_size = lzma_dictionary_size( buffer );
   const unsigned orig_dictionary_size = dictionary_size;
   validate_ds( &dictionary_size );
   Lzip_header & header = *(Lzip_header *)( buffer + offset );
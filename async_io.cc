@@ -0,0 +1,204 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "lzip.h"
+#include "decoder.h"
+#include "threads.h"
+#include "async_io.h"
+
+
+namespace {
+
+extern "C" void * pworker( void * arg )
+  { ((Input_prefetcher *)arg)->read_blocks(); return 0; }
+
+extern "C" void * oworker( void * arg )
+  { ((Async_writer *)arg)->write_blocks(); return 0; }
+
+} // end namespace
+
+
+Input_prefetcher::Input_prefetcher( const int ifd, const int bufsize )
+  : infd( ifd ), buffer_size( bufsize ), num_free( 2 ), next( 0 ),
+    next_size( -1 ), next_errno( 0 ), quit( false )
+  {
+  free_buffers[0] = new uint8_t[buffer_size];
+  free_buffers[1] = new uint8_t[buffer_size];
+  xinit_mutex( &mutex ); xinit_cond( &free_av ); xinit_cond( &next_av );
+  xcreate( &thread, pworker, this );
+  }
+
+
+Input_prefetcher::~Input_prefetcher()
+  {
+  xlock( &mutex );
+  quit = true;
+  xsignal( &free_av );
+  xunlock( &mutex );
+  xjoin( thread );
+  xdestroy_cond( &next_av ); xdestroy_cond( &free_av );
+  xdestroy_mutex( &mutex );
+  while( num_free > 0 ) delete[] free_buffers[--num_free];
+  delete[] next;
+  }
+
+
+// Read blocks until EOF or error, or until quit is requested.
+void Input_prefetcher::read_blocks()
+  {
+  while( true )
+    {
+    xlock( &mutex );
+    while( !quit && ( num_free == 0 || next_size >= 0 ) )
+      xwait( &free_av, &mutex );
+    if( quit ) { xunlock( &mutex ); break; }
+    uint8_t * const buf = free_buffers[--num_free];
+    xunlock( &mutex );
+    const int size = readblock( infd, buf, buffer_size );
+    const int errcode = errno;
+    xlock( &mutex );
+    next = buf; next_size = size; next_errno = errcode;
+    xsignal( &next_av );
+    xunlock( &mutex );
+    if( size < buffer_size ) break;		// EOF or read error
+    }
+  }
+
+
+int Input_prefetcher::get_block( uint8_t *& buf )
+  {
+  xlock( &mutex );
+  if( buf ) { free_buffers[num_free++] = buf; buf = 0; }
+  while( next_size < 0 ) xwait( &next_av, &mutex );
+  buf = next; next = 0;
+  const int size = next_size; next_size = -1;
+  errno = next_errno;
+  xsignal( &free_av );
+  xunlock( &mutex );
+  return size;
+  }
+
+
+Async_writer::Async_writer( const int ofd, const int bufsize )
+  : outfd( ofd ), buffer_size( bufsize ), current( 0 ), current_size( 0 ),
+    pending( 0 ), write_errno( 0 ), write_error( false ), quit( false )
+  {
+  if( outfd < 0 ) return;			// inactive writer
+  for( int i = 0; i < num_buffers; ++i )
+    free_buffers.push_back( new uint8_t[buffer_size] );
+  xinit_mutex( &mutex ); xinit_cond( &full_av ); xinit_cond( &free_av );
+  xcreate( &thread, oworker, this );
+  }
+
+
+// Data still queued is written before the thread exits.
+Async_writer::~Async_writer()
+  {
+  if( outfd < 0 ) return;
+  xlock( &mutex );
+  quit = true;
+  xsignal( &full_av );
+  xunlock( &mutex );
+  xjoin( thread );
+  xdestroy_cond( &free_av ); xdestroy_cond( &full_av );
+  xdestroy_mutex( &mutex );
+  if( current ) free_buffers.push_back( current );
+  for( unsigned i = 0; i < free_buffers.size(); ++i )
+    delete[] free_buffers[i];
+  }
+
+
+void Async_writer::write_blocks()
+  {
+  xlock( &mutex );
+  while( true )
+    {
+    while( !quit && full_queue.empty() ) xwait( &full_av, &mutex );
+    if( full_queue.empty() ) break;
+    const std::pair< uint8_t *, int > block = full_queue.front();
+    full_queue.pop();
+    const bool skip = write_error;	// don't write after an error
+    xunlock( &mutex );
+    int errcode = 0;
+    if( !skip && writeblock( outfd, block.first, block.second ) != block.second )
+      errcode = errno;
+    xlock( &mutex );
+    if( errcode && !write_error ) { write_error = true; write_errno = errcode; }
+    free_buffers.push_back( block.first );
+    --pending;
+    xsignal( &free_av );
+    }
+  xunlock( &mutex );
+  }
+
+
+// Queue the current buffer for writing. Caller holds the lock.
+void Async_writer::queue_current()
+  {
+  if( current && current_size > 0 )
+    {
+    full_queue.push( std::make_pair( current, current_size ) );
+    ++pending; current = 0; current_size = 0;
+    xsignal( &full_av );
+    }
+  }
+
+
+void Async_writer::write_data( const uint8_t * const buf, const int size )
+  {
+  int sz = 0;
+  while( sz < size )
+    {
+    if( !current || current_size >= buffer_size )
+      {
+      xlock( &mutex );
+      queue_current();
+      while( free_buffers.empty() && !write_error ) xwait( &free_av, &mutex );
+      const bool error = write_error;
+      if( !error ) { current = free_buffers.back(); free_buffers.pop_back(); }
+      xunlock( &mutex );
+      if( error ) { errno = write_errno; throw Error( "Write error" ); }
+      }
+    const int n = std::min( size - sz, buffer_size - current_size );
+    std::memcpy( current + current_size, buf + sz, n );
+    current_size += n; sz += n;
+    }
+  }
+
+
+void Async_writer::finish()
+  {
+  if( outfd < 0 ) return;
+  xlock( &mutex );
+  queue_current();
+  while( pending > 0 ) xwait( &free_av, &mutex );
+  const bool error = write_error;
+  xunlock( &mutex );
+  if( error ) { errno = write_errno; throw Error( "Write error" ); }
+  }
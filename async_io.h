@@ -0,0 +1,86 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Double-buffered reader. A thread fills the next buffer while the
+   caller consumes the current one. Used by Range_decoder. */
+class Input_prefetcher
+  {
+  const int infd;
+  const int buffer_size;
+  uint8_t * free_buffers[2];	// buffers waiting to be filled
+  int num_free;
+  uint8_t * next;		// filled buffer not yet taken by the caller
+  int next_size;		// size of data in next, -1 if none
+  int next_errno;		// errno after reading next
+  bool quit;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t free_av;	// free buffer available or quit
+  pthread_cond_t next_av;	// filled buffer available
+
+  Input_prefetcher( const Input_prefetcher & );	// declared as private
+  void operator=( const Input_prefetcher & );	// declared as private
+
+public:
+  Input_prefetcher( const int ifd, const int bufsize );
+  ~Input_prefetcher();
+
+  void read_blocks();		// run by the thread
+
+  /* Return 'buf' (if not null) to the reader and replace it with the next
+     filled buffer. Return the size of the data read, and set errno as
+     readblock does. Must not be called again after a short read. */
+  int get_block( uint8_t *& buf );
+  };
+
+
+/* Data_sink that copies the data into buffers that a thread writes to a
+   file descriptor, so that decoding and writing overlap. Data are written
+   in order. Write errors are reported by the next call to write_data or
+   finish. If ofd < 0, no thread is created and nothing can be written. */
+class Async_writer : public Data_sink
+  {
+  const int outfd;
+  const int buffer_size;
+  std::vector< uint8_t * > free_buffers;
+  std::queue< std::pair< uint8_t *, int > > full_queue;	// data, size
+  uint8_t * current;		// buffer being filled by write_data
+  int current_size;
+  int pending;			// buffers queued or being written
+  int write_errno;		// errno of the first write error
+  bool write_error;
+  bool quit;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t full_av;	// buffer to write available or quit
+  pthread_cond_t free_av;	// buffer written
+
+  Async_writer( const Async_writer & );		// declared as private
+  void operator=( const Async_writer & );	// declared as private
+
+  void queue_current();
+
+public:
+  enum { num_buffers = 4 };
+  Async_writer( const int ofd, const int bufsize );
+  ~Async_writer();
+
+  void write_blocks();		// run by the thread
+
+  void write_data( const uint8_t * const buf, const int size );
+  void finish();		// wait until all the data are written
+  };
@@ -32,6 +32,7 @@
 #include "lzip.h"
 #include "mtester.h"
 #include "lzip_index.h"
+#include "threads.h"
 
 
 namespace {
@@ -107,48 +108,237 @@ const LZ_mtester * prepare_master( const uint8_t * const buffer,
   }
 
 
-bool test_member_rest( const LZ_mtester & master, uint8_t * const buffer2,
-                       long * const failure_posp = 0 )
+/* Masks applied to the byte at each position tried, grouped in tiers.
+   Each tier is tried at all the positions of the range before the next
+   tier. With bit_flips_first, the masks are XORed to the byte, and the
+   tiers are the 8 single-bit flips, the 28 double-bit flips, and the 219
+   remaining values, because most media errors are single-bit flips. Else
+   there is one tier whose masks are added to the byte, trying the values
+   byte + 1, byte + 2, ... in the order of lziprecover 1.24. */
+class Repair_masks
+  {
+  std::vector< uint8_t > tiers[3];
+  int num_tiers;
+
+public:
+  explicit Repair_masks( const bool bit_flips_first )
+    : num_tiers( bit_flips_first ? 3 : 1 )
+    {
+    for( int mask = 1; mask < 256; ++mask )
+      {
+      int bits = 0;
+      for( int m = mask; m > 0; m >>= 1 ) bits += m & 1;
+      const int i = bit_flips_first ? std::min( bits, 3 ) - 1 : 0;
+      tiers[i].push_back( mask );
+      }
+    }
+
+  int size() const { return num_tiers; }
+  unsigned size( const int t ) const { return tiers[t].size(); }
+
+  // value j of tier t for a byte whose original value is 'value'
+  uint8_t operator()( const int t, const unsigned j,
+                      const uint8_t value ) const
+    { return ( num_tiers > 1 ) ? value ^ tiers[t][j] : value + tiers[t][j]; }
+  };
+
+
+/* Checkpoints covering the blocks of positions tried by repair_member.
+   At most 64 checkpoints are taken, fewer for large dictionaries, so that
+   their total size stays below about 256 MiB. */
+unsigned long checkpoint_interval( const long begin, const long end,
+                                   const unsigned dictionary_size )
+  {
+  const long max_checkpoints = std::max( 1L,
+    std::min( 64L, ( 256L << 20 ) / ( dictionary_size + 65536L ) ) );
+  return std::max( 100L, ( end - begin ) / max_checkpoints + 1 );
+  }
+
+long first_limit( const long begin, const long end )
+  { return std::max( std::max( begin, end - 50100 ) - 16, 0L ); }
+
+
+bool test_member_rest( const LZ_mtester & master, Trial_buffer & tbuffer,
+                       long * const failure_posp = 0,
+                       const uint8_t * const ibuf = 0 )
   {
   LZ_mtester mtester( master );		// tester with external buffer
-  mtester.duplicate_buffer( buffer2 );
+  mtester.duplicate_buffer( tbuffer );
+  if( ibuf ) mtester.set_input_buffer( ibuf );
   if( mtester.test_member() == 0 && mtester.finished() ) return true;
   if( failure_posp ) *failure_posp = mtester.member_position();
   return false;
   }
 
 
-// Return value: -1 = master failed, 0 = begin reached, > 0 = repaired pos
-long repair_member( uint8_t * const mbuffer, const long long mpos,
-                    const long msize, const long begin, const long end,
-                    const unsigned dictionary_size, const char terminator )
+struct Repair_arg		// state shared by the repair workers
+  {
+  const LZ_mtester * master;
+  const Repair_masks * masks;
+  int tier;			// current tier of masks
+  long long mpos;
+  long min_pos;
+  long next_pos;		// next position to be tried (descending)
+  long found_pos;		// highest position repaired, or -1
+  uint8_t found_value;
+  char terminator;
+  pthread_mutex_t mutex;
+  };
+
+struct Worker_arg
+  {
+  Repair_arg * ra;
+  uint8_t * mbuffer;		// private copy of the member
+  Trial_buffer * tbuffer;	// private dictionary buffer
+  };
+
+
+/* Try the positions of the current block in descending order, as the serial
+   loop does. A position is abandoned only if a higher position has already
+   been repaired, so the result is the same as that of the serial search. */
+extern "C" void * rworker( void * arg )
   {
-  uint8_t * const buffer2 = new uint8_t[dictionary_size];
-  for( long pos = end; pos >= begin && pos > end - 50000; )
+  const Worker_arg & wa = *(const Worker_arg *)arg;
+  Repair_arg & ra = *wa.ra;
+
+  while( true )
     {
-    const long min_pos = std::max( begin, pos - 100 );
-    const unsigned long pos_limit = std::max( min_pos - 16, 0L );
-    const LZ_mtester * master =
-      prepare_master( mbuffer, msize, pos_limit, dictionary_size );
-    if( !master ) { delete[] buffer2; return -1; }
-    for( ; pos >= min_pos; --pos )
+    xlock( &ra.mutex );
+    const long pos = ra.next_pos;
+    const bool done = pos < ra.min_pos || pos < ra.found_pos;
+    if( !done )
       {
+      --ra.next_pos;
       if( verbosity >= 2 )
         {
-        std::printf( "  Trying position %llu %c", mpos + pos, terminator );
+        std::printf( "  Trying position %llu %c", ra.mpos + pos, ra.terminator );
         std::fflush( stdout ); pending_newline = true;
         }
-      for( int j = 0; j < 255; ++j )
+      }
+    xunlock( &ra.mutex );
+    if( done ) break;
+    const Repair_masks & masks = *ra.masks;
+    uint8_t & byte = wa.mbuffer[pos];
+    const uint8_t orig_value = byte;
+    for( unsigned j = 0; j < masks.size( ra.tier ); ++j )
+      {
+      byte = masks( ra.tier, j, orig_value );
+      xlock( &ra.mutex ); const bool skip = pos < ra.found_pos;
+      xunlock( &ra.mutex );
+      if( skip ) break;
+      if( test_member_rest( *ra.master, *wa.tbuffer, 0, wa.mbuffer ) )
         {
-        ++mbuffer[pos];
-        if( test_member_rest( *master, buffer2 ) )
-          { delete master; delete[] buffer2; return pos; }
+        xlock( &ra.mutex );
+        if( ra.found_pos < pos ) { ra.found_pos = pos; ra.found_value = byte; }
+        xunlock( &ra.mutex );
+        break;
         }
-      ++mbuffer[pos];
       }
-    delete master;
+    byte = orig_value;
+    }
+  return 0;
+  }
+
+
+/* Same as repair_member, but the trials of each block of positions are
+   shared among 'workers' threads. Each worker uses a private copy of the
+   member, while the master is shared read-only.
+   Return value: -1 = master failed, 0 = begin reached, > 0 = repaired pos */
+long repair_member_mt( uint8_t * const mbuffer, const long long mpos,
+                       const long msize, const long begin, const long end,
+                       const unsigned dictionary_size, const char terminator,
+                       const Repair_masks & masks, const int workers )
+  {
+  std::vector< Worker_arg > worker_args( workers );
+  std::vector< pthread_t > worker_threads( workers );
+  Repair_arg ra;
+  ra.masks = &masks;
+  ra.mpos = mpos;
+  ra.terminator = terminator;
+  xinit_mutex( &ra.mutex );
+  for( int i = 0; i < workers; ++i )
+    {
+    worker_args[i].ra = &ra;
+    worker_args[i].mbuffer = new uint8_t[msize];
+    std::memcpy( worker_args[i].mbuffer, mbuffer, msize );
+    worker_args[i].tbuffer = new Trial_buffer( dictionary_size );
+    }
+  const long cp_begin = first_limit( begin, end );
+  const Mtester_checkpoints checkpoints( mbuffer, msize, dictionary_size,
+    cp_begin, end, checkpoint_interval( cp_begin, end, dictionary_size ) );
+  long result = 0;
+  for( int t = 0; t < masks.size() && result == 0; ++t )
+    {
+    ra.tier = t;
+    for( long pos = end; pos >= begin && pos > end - 50000; )
+      {
+      const long min_pos = std::max( begin, pos - 100 );
+      const unsigned long pos_limit = std::max( min_pos - 16, 0L );
+      const LZ_mtester * master = checkpoints.prepare_master( pos_limit );
+      if( !master ) { result = -1; break; }
+      ra.master = master;
+      ra.min_pos = min_pos;
+      ra.next_pos = pos;
+      ra.found_pos = -1;
+      for( int i = 0; i < workers; ++i ) worker_args[i].tbuffer->reset();
+      for( int i = 0; i < workers; ++i )
+        xcreate( &worker_threads[i], rworker, &worker_args[i] );
+      for( int i = 0; i < workers; ++i ) xjoin( worker_threads[i] );
+      delete master;
+      if( ra.found_pos >= 0 )
+        { mbuffer[ra.found_pos] = ra.found_value; result = ra.found_pos;
+          break; }
+      pos = min_pos - 1;
+      }
     }
-  delete[] buffer2;
+  for( int i = 0; i < workers; ++i )
+    { delete worker_args[i].tbuffer; delete[] worker_args[i].mbuffer; }
+  xdestroy_mutex( &ra.mutex );
+  return result;
+  }
+
+
+// Return value: -1 = master failed, 0 = begin reached, > 0 = repaired pos
+long repair_member( uint8_t * const mbuffer, const long long mpos,
+                    const long msize, const long begin, const long end,
+                    const unsigned dictionary_size, const char terminator,
+                    const Repair_masks & masks, const int num_workers = 1 )
+  {
+  const int workers = limit_workers( std::min( (long)num_workers,
+                                     end - begin + 1 ), dictionary_size );
+  if( workers > 1 )
+    return repair_member_mt( mbuffer, mpos, msize, begin, end,
+                             dictionary_size, terminator, masks, workers );
+  const long cp_begin = first_limit( begin, end );
+  const Mtester_checkpoints checkpoints( mbuffer, msize, dictionary_size,
+    cp_begin, end, checkpoint_interval( cp_begin, end, dictionary_size ) );
+  Trial_buffer tbuffer( dictionary_size );
+  for( int t = 0; t < masks.size(); ++t )
+    for( long pos = end; pos >= begin && pos > end - 50000; )
+      {
+      const long min_pos = std::max( begin, pos - 100 );
+      const unsigned long pos_limit = std::max( min_pos - 16, 0L );
+      const LZ_mtester * master = checkpoints.prepare_master( pos_limit );
+      if( !master ) return -1;
+      tbuffer.reset();
+      for( ; pos >= min_pos; --pos )
+        {
+        if( verbosity >= 2 )
+          {
+          std::printf( "  Trying position %llu %c", mpos + pos, terminator );
+          std::fflush( stdout ); pending_newline = true;
+          }
+        const uint8_t orig_value = mbuffer[pos];
+        for( unsigned j = 0; j < masks.size( t ); ++j )
+          {
+          mbuffer[pos] = masks( t, j, orig_value );
+          if( test_member_rest( *master, tbuffer ) )
+            { delete master; return pos; }
+          }
+        mbuffer[pos] = orig_value;
+        }
+      delete master;
+      }
   return 0;
   }
 
@@ -182,9 +372,11 @@ uint8_t * read_member( const int infd, const long long mpos,
 
 int byte_repair( const std::string & input_filename,
                  const std::string & default_output_filename,
-                 const Cl_options & cl_opts,
-                 const char terminator, const bool force )
+                 const Cl_options & cl_opts, const char terminator,
+                 const bool force, const bool bit_flips_first,
+                 const int num_workers )
   {
+  const Repair_masks masks( bit_flips_first );
   const char * const filename = input_filename.c_str();
   struct stat in_stats;
   const int infd = open_instream( filename, &in_stats, false, true );
@@ -228,10 +420,12 @@ int byte_repair( const std::string & input_filename,
       pos = repair_dictionary_size( mbuffer, msize );
       if( pos == 0 )
         pos = repair_member( mbuffer, mpos, msize, header.size + 1,
-                             header.size + 6, dictionary_size, terminator );
+                             header.size + 6, dictionary_size, terminator,
+                             masks, num_workers );
       if( pos == 0 )
         pos = repair_member( mbuffer, mpos, msize, header.size + 7,
-                             failure_pos, dictionary_size, terminator );
+                             failure_pos, dictionary_size, terminator,
+                             masks, num_workers );
       print_pending_newline( terminator );
       }
     if( pos < 0 )
@@ -304,7 +498,7 @@ int debug_delay( const char * const input_filename,
       }
     uint8_t * const mbuffer = read_member( infd, mpos, msize, input_filename );
     if( !mbuffer ) return 1;
-    uint8_t * const buffer2 = new uint8_t[dictionary_size];
+    Trial_buffer tbuffer( dictionary_size );
     long pos = std::max( range.pos() - mpos, Lzip_header::size + 1LL );
     const long end = std::min( range.end() - mpos, msize );
     long max_delay = 0;
@@ -314,7 +508,8 @@ int debug_delay( const char * const input_filename,
       const LZ_mtester * master =
         prepare_master( mbuffer, msize, pos_limit, dictionary_size );
       if( !master ) { show_error( "Can't prepare master." );
-                      delete[] buffer2; delete[] mbuffer; return 1; }
+                      delete[] mbuffer; return 1; }
+      tbuffer.reset();
       const long partial_end = std::min( pos + 100, end );
       for( ; pos < partial_end; ++pos )
         {
@@ -329,7 +524,7 @@ int debug_delay( const char * const input_filename,
           ++mbuffer[pos];
           if( j == 255 ) break;
           long failure_pos = 0;
-          if( test_member_rest( *master, buffer2, &failure_pos ) ) continue;
+          if( test_member_rest( *master, tbuffer, &failure_pos ) ) continue;
           const long delay = failure_pos - pos;
           if( delay > max_delay ) { max_delay = delay; value = mbuffer[pos]; }
           }
@@ -343,7 +538,6 @@ int debug_delay( const char * const input_filename,
         }
       delete master;
       }
-    delete[] buffer2;
     delete[] mbuffer;
     print_pending_newline( terminator );
     }
@@ -355,7 +549,7 @@ int debug_delay( const char * const input_filename,
 
 int debug_byte_repair( const char * const input_filename,
                        const Cl_options & cl_opts, const Bad_byte & bad_byte,
-                       const char terminator )
+                       const char terminator, const bool bit_flips_first )
   {
   struct stat in_stats;				// not used
   const int infd = open_instream( input_filename, &in_stats, false, true );
@@ -415,13 +609,14 @@ int debug_byte_repair( const char * const input_filename,
     std::fflush( stdout );
     }
   if( failure_pos >= msize ) failure_pos = msize - 1;
+  const Repair_masks masks( bit_flips_first );
   long pos = repair_dictionary_size( mbuffer, msize );
   if( pos == 0 )
     pos = repair_member( mbuffer, mpos, msize, header.size + 1,
-                         header.size + 6, dictionary_size, terminator );
+                         header.size + 6, dictionary_size, terminator, masks );
   if( pos == 0 )
     pos = repair_member( mbuffer, mpos, msize, header.size + 7,
-                         failure_pos, dictionary_size, terminator );
+                         failure_pos, dictionary_size, terminator, masks );
   print_pending_newline( terminator );
   delete[] mbuffer;
   if( pos < 0 ) { show_error( "Can't prepare master." ); return 1; }
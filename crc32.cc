@@ -0,0 +1,187 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "lzip.h"
+
+/* The hardware kernels are only built if the compiler supports selecting
+   the instruction set per function, so that no special flags are needed
+   and the program still runs on processors lacking the instructions. */
+#if defined __x86_64__ && \
+    ( defined __clang__ || __GNUC__ > 4 || \
+      ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) )
+#define CRC32_PCLMUL
+#include <immintrin.h>
+#elif defined __aarch64__ && defined __ARM_FEATURE_CRC32 && \
+      defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CRC32_ARM
+#include <arm_acle.h>
+#endif
+
+
+const CRC32 crc32;
+
+
+namespace {
+
+#ifdef CRC32_PCLMUL
+/* Fold 4 x 128 bits in parallel using carry-less multiplication, then
+   reduce to 32 bits with Barrett reduction. See "Fast CRC Computation for
+   Generic Polynomials Using PCLMULQDQ Instruction", Intel, 2009.
+   'size' must be a multiple of 16 and >= 64. */
+__attribute__(( target( "pclmul,sse4.1" ) ))
+uint32_t pclmul_update( uint32_t crc, const uint8_t * buffer, long size )
+  {
+  // bit-reflected constants for the polynomial 0x04C11DB7
+  const __m128i k1k2 = _mm_set_epi64x( 0x01C6E41596LL, 0x0154442BD4LL );
+  const __m128i k3k4 = _mm_set_epi64x( 0x00CCAA009ELL, 0x01751997D0LL );
+  const __m128i k5k0 = _mm_set_epi64x( 0, 0x0163CD6124LL );
+  const __m128i poly = _mm_set_epi64x( 0x01F7011641LL, 0x01DB710641LL );
+  const __m128i mask32 = _mm_setr_epi32( ~0, 0, ~0, 0 );
+
+  __m128i x1 = _mm_loadu_si128( (const __m128i *)( buffer + 0x00 ) );
+  __m128i x2 = _mm_loadu_si128( (const __m128i *)( buffer + 0x10 ) );
+  __m128i x3 = _mm_loadu_si128( (const __m128i *)( buffer + 0x20 ) );
+  __m128i x4 = _mm_loadu_si128( (const __m128i *)( buffer + 0x30 ) );
+  x1 = _mm_xor_si128( x1, _mm_cvtsi32_si128( crc ) );
+  buffer += 64; size -= 64;
+
+  while( size >= 64 )			// fold blocks of 64 bytes
+    {
+    const __m128i x5 = _mm_clmulepi64_si128( x1, k1k2, 0x00 );
+    const __m128i x6 = _mm_clmulepi64_si128( x2, k1k2, 0x00 );
+    const __m128i x7 = _mm_clmulepi64_si128( x3, k1k2, 0x00 );
+    const __m128i x8 = _mm_clmulepi64_si128( x4, k1k2, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, k1k2, 0x11 );
+    x2 = _mm_clmulepi64_si128( x2, k1k2, 0x11 );
+    x3 = _mm_clmulepi64_si128( x3, k1k2, 0x11 );
+    x4 = _mm_clmulepi64_si128( x4, k1k2, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128( x1, x5 ),
+           _mm_loadu_si128( (const __m128i *)( buffer + 0x00 ) ) );
+    x2 = _mm_xor_si128( _mm_xor_si128( x2, x6 ),
+           _mm_loadu_si128( (const __m128i *)( buffer + 0x10 ) ) );
+    x3 = _mm_xor_si128( _mm_xor_si128( x3, x7 ),
+           _mm_loadu_si128( (const __m128i *)( buffer + 0x20 ) ) );
+    x4 = _mm_xor_si128( _mm_xor_si128( x4, x8 ),
+           _mm_loadu_si128( (const __m128i *)( buffer + 0x30 ) ) );
+    buffer += 64; size -= 64;
+    }
+
+  __m128i x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );	// fold to 128 bits
+  x1 = _mm_clmulepi64_si128( x1, k3k4, 0x11 );
+  x1 = _mm_xor_si128( _mm_xor_si128( x1, x2 ), x5 );
+  x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+  x1 = _mm_clmulepi64_si128( x1, k3k4, 0x11 );
+  x1 = _mm_xor_si128( _mm_xor_si128( x1, x3 ), x5 );
+  x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+  x1 = _mm_clmulepi64_si128( x1, k3k4, 0x11 );
+  x1 = _mm_xor_si128( _mm_xor_si128( x1, x4 ), x5 );
+
+  while( size >= 16 )			// fold blocks of 16 bytes
+    {
+    x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, k3k4, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128( x1, x5 ),
+           _mm_loadu_si128( (const __m128i *)buffer ) );
+    buffer += 16; size -= 16;
+    }
+
+  x2 = _mm_clmulepi64_si128( x1, k3k4, 0x10 );		// fold to 64 bits
+  x1 = _mm_xor_si128( _mm_srli_si128( x1, 8 ), x2 );
+  x2 = _mm_srli_si128( x1, 4 );
+  x1 = _mm_and_si128( x1, mask32 );
+  x1 = _mm_clmulepi64_si128( x1, k5k0, 0x00 );
+  x1 = _mm_xor_si128( x1, x2 );
+
+  x2 = _mm_and_si128( x1, mask32 );			// Barrett reduction
+  x2 = _mm_clmulepi64_si128( x2, poly, 0x10 );
+  x2 = _mm_and_si128( x2, mask32 );
+  x2 = _mm_clmulepi64_si128( x2, poly, 0x00 );
+  x1 = _mm_xor_si128( x1, x2 );
+  return _mm_extract_epi32( x1, 1 );
+  }
+#endif
+
+#ifdef CRC32_ARM
+// ARMv8 CRC32 instructions use the same polynomial as lzip
+uint32_t arm_update( uint32_t crc, const uint8_t * buffer, long size )
+  {
+  for( ; size >= 8; buffer += 8, size -= 8 )
+    {
+    uint64_t word;
+    std::memcpy( &word, buffer, 8 );
+    crc = __crc32d( crc, word );
+    }
+  return crc;
+  }
+#endif
+
+} // end namespace
+
+
+CRC32::CRC32() : hw_update( 0 )
+  {
+  for( unsigned n = 0; n < 256; ++n )
+    {
+    unsigned c = n;
+    for( int k = 0; k < 8; ++k )
+      { if( c & 1 ) c = 0xEDB88320U ^ ( c >> 1 ); else c >>= 1; }
+    data[0][n] = c;
+    }
+  for( unsigned n = 0; n < 256; ++n )
+    for( int k = 1; k < 8; ++k )
+      data[k][n] = data[0][data[k-1][n]&0xFF] ^ ( data[k-1][n] >> 8 );
+#ifdef CRC32_PCLMUL
+  __builtin_cpu_init();		// needed in static constructors
+  if( __builtin_cpu_supports( "pclmul" ) && __builtin_cpu_supports( "sse4.1" ) )
+    hw_update = pclmul_update;
+#endif
+#ifdef CRC32_ARM
+  hw_update = arm_update;
+#endif
+  }
+
+
+/* Slicing-by-8 processes 8 bytes per iteration. The bytes are combined
+   explicitly, so the result does not depend on the endianness. */
+void CRC32::update_buf( uint32_t & crc, const uint8_t * const buffer,
+                        const int size ) const
+  {
+  uint32_t c = crc;
+  int i = 0;
+  if( hw_update && size >= 64 )
+    { i = size & ~15; c = hw_update( c, buffer, i ); }
+  for( ; i + 8 <= size; i += 8 )
+    {
+    c ^= buffer[i] | ( buffer[i+1] << 8 ) | ( buffer[i+2] << 16 ) |
+         ( (uint32_t)buffer[i+3] << 24 );
+    c = data[7][c&0xFF] ^ data[6][(c>>8)&0xFF] ^ data[5][(c>>16)&0xFF] ^
+        data[4][c>>24] ^ data[3][buffer[i+4]] ^ data[2][buffer[i+5]] ^
+        data[1][buffer[i+6]] ^ data[0][buffer[i+7]];
+    }
+  for( ; i < size; ++i )
+    c = data[0][(c^buffer[i])&0xFF] ^ ( c >> 8 );
+  crc = c;
+  }
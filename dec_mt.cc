@@ -0,0 +1,344 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <queue>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "lzip.h"
+#include "decoder.h"
+#include "lzip_index.h"
+#include "threads.h"
+
+
+namespace {
+
+struct Packet			// data block decoded by a worker
+  {
+  uint8_t * data;
+  int size;
+  Packet() : data( 0 ), size( 0 ) {}
+  Packet( uint8_t * const d, const int s ) : data( d ), size( s ) {}
+  };
+
+
+struct Member_slot		// output of a member being decoded
+  {
+  std::queue< Packet > packet_queue;
+  long member;			// index of member, or -1 if slot is free
+  int result;			// result of decode_member, -1 if not finished
+  Member_slot() : member( -1 ), result( -1 ) {}
+  };
+
+
+/* Moves the packets from the workers to the muxer in member order.
+   Member i is decoded into slot i % num_slots, and no member is decoded
+   until the member num_slots positions before it has been delivered. */
+class Packet_courier
+  {
+  const long end_member;	// one past the last member to be decoded
+  const unsigned max_packets;	// max packets queued per member
+  long next_member;		// next member to be decoded by a worker
+  long deliver_member;		// next member to be delivered to the muxer
+  std::vector< Member_slot > slot_vector;
+  pthread_mutex_t omutex;
+  pthread_cond_t oav_or_exit;	// output packet available or member done
+  pthread_cond_t slot_av;	// free slot or free space in a queue
+  bool aborted;
+
+  Packet_courier( const Packet_courier & );	// declared as private
+  void operator=( const Packet_courier & );	// declared as private
+
+public:
+  Packet_courier( const long first, const long last, const int slots,
+                  const unsigned max_pkts )
+    : end_member( last ), max_packets( max_pkts ), next_member( first ),
+      deliver_member( first ), slot_vector( slots ), aborted( false )
+    {
+    xinit_mutex( &omutex ); xinit_cond( &oav_or_exit ); xinit_cond( &slot_av );
+    }
+
+  ~Packet_courier()
+    {
+    for( unsigned i = 0; i < slot_vector.size(); ++i )
+      while( !slot_vector[i].packet_queue.empty() )
+        { delete[] slot_vector[i].packet_queue.front().data;
+          slot_vector[i].packet_queue.pop(); }
+    xdestroy_cond( &slot_av ); xdestroy_cond( &oav_or_exit );
+    xdestroy_mutex( &omutex );
+    }
+
+  // Return the index of the next member to be decoded, or -1 if none.
+  long get_member()
+    {
+    long member = -1;
+    xlock( &omutex );
+    while( !aborted && next_member < end_member &&
+           next_member >= deliver_member + (long)slot_vector.size() )
+      xwait( &slot_av, &omutex );
+    if( !aborted && next_member < end_member )
+      {
+      member = next_member++;
+      Member_slot & slot = slot_vector[member%slot_vector.size()];
+      slot.member = member; slot.result = -1;
+      }
+    xunlock( &omutex );
+    return member;
+    }
+
+  // Return false if aborted. The caller still owns the packet in that case.
+  bool put_packet( const long member, const Packet & packet )
+    {
+    xlock( &omutex );
+    Member_slot & slot = slot_vector[member%slot_vector.size()];
+    while( !aborted && slot.packet_queue.size() >= max_packets )
+      xwait( &slot_av, &omutex );
+    const bool done = !aborted;
+    if( done )
+      {
+      slot.packet_queue.push( packet );
+      if( member == deliver_member ) xsignal( &oav_or_exit );
+      }
+    xunlock( &omutex );
+    return done;
+    }
+
+  void finish_member( const long member, const int result )
+    {
+    xlock( &omutex );
+    slot_vector[member%slot_vector.size()].result = result;
+    if( member == deliver_member ) xsignal( &oav_or_exit );
+    xunlock( &omutex );
+    }
+
+  /* Get the next packet of the member being delivered. If the member is
+     finished and there are no more packets, return false, set 'result',
+     and advance to the next member. */
+  bool get_packet( Packet & packet, int & result )
+    {
+    bool got = false;
+    xlock( &omutex );
+    Member_slot & slot = slot_vector[deliver_member%slot_vector.size()];
+    while( slot.member != deliver_member ||
+           ( slot.packet_queue.empty() && slot.result < 0 ) )
+      xwait( &oav_or_exit, &omutex );
+    if( !slot.packet_queue.empty() )
+      { packet = slot.packet_queue.front(); slot.packet_queue.pop();
+        got = true; }
+    else
+      { result = slot.result; slot.member = -1; ++deliver_member; }
+    xbroadcast( &slot_av );
+    xunlock( &omutex );
+    return got;
+    }
+
+  void abort()			// make the workers exit as soon as possible
+    {
+    xlock( &omutex );
+    aborted = true;
+    xbroadcast( &slot_av );
+    xunlock( &omutex );
+    }
+  };
+
+
+struct Aborted {};		// thrown by Courier_sink to stop a worker
+
+class Courier_sink : public Data_sink
+  {
+  Packet_courier & courier;
+  const long member;
+
+public:
+  Courier_sink( Packet_courier & c, const long m ) : courier( c ), member( m ) {}
+
+  void write_data( const uint8_t * const buf, const int size )
+    {
+    if( size <= 0 ) return;
+    uint8_t * const data = new uint8_t[size];
+    std::memcpy( data, buf, size );
+    if( !courier.put_packet( member, Packet( data, size ) ) )
+      { delete[] data; throw Aborted(); }
+    }
+  };
+
+
+struct Worker_arg
+  {
+  const Lzip_index * lzip_index;
+  Packet_courier * courier;
+  const Cl_options * cl_opts;
+  int infd;
+  bool testing;
+  bool verbose;			// verbosity >= 1 before entering dec_mt
+  };
+
+
+/* Decode members in any order and pass the results to the courier.
+   Any member with problems is reported as failed (result != 0) so that
+   the serial decoder can produce the corresponding messages. */
+extern "C" void * dworker( void * arg )
+  {
+  const Worker_arg & tmp = *(const Worker_arg *)arg;
+  const Lzip_index & lzip_index = *tmp.lzip_index;
+  Packet_courier & courier = *tmp.courier;
+  const Pretty_print pp( "" );		// verbosity is -1 here
+
+  while( true )
+    {
+    const long i = courier.get_member();
+    if( i < 0 ) break;
+    const Block & mb = lzip_index.mblock( i );
+    int result = 7;
+    try {
+      Range_decoder rdec( tmp.infd, mb.pos(), mb.end() );
+      Lzip_header header;	// may be bad if lzip_index ignores gaps
+      if( rdec.read_data( header.data, header.size ) == header.size &&
+          header.check() )
+        {
+        const unsigned dictionary_size = header.dictionary_size();
+        if( tmp.testing )
+          {
+          LZ_decoder decoder( rdec, dictionary_size, -1 );
+          result = decoder.decode_member( *tmp.cl_opts, pp );
+          }
+        else
+          {
+          Courier_sink sink( courier, i );
+          LZ_decoder decoder( rdec, dictionary_size, sink );
+          result = decoder.decode_member( *tmp.cl_opts, pp );
+          }
+        // let the serial decoder warn about the final code
+        if( result == 0 && tmp.verbose && rdec.get_code() != 0 ) result = 7;
+        }
+      }
+    catch( Aborted & ) { break; }
+    catch( std::bad_alloc & ) { result = 7; }
+    catch( Error & ) { result = 7; }
+    courier.finish_member( i, result );
+    }
+  return 0;
+  }
+
+
+void join_workers( Packet_courier & courier,
+                   const std::vector< pthread_t > & worker_threads )
+  {
+  courier.abort();
+  for( unsigned i = 0; i < worker_threads.size(); ++i )
+    xjoin( worker_threads[i] );
+  }
+
+} // end namespace
+
+
+/* Decode (or test) the members [first, last) of lzip_index from the
+   regular file infd using num_workers worker threads, writing the data to
+   outfd in member order. Stop at the first member that fails, produces any
+   message, or does not produce the data size of its dblock, and return its
+   index (or last), so that the serial decoder can take over from there and
+   produce exactly the same messages and data. 'outskip' is set to the
+   amount of data of the returned member already written to outfd. */
+long dec_members_mt( const int infd, const Lzip_index & lzip_index,
+                     const Cl_options & cl_opts, const long first,
+                     const long last, const bool testing,
+                     const int num_workers, unsigned long long & outskip )
+  {
+  enum { max_packets = 4 };	// max packets queued per member
+  outskip = 0;
+  const int workers = limit_workers( std::min( (long)num_workers, last - first ),
+                                     lzip_index.dictionary_size() );
+  Packet_courier courier( first, last, workers, max_packets );
+  Worker_arg worker_arg;
+  worker_arg.lzip_index = &lzip_index;
+  worker_arg.courier = &courier;
+  worker_arg.cl_opts = &cl_opts;
+  worker_arg.infd = infd;
+  worker_arg.testing = testing;
+  worker_arg.verbose = verbosity >= 1;
+
+  const int saved_verbosity = verbosity;
+  verbosity = -1;		// workers must not print anything
+  std::vector< pthread_t > worker_threads( workers );
+  for( int i = 0; i < workers; ++i )
+    xcreate( &worker_threads[i], dworker, &worker_arg );
+
+  long i = first;			// member being delivered
+  try {
+    for( ; i < last; ++i )
+      {
+      Packet packet;
+      int result = 0;
+      while( courier.get_packet( packet, result ) )
+        {
+        if( !testing && writeblock( outfd, packet.data, packet.size ) != packet.size )
+          { delete[] packet.data; throw Error( "Write error" ); }
+        outskip += packet.size;
+        delete[] packet.data;
+        }
+      if( result != 0 ||
+          outskip != (unsigned long long)lzip_index.dblock( i ).size() ) break;
+      outskip = 0;
+      }
+    }
+  catch( Error & )
+    { join_workers( courier, worker_threads ); verbosity = saved_verbosity;
+      throw; }
+  join_workers( courier, worker_threads );
+  verbosity = saved_verbosity;
+  return i;
+  }
+
+
+/* Decode (or test) the members of the regular file infd using num_workers
+   worker threads, writing the data to outfd in member order.
+   Stop at the first member that fails or produces any message, and return
+   the file position of that member (or the end of the last member) with
+   infd positioned there, so that the serial decoder can take over from
+   there and produce exactly the same messages and data. 'outskip' is set
+   to the amount of data of the failed member already written to outfd. */
+unsigned long long dec_mt( const int infd, const Cl_options & cl_opts,
+                           const Pretty_print & pp, const bool testing,
+                           const int num_workers,
+                           unsigned long long & outskip )
+  {
+  outskip = 0;
+  const Lzip_index lzip_index( infd, cl_opts );
+  if( lzip_index.retval() != 0 || lzip_index.members() < 2 )
+    {
+    if( lseek( infd, 0, SEEK_SET ) != 0 ) throw Error( "Seek error" );
+    return 0;
+    }
+  if( verbosity == 1 ) pp();
+
+  const long i = dec_members_mt( infd, lzip_index, cl_opts, 0,
+                      lzip_index.members(), testing, num_workers, outskip );
+  const long long pos = ( i < lzip_index.members() ) ?
+                        lzip_index.mblock( i ).pos() : lzip_index.cdata_size();
+  if( lseek( infd, pos, SEEK_SET ) != pos ) throw Error( "Seek error" );
+  return pos;
+  }
@@ -22,6 +22,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <queue>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -29,9 +30,8 @@
 
 #include "lzip.h"
 #include "decoder.h"
-
-
-const CRC32 crc32;
+#include "threads.h"
+#include "async_io.h"
 
 
 /* Return the number of bytes really read.
@@ -49,6 +49,29 @@ long readblock( const int fd, uint8_t * const buf, const long size )
     else if( errno != EINTR ) break;
     errno = 0;
     }
+  stat_add( st_bytes_read, sz );
+  return sz;
+  }
+
+
+/* Return the number of bytes really read starting at file offset 'pos'.
+   If (value returned < size) and (errno == 0), means EOF was reached.
+   The file offset of 'fd' is not modified.
+*/
+long preadblock( const int fd, uint8_t * const buf, const long size,
+                 const long long pos )
+  {
+  long sz = 0;
+  errno = 0;
+  while( sz < size )
+    {
+    const long n = pread( fd, buf + sz, size - sz, pos + sz );
+    if( n > 0 ) sz += n;
+    else if( n == 0 ) break;				// EOF
+    else if( errno != EINTR ) break;
+    errno = 0;
+    }
+  stat_add( st_bytes_read, sz );
   return sz;
   }
 
@@ -67,42 +90,139 @@ long writeblock( const int fd, const uint8_t * const buf, const long size )
     else if( n < 0 && errno != EINTR ) break;
     errno = 0;
     }
+  stat_add( st_bytes_written, sz );
+  return sz;
+  }
+
+
+/* Return the number of bytes really written starting at file offset 'pos'.
+   If (value returned < size), it is always an error.
+   The file offset of 'fd' is not modified.
+*/
+long pwriteblock( const int fd, const uint8_t * const buf, const long size,
+                  const long long pos )
+  {
+  long sz = 0;
+  errno = 0;
+  while( sz < size )
+    {
+    const long n = pwrite( fd, buf + sz, size - sz, pos + sz );
+    if( n > 0 ) sz += n;
+    else if( n < 0 && errno != EINTR ) break;
+    errno = 0;
+    }
+  stat_add( st_bytes_written, sz );
   return sz;
   }
 
 
+Range_decoder::Range_decoder( const int ifd, const int async_size,
+                              const uint8_t * const imap,
+                              const long long isize )
+  :
+  buffer_size( imap ? mapped_block_size :
+               ( async_size > 0 ) ? async_size : default_buffer_size ),
+  partial_member_pos( 0 ),
+  buffer( ( imap || async_size > 0 ) ? 0 : new uint8_t[buffer_size] ),
+  pos( 0 ),
+  stream_pos( 0 ),
+  code( 0 ),
+  range( 0xFFFFFFFFU ),
+  infd( ifd ),
+  file_pos( imap ? 0 : -1 ),
+  file_end( imap ? isize : -1 ),
+  prefetcher( ( async_size > 0 && !imap ) ?
+              new Input_prefetcher( ifd, async_size ) : 0 ),
+  map( imap ),
+  at_stream_end( false )
+  {}
+
+
+Range_decoder::~Range_decoder()
+  { delete prefetcher; if( !map ) delete[] buffer; }
+
+
 bool Range_decoder::read_block()
   {
   if( !at_stream_end )
     {
-    stream_pos = readblock( infd, buffer, buffer_size );
+    if( prefetcher ) stream_pos = prefetcher->get_block( buffer );
+    else if( map )			// point buffer into the mapped file
+      {
+      stream_pos = std::min( (long long)buffer_size, file_end - file_pos );
+      buffer = (uint8_t *)map + file_pos;
+      file_pos += stream_pos;
+      stat_add( st_bytes_read, stream_pos );
+      errno = 0;
+      }
+    else if( file_pos < 0 )
+      stream_pos = readblock( infd, buffer, buffer_size );
+    else
+      {
+      const int size = std::min( (long long)buffer_size, file_end - file_pos );
+      stream_pos = preadblock( infd, buffer, size, file_pos );
+      file_pos += stream_pos;
+      }
     if( stream_pos != buffer_size && errno ) throw Error( "Read error" );
     at_stream_end = ( stream_pos < buffer_size );
     partial_member_pos += pos;
     pos = 0;
-    show_dprogress();
+    if( file_pos < 0 || map ) show_dprogress();
     }
   return pos < stream_pos;
   }
 
 
+/* Move forward the window of the mapped output, keeping behind pos the
+   last dictionary_size bytes decoded. If the member does not fit in its
+   part of the output (corrupt data), decode the rest of the member into a
+   circular buffer, discarding the data. */
+void LZ_decoder::move_window()
+  {
+  const unsigned keep = std::min( dictionary_size, pos );
+  uint8_t * const base = buffer + ( pos - keep );
+  if( map_end - base > keep )
+    {
+    buffer = base;
+    buffer_size = std::min( (long long)( map_end - base ),
+                            (long long)keep + map_step );
+    partial_data_pos += pos - keep; pos = keep;
+    return;
+    }
+  uint8_t * const b = new_dictionary( dictionary_size );
+  std::memcpy( b, base, keep );
+  buffer = b; buffer_size = dictionary_size; map_end = 0;
+  const unsigned new_pos = ( keep < dictionary_size ) ? keep : 0;
+  partial_data_pos += pos - new_pos; pos = new_pos;
+  if( new_pos == 0 ) pos_wrapped = true;
+  }
+
+
 void LZ_decoder::flush_data()
   {
   if( pos > stream_pos )
     {
     const int size = pos - stream_pos;
     crc32.update_buf( crc_, buffer + stream_pos, size );
-    if( outfd >= 0 )
+    if( digest ) digest->write_data( buffer + stream_pos, size );
+    if( sink || outfd >= 0 )
       {
       const unsigned long long sp = stream_position();
       const long long i = positive_diff( outskip, sp );
       const long long s =
         std::min( positive_diff( outend, sp ), (unsigned long long)size ) - i;
-      if( s > 0 && writeblock( outfd, buffer + stream_pos + i, s ) != s )
-        throw Error( "Write error" );
+      if( s > 0 )
+        {
+        if( sink ) sink->write_data( buffer + stream_pos + i, s );
+        else if( writeblock( outfd, buffer + stream_pos + i, s ) != s )
+          throw Error( "Write error" );
+        }
+      }
+    if( pos >= buffer_size )
+      {
+      if( map_end ) move_window();
+      else { partial_data_pos += pos; pos = 0; pos_wrapped = true; }
       }
-    if( pos >= dictionary_size )
-      { partial_data_pos += pos; pos = 0; pos_wrapped = true; }
     stream_pos = pos;
     }
   }
@@ -183,7 +303,7 @@ int LZ_decoder::check_trailer( const Pretty_print & pp,
                  3 = trailer error, 4 = unknown marker found,
                  5 = empty member found, 6 = marked member found. */
 int LZ_decoder::decode_member( const Cl_options & cl_opts,
-                               const Pretty_print & pp )
+                               const Pretty_print & pp, const bool lzma_alone )
   {
   Bit_model bm_literal[1<<literal_context_bits][0x300];
   Bit_model bm_match[State::states][pos_states];
@@ -267,7 +387,7 @@ int LZ_decoder::decode_member( const Cl_options & cl_opts,
             rdec.normalize();
             flush_data();
             if( len == min_match_len )		// End Of Stream marker
-              return check_trailer( pp, cl_opts.ignore_empty );
+              return lzma_alone ? 0 : check_trailer( pp, cl_opts.ignore_empty );
             if( len == min_match_len + 1 )	// Sync Flush marker
               { rdec.load(); continue; }
             if( verbosity >= 0 )
@@ -280,6 +400,7 @@ int LZ_decoder::decode_member( const Cl_options & cl_opts,
           }
         }
       rep3 = rep2; rep2 = rep1; rep1 = rep0; rep0 = distance;
+      if( rep0 > max_rep0 ) max_rep0 = rep0;
       state.set_match();
       if( rep0 >= dictionary_size || ( rep0 >= pos && !pos_wrapped ) )
         { flush_data(); return 1; }
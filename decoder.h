@@ -15,16 +15,23 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+class Input_prefetcher;
+
 class Range_decoder
   {
-  enum { buffer_size = 16384 };
+  enum { default_buffer_size = 16384, mapped_block_size = 1 << 20 };
+  const int buffer_size;
   unsigned long long partial_member_pos;
-  uint8_t * const buffer;	// input buffer
+  uint8_t * buffer;		// input buffer
   int pos;			// current pos in buffer
   int stream_pos;		// when reached, a new block must be read
   uint32_t code;
   uint32_t range;
   const int infd;		// input file descriptor
+  long long file_pos;		// if >= 0, read from here with pread
+  const long long file_end;	// end of region to read with pread
+  Input_prefetcher * const prefetcher;	// if not null, read in a thread
+  const uint8_t * const map;	// if not null, file mapped in memory
   bool at_stream_end;
 
   bool read_block();
@@ -33,8 +40,18 @@ class Range_decoder
   void operator=( const Range_decoder & );	// declared as private
 
 public:
-  explicit Range_decoder( const int ifd )
+  /* If async_size > 0, read blocks of async_size bytes in a thread while
+     the previous block is decoded.
+     If imap is not null, decode the isize bytes at imap instead of reading
+     ifd. The blocks are not copied. */
+  explicit Range_decoder( const int ifd, const int async_size = 0,
+                          const uint8_t * const imap = 0,
+                          const long long isize = 0 );
+
+  // read only the region [ipos,iend) of ifd; file offset is not modified
+  Range_decoder( const int ifd, const long long ipos, const long long iend )
     :
+    buffer_size( default_buffer_size ),
     partial_member_pos( 0 ),
     buffer( new uint8_t[buffer_size] ),
     pos( 0 ),
@@ -42,10 +59,14 @@ public:
     code( 0 ),
     range( 0xFFFFFFFFU ),
     infd( ifd ),
+    file_pos( ipos ),
+    file_end( iend ),
+    prefetcher( 0 ),
+    map( 0 ),
     at_stream_end( false )
     {}
 
-  ~Range_decoder() { delete[] buffer; }
+  ~Range_decoder();
 
   unsigned get_code() const { return code; }
   bool finished() { return pos >= stream_pos && !read_block(); }
@@ -288,6 +309,14 @@ len3:
   };
 
 
+class Data_sink		// receives the data decoded by LZ_decoder
+  {
+public:
+  virtual void write_data( const uint8_t * const buf, const int size ) = 0;
+  virtual ~Data_sink() {}
+  };
+
+
 class LZ_decoder
   {
   const unsigned long long outskip;
@@ -295,32 +324,39 @@ class LZ_decoder
   unsigned long long partial_data_pos;
   Range_decoder & rdec;
   const unsigned dictionary_size;
-  uint8_t * const buffer;	// output buffer
+  uint8_t * buffer;		// output buffer, or window of mapped output
+  unsigned buffer_size;		// dictionary_size if not mapped
+  uint8_t * map_end;		// if not null, end of member in mapped output
   unsigned pos;			// current pos in buffer
   unsigned stream_pos;		// first byte not yet written to file
   uint32_t crc_;
   const int outfd;		// output file descriptor
+  Data_sink * const sink;	// if not null, send data here instead of outfd
+  Data_sink * const digest;	// if not null, send also all the data here
+  unsigned max_rep0;		// maximum distance found
   bool pos_wrapped;
 
+  enum { map_step = 1 << 20 };	// growth of the window of mapped output
+
   unsigned long long stream_position() const
     { return partial_data_pos + stream_pos; }
+  void move_window();
   void flush_data();
   int check_trailer( const Pretty_print & pp, const bool ignore_empty ) const;
 
   uint8_t peek_prev() const
-    { return buffer[((pos > 0) ? pos : dictionary_size)-1]; }
+    { return buffer[((pos > 0) ? pos : buffer_size)-1]; }
+
+  unsigned peek_index( const unsigned distance ) const
+    { return ( ( pos > distance ) ? 0 : buffer_size ) + pos - distance - 1; }
 
   uint8_t peek( const unsigned distance ) const
-    {
-    const unsigned i = ( ( pos > distance ) ? 0 : dictionary_size ) +
-                       pos - distance - 1;
-    return buffer[i];
-    }
+    { return buffer[peek_index( distance )]; }
 
   void put_byte( const uint8_t b )
     {
     buffer[pos] = b;
-    if( ++pos >= dictionary_size ) flush_data();
+    if( ++pos >= buffer_size ) flush_data();
     }
 
   void copy_block( const unsigned distance, unsigned len )
@@ -329,13 +365,13 @@ class LZ_decoder
     bool fast, fast2;
     if( lpos > distance )
       {
-      fast = ( len < dictionary_size - lpos );
+      fast = ( len < buffer_size - lpos );
       fast2 = ( fast && len <= lpos - i );
       }
     else
       {
-      i += dictionary_size;
-      fast = ( len < dictionary_size - i );	// (i == pos) may happen
+      i += buffer_size;
+      fast = ( len < buffer_size - i );	// (i == pos) may happen
       fast2 = ( fast && len <= i - lpos );
       }
     if( fast )					// no wrap
@@ -349,8 +385,9 @@ class LZ_decoder
     else for( ; len > 0; --len )
       {
       buffer[pos] = buffer[i];
-      if( ++pos >= dictionary_size ) flush_data();
-      if( ++i >= dictionary_size ) i = 0;
+      // flush_data may move the buffer
+      if( ++pos >= buffer_size ) { flush_data(); i = peek_index( distance ); }
+      else if( ++i >= buffer_size ) i = 0;
       }
     }
 
@@ -358,30 +395,67 @@ class LZ_decoder
   void operator=( const LZ_decoder & );		// declared as private
 
 public:
+  /* if ds is not null, the data in [oskip,oend) are sent to ds
+     if dg is not null, all the data decoded are sent to dg
+     if mbegin is not null, the data are decoded directly into the mapped
+     output [mbegin,mend), which must be zeroed and at least one byte larger
+     than the data of the member, using the data already decoded as
+     dictionary; ofd must be -1 and ds null */
   LZ_decoder( Range_decoder & rde, const unsigned dict_size, const int ofd,
               const unsigned long long oskip = 0,
-              const unsigned long long oend = -1ULL )
+              const unsigned long long oend = -1ULL, Data_sink * const ds = 0,
+              Data_sink * const dg = 0, uint8_t * const mbegin = 0,
+              uint8_t * const mend = 0 )
     :
     outskip( oskip ),
     outend( oend ),
     partial_data_pos( 0 ),
     rdec( rde ),
     dictionary_size( dict_size ),
-    buffer( new uint8_t[dictionary_size] ),
+    buffer( mbegin ? mbegin : new_dictionary( dictionary_size ) ),
+    buffer_size( mbegin ? std::min( (long long)( mend - mbegin ),
+                                    (long long)map_step ) : dictionary_size ),
+    map_end( mbegin ? mend : 0 ),
     pos( 0 ),
     stream_pos( 0 ),
     crc_( 0xFFFFFFFFU ),
     outfd( ofd ),
+    sink( ds ),
+    digest( dg ),
+    max_rep0( 0 ),
     pos_wrapped( false )
     // prev_byte of first byte; also for peek( 0 ) on corrupt file
+    { if( !map_end ) buffer[dictionary_size-1] = 0; }
+
+  LZ_decoder( Range_decoder & rde, const unsigned dict_size, Data_sink & ds )
+    :
+    outskip( 0 ),
+    outend( -1ULL ),
+    partial_data_pos( 0 ),
+    rdec( rde ),
+    dictionary_size( dict_size ),
+    buffer( new_dictionary( dictionary_size ) ),
+    buffer_size( dictionary_size ),
+    map_end( 0 ),
+    pos( 0 ),
+    stream_pos( 0 ),
+    crc_( 0xFFFFFFFFU ),
+    outfd( -1 ),
+    sink( &ds ),
+    digest( 0 ),
+    max_rep0( 0 ),
+    pos_wrapped( false )
     { buffer[dictionary_size-1] = 0; }
 
-  ~LZ_decoder() { delete[] buffer; }
+  ~LZ_decoder() { if( !map_end ) delete_dictionary( buffer, dictionary_size ); }
 
   unsigned crc() const { return crc_ ^ 0xFFFFFFFFU; }
   unsigned long long data_position() const { return partial_data_pos + pos; }
+  unsigned max_distance() const { return max_rep0 + 1; }
 
-  int decode_member( const Cl_options & cl_opts, const Pretty_print & pp );
+  // if lzma_alone, the stream has no trailer and ends at the EOS marker
+  int decode_member( const Cl_options & cl_opts, const Pretty_print & pp,
+                     const bool lzma_alone = false );
   int decode_member()
     { return decode_member( Cl_options(), Pretty_print( "" ) ); }
   };
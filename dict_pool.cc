@@ -0,0 +1,172 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "lzip.h"
+#include "threads.h"
+
+
+namespace {
+
+#if defined MAP_ANONYMOUS && defined MADV_HUGEPAGE
+#define DICT_MMAP
+#endif
+
+struct Free_dictionary
+  {
+  uint8_t * buffer;
+  unsigned size;
+  };
+
+/* Dictionaries freed, most recent last. They are reused by later members
+   and trials with the same dictionary size, avoiding the page faults of
+   touching a newly allocated buffer. */
+std::vector< Free_dictionary > free_dictionaries;
+unsigned long long cached_bytes = 0;	// total size of free_dictionaries
+unsigned long long memory_limit = 0;	// 0 = no limit
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+enum { max_cached = 16,			// buffers
+       mmap_threshold = 1 << 21 };	// 2 MiB, the usual huge page size
+
+/* Return the maximum size of the pool. If no memory limit was given, use a
+   quarter of the memory budget, bounded by the address space. */
+unsigned long long max_cached_bytes()
+  {
+  if( memory_limit ) return memory_limit;
+  static const unsigned long long default_max_cached_bytes =
+    std::min( ( sizeof (void *) > 4 ) ? 1ULL << 32 : 1ULL << 27,
+              memory_budget() / 4 );
+  return default_max_cached_bytes;
+  }
+
+
+/* Large buffers are mapped directly and marked as candidates for
+   transparent huge pages, which reduces the number of TLB misses and
+   page faults when decoding with large dictionaries. */
+uint8_t * allocate( const unsigned size )
+  {
+#ifdef DICT_MMAP
+  if( size >= mmap_threshold )
+    {
+    void * const p = mmap( 0, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( p == MAP_FAILED ) throw std::bad_alloc();
+    madvise( p, size, MADV_HUGEPAGE );		// errors are ignored
+    return (uint8_t *)p;
+    }
+#endif
+  return new uint8_t[size];
+  }
+
+
+void release( uint8_t * const buffer, const unsigned size )
+  {
+#ifdef DICT_MMAP
+  if( size >= mmap_threshold ) { munmap( buffer, size ); return; }
+#endif
+  delete[] buffer;
+  }
+
+} // end namespace
+
+
+uint8_t * new_dictionary( const unsigned size )
+  {
+  xlock( &pool_mutex );
+  for( unsigned i = free_dictionaries.size(); i > 0; --i )
+    if( free_dictionaries[i-1].size == size )
+      {
+      uint8_t * const buffer = free_dictionaries[i-1].buffer;
+      free_dictionaries.erase( free_dictionaries.begin() + ( i - 1 ) );
+      cached_bytes -= size;
+      xunlock( &pool_mutex );
+      stat_add( st_dict_reuses );
+      return buffer;
+      }
+  xunlock( &pool_mutex );
+  stat_add( st_dict_allocs );
+  return allocate( size );
+  }
+
+
+/* Keep the buffer for reuse unless the pool is full. If the pool is full,
+   the oldest buffer is released to make room for the new one. */
+void delete_dictionary( uint8_t * const buffer, const unsigned size )
+  {
+  if( !buffer ) return;
+  const unsigned long long max_bytes = max_cached_bytes();
+  if( size > max_bytes ) { release( buffer, size ); return; }
+  std::vector< Free_dictionary > old;		// released after unlocking
+  xlock( &pool_mutex );
+  while( !free_dictionaries.empty() &&
+         ( free_dictionaries.size() >= max_cached ||
+           cached_bytes + size > max_bytes ) )
+    {
+    old.push_back( free_dictionaries.front() );
+    cached_bytes -= free_dictionaries.front().size;
+    free_dictionaries.erase( free_dictionaries.begin() );
+    }
+  Free_dictionary fd;
+  fd.buffer = buffer; fd.size = size;
+  free_dictionaries.push_back( fd );
+  cached_bytes += size;
+  xunlock( &pool_mutex );
+  for( unsigned i = 0; i < old.size(); ++i )
+    release( old[i].buffer, old[i].size );
+  }
+
+
+void set_memory_limit( const unsigned long long limit )
+  { memory_limit = limit; }
+
+
+/* Return the memory limit or, if no limit was given, half the physical
+   memory, bounded by the address space. */
+unsigned long long memory_budget()
+  {
+  if( memory_limit ) return memory_limit;
+  unsigned long long budget = ( sizeof (void *) > 4 ) ? 1ULL << 40 : 1ULL << 29;
+#if defined _SC_PHYS_PAGES && defined _SC_PAGESIZE
+  const long pages = sysconf( _SC_PHYS_PAGES );
+  const long page_size = sysconf( _SC_PAGESIZE );
+  if( pages > 0 && page_size > 0 )
+    budget = std::min( budget, (unsigned long long)pages * page_size / 2 );
+#endif
+  return budget;
+  }
+
+
+/* Return the number of workers, each needing worker_size bytes of memory,
+   that fit in the memory limit (at least 1, at most num_workers). */
+int limit_workers( const int num_workers, const unsigned long long worker_size )
+  {
+  if( memory_limit == 0 || worker_size == 0 ) return num_workers;
+  return std::max( 1ULL, std::min( (unsigned long long)num_workers,
+                                   memory_limit / worker_size ) );
+  }
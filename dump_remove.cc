@@ -24,6 +24,7 @@
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <utime.h>
 #include <sys/stat.h>
@@ -166,8 +167,34 @@ int dump_members( const std::vector< std::string > & filenames,
   }
 
 
+namespace {
+
+/* Try to remove from the file in place the bytes from pos to end, which
+   are no longer needed, without copying the data that follow them.
+   Return true if the range was removed. The filesystem may require pos and
+   end to be multiples of its block size, and end to be before EOF. */
+bool collapse_range( const int fd, const long long pos, const long long end )
+  {
+#ifdef FALLOC_FL_COLLAPSE_RANGE
+  if( end <= pos ) return false;
+  int result;
+  do result = fallocate( fd, FALLOC_FL_COLLAPSE_RANGE, pos, end - pos );
+    while( result != 0 && errno == EINTR );
+  errno = 0;
+  return result == 0;
+#else
+  return false;
+#endif
+  }
+
+} // end namespace
+
+
 /* Remove members, tdata from files in place by opening two descriptors for
-   each file. */
+   each file. Where the filesystem allows it, the removed ranges are
+   collapsed instead of copying the data that follow them. 'collapsed'
+   counts the bytes already collapsed, by which the members not yet
+   processed have moved to lower positions in the file. */
 int remove_members( const std::vector< std::string > & filenames,
                   const Cl_options & cl_opts, const Member_list & member_list )
   {
@@ -196,6 +223,7 @@ int remove_members( const std::vector< std::string > & filenames,
     if( !safe_seek( infd, 0, filename ) ) return 1;
     const long blocks = lzip_index.blocks( false );	// not counting tdata
     long long stream_pos = 0;		// first pos not yet written to file
+    long long collapsed = 0;		// bytes removed by collapse_range
     long gaps = 0;
     bool error = false;
     const long prev_members = members;
@@ -207,8 +235,11 @@ int remove_members( const std::vector< std::string > & filenames,
         {
         if( !member_list.damaged && !member_list.includes( j + gaps, blocks ) )
           {
-          if( stream_pos != prev_end &&
-              ( !safe_seek( infd, prev_end, filename ) ||
+          if( stream_pos != prev_end - collapsed &&
+              collapse_range( fd, stream_pos, prev_end - collapsed ) )
+            collapsed = prev_end - stream_pos;
+          if( stream_pos != prev_end - collapsed &&
+              ( !safe_seek( infd, prev_end - collapsed, filename ) ||
                 !safe_seek( fd, stream_pos, filename ) ||
                 !copy_file( infd, fd, mb.pos() - prev_end ) ) )
             { error = true; set_retval( retval, 1 ); break; }
@@ -222,14 +253,17 @@ int remove_members( const std::vector< std::string > & filenames,
         in = true;
       if( !in && member_list.damaged )
         {
-        if( !safe_seek( infd, mb.pos(), filename ) )
+        if( !safe_seek( infd, mb.pos() - collapsed, filename ) )
           { error = true; set_retval( retval, 1 ); break; }
         in = ( test_member_from_file( infd, mb.size() ) != 0 );	// damaged
         }
       if( !in )
         {
-        if( stream_pos != mb.pos() &&
-            ( !safe_seek( infd, mb.pos(), filename ) ||
+        if( stream_pos != mb.pos() - collapsed &&
+            collapse_range( fd, stream_pos, mb.pos() - collapsed ) )
+          collapsed = mb.pos() - stream_pos;
+        if( stream_pos != mb.pos() - collapsed &&
+            ( !safe_seek( infd, mb.pos() - collapsed, filename ) ||
               !safe_seek( fd, stream_pos, filename ) ||
               !copy_file( infd, fd, mb.size() ) ) )
           { error = true; set_retval( retval, 1 ); break; }
@@ -251,8 +285,11 @@ int remove_members( const std::vector< std::string > & filenames,
       {
       if( !member_list.tdata )	// copy trailing data
         {
-        if( stream_pos != cdata_size &&
-            ( !safe_seek( infd, cdata_size, filename ) ||
+        if( stream_pos != cdata_size - collapsed &&
+            collapse_range( fd, stream_pos, cdata_size - collapsed ) )
+          collapsed = cdata_size - stream_pos;
+        if( stream_pos != cdata_size - collapsed &&
+            ( !safe_seek( infd, cdata_size - collapsed, filename ) ||
               !safe_seek( fd, stream_pos, filename ) ||
               !copy_file( infd, fd, trailing_size ) ) )
           { close( fd ); close( infd ); set_retval( retval, 1 ); break; }
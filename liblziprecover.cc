@@ -0,0 +1,266 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+   This file replaces main.cc in liblziprecover.a. It defines the global
+   variables and functions that the objects of the library take from
+   main.cc, so that they never print anything nor terminate the process.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "lzip.h"
+#include "decoder.h"
+#include "lzip_index.h"
+#include "mtester.h"
+#include "liblziprecover.h"
+
+
+int verbosity = -1;		// Pretty_print and the decoders print nothing
+
+const char * const program_name = "liblziprecover";
+std::string output_filename;
+int outfd = -1;
+
+void Pretty_print::operator()( const char * const, FILE * const ) const {}
+void show_header( const unsigned ) {}
+void show_dprogress( const unsigned long long, const unsigned long long,
+                     const Range_decoder * const, const Pretty_print * const )
+  {}
+
+void show_error( const char * const, const int, const bool ) {}
+void show_file_error( const char * const, const char * const, const int ) {}
+
+// Unwind to the function of the library that was called.
+void internal_error( const char * const msg ) { throw Error( msg ); }
+
+/* Called only by the wrappers of threads.h if a pthread function fails.
+   The exception can be caught only in the thread that called the library;
+   in a worker thread or in a destructor it terminates the program. */
+void cleanup_and_fail( const int ) { throw Error( "Thread function failed" ); }
+
+
+namespace {
+
+const char * const decoder_msg[7] = {
+  "", "Decoder error", "File ends unexpectedly",
+  "Member trailer does not match the data", "Unsupported marker code",
+  empty_msg, marking_msg };
+
+
+// Set the error from the result of decode_member or test_member.
+int decoder_error( Lzr_result & result, const int code,
+                   const long long pos )
+  {
+  if( code > 0 && code <= 6 )
+    return result.set_error( 2, decoder_msg[code], pos );
+  return result.set_error( 2, "Decoder error", pos );
+  }
+
+
+int exception_error( Lzr_result & result, const char * const msg )
+  {
+  std::string s( msg );
+  if( errno > 0 ) { s += ": "; s += std::strerror( errno ); }
+  return result.set_error( 1, s );
+  }
+
+
+/* Decode member i of 'lzip_index' sending to outfd the data in
+   [outskip,outend) of the member. */
+int decode_member_at( const int infd, const int outfd,
+                      const Lzip_index & lzip_index, const long i,
+                      const unsigned long long outskip,
+                      const unsigned long long outend,
+                      const Cl_options & cl_opts, Lzr_result & result )
+  {
+  const Block & mb = lzip_index.mblock( i );
+  Range_decoder rdec( infd, mb.pos(), mb.end() );
+  Lzip_header header;
+  if( rdec.read_data( header.data, header.size ) != header.size ||
+      !header.check() )
+    return result.set_error( 2, "Bad member header", mb.pos() );
+  LZ_decoder decoder( rdec, header.dictionary_size(), outfd, outskip,
+                      outend );
+  const int code = decoder.decode_member( cl_opts, Pretty_print( "" ) );
+  if( code != 0 )
+    return decoder_error( result, code, mb.pos() + rdec.member_position() );
+  ++result.members;
+  result.data_size += std::min( decoder.data_position(), outend ) -
+                      std::min( decoder.data_position(), outskip );
+  return 0;
+  }
+
+} // end namespace
+
+
+int lzr_test_members( const int infd, const Lzip_index & lzip_index,
+                      const Cl_options & cl_opts, Lzr_result & result )
+  {
+  result = Lzr_result();
+  if( lzip_index.retval() != 0 )
+    return result.set_error( lzip_index.retval(), lzip_index.error() );
+  try {
+    for( long i = 0; i < lzip_index.members(); ++i )
+      if( decode_member_at( infd, -1, lzip_index, i, 0, -1ULL, cl_opts,
+                            result ) ) break;
+    }
+  catch( std::bad_alloc & ) { result.set_error( 1, mem_msg ); }
+  catch( Error & e ) { exception_error( result, e.msg ); }
+  return result.retval;
+  }
+
+
+int lzr_decompress_range( const int infd, const int outfd,
+                          const Lzip_index & lzip_index, const Block & range,
+                          const Cl_options & cl_opts, Lzr_result & result )
+  {
+  result = Lzr_result();
+  if( lzip_index.retval() != 0 )
+    return result.set_error( lzip_index.retval(), lzip_index.error() );
+  const long long end = std::min( range.end(), lzip_index.udata_size() );
+  try {
+    for( long i = 0; i < lzip_index.members(); ++i )
+      {
+      const Block & db = lzip_index.dblock( i );
+      if( db.end() <= range.pos() ) continue;
+      if( db.pos() >= end ) break;
+      const unsigned long long outskip = positive_diff( range.pos(), db.pos() );
+      if( decode_member_at( infd, outfd, lzip_index, i, outskip,
+                            end - db.pos(), cl_opts, result ) ) break;
+      }
+    }
+  catch( std::bad_alloc & ) { result.set_error( 1, mem_msg ); }
+  catch( Error & e ) { exception_error( result, e.msg ); }
+  return result.retval;
+  }
+
+
+int lzr_decompress( const int infd, const int outfd,
+                    const Cl_options & cl_opts, Lzr_result & result )
+  {
+  result = Lzr_result();
+  try {
+    Range_decoder rdec( infd );
+    unsigned long long partial_file_pos = 0;
+    for( bool first_member = true; ; first_member = false )
+      {
+      Lzip_header header;
+      rdec.reset_member_position();
+      const int size = rdec.read_header_carefully( header, false );
+      if( rdec.finished() )			// End Of File
+        {
+        if( first_member )
+          result.set_error( 2, "File ends unexpectedly at member header.",
+                            partial_file_pos );
+        else if( header.check_prefix( size ) )
+          result.set_error( 2, "Truncated header in multimember file.",
+                            partial_file_pos );
+        else if( size > 0 && !cl_opts.ignore_trailing )
+          result.set_error( 2, trailing_msg, partial_file_pos );
+        break;
+        }
+      if( !header.check_magic() )
+        {
+        if( first_member ) result.set_error( 2, bad_magic_msg, 0 );
+        else if( !cl_opts.loose_trailing && header.check_corrupt() )
+          result.set_error( 2, corrupt_mm_msg, partial_file_pos );
+        else if( !cl_opts.ignore_trailing )
+          result.set_error( 2, trailing_msg, partial_file_pos );
+        break;
+        }
+      if( !header.check_version() )
+        { result.set_error( 2, bad_version( header.version() ),
+                            partial_file_pos ); break; }
+      const unsigned dictionary_size = header.dictionary_size();
+      if( !isvalid_ds( dictionary_size ) )
+        { result.set_error( 2, bad_dict_msg, partial_file_pos ); break; }
+
+      LZ_decoder decoder( rdec, dictionary_size, outfd );
+      const int code = decoder.decode_member( cl_opts, Pretty_print( "" ) );
+      partial_file_pos += rdec.member_position();
+      if( code != 0 )
+        { decoder_error( result, code, partial_file_pos ); break; }
+      ++result.members;
+      result.data_size += decoder.data_position();
+      }
+    }
+  catch( std::bad_alloc & ) { result.set_error( 1, mem_msg ); }
+  catch( Error & e ) { exception_error( result, e.msg ); }
+  return result.retval;
+  }
+
+
+int lzr_test_buffer( const uint8_t * const buffer, const long size,
+                     const Cl_options & cl_opts, Lzr_result & result )
+  {
+  result = Lzr_result();
+  try {
+    for( long pos = 0; pos < size; )
+      {
+      Lzip_header header;
+      const long rest = size - pos;
+      const int hsize = std::min( rest, (long)header.size );
+      std::memset( header.data, 0, header.size );
+      std::memcpy( header.data, buffer + pos, hsize );
+      if( hsize < header.size || !header.check_magic() )
+        {
+        if( pos == 0 ) result.set_error( 2, ( hsize < header.size ) ?
+            "File ends unexpectedly at member header." : bad_magic_msg, 0 );
+        else if( header.check_prefix( hsize ) )
+          result.set_error( 2, "Truncated header in multimember file.", pos );
+        else if( !cl_opts.loose_trailing && hsize == header.size &&
+                 header.check_corrupt() )
+          result.set_error( 2, corrupt_mm_msg, pos );
+        else if( !cl_opts.ignore_trailing )
+          result.set_error( 2, trailing_msg, pos );
+        break;
+        }
+      if( !header.check_version() )
+        { result.set_error( 2, bad_version( header.version() ), pos ); break; }
+      const unsigned dictionary_size = header.dictionary_size();
+      if( !isvalid_ds( dictionary_size ) )
+        { result.set_error( 2, bad_dict_msg, pos ); break; }
+      if( !cl_opts.ignore_marking && rest > header.size &&
+          buffer[pos+header.size] != 0 )
+        { result.set_error( 2, marking_msg, pos ); break; }
+
+      LZ_mtester mtester( buffer + pos, rest, dictionary_size );
+      const int code = mtester.test_member();
+      if( code != 0 )
+        { decoder_error( result, code, pos + mtester.member_position() );
+          break; }
+      if( !cl_opts.ignore_empty && mtester.data_position() == 0 )
+        { result.set_error( 2, empty_msg, pos ); break; }
+      ++result.members;
+      result.data_size += mtester.data_position();
+      pos += mtester.member_position();
+      }
+    }
+  catch( std::bad_alloc & ) { result.set_error( 1, mem_msg ); }
+  catch( Error & e ) { exception_error( result, e.msg ); }
+  return result.retval;
+  }
@@ -0,0 +1,66 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Interface of liblziprecover.a, for programs that test or decompress many
+   lzip files in the same process. Requires lzip.h and lzip_index.h.
+   Nothing is printed and the process is never terminated; errors are
+   returned in Lzr_result. The dictionary buffers freed are kept in a pool
+   (see set_memory_limit) and reused by later calls. The functions may be
+   called from several threads at once on different file descriptors.
+   Lzip_index, LZ_decoder, and LZ_mtester may also be used directly.
+   '--ignore-errors' is not supported; the first error found is returned.
+   The functions don't start threads. If a pthread function fails in the
+   calling thread, the error is returned in Lzr_result, but if it fails in a
+   worker thread (for example of a Range_decoder with async_size > 0 used
+   directly) or in a destructor, the program is terminated. */
+
+struct Lzr_result		// result of a call to the library
+  {
+  int retval;			// 0 = OK, 1 = I/O error or not enough memory
+				// 2 = corrupt or invalid input file
+  long members;			// members tested or decompressed
+  unsigned long long data_size;	// bytes of data decompressed
+  long long error_pos;		// position of the error in input, or -1
+  std::string error;		// description of the error, or empty
+
+  Lzr_result() : retval( 0 ), members( 0 ), data_size( 0 ), error_pos( -1 ) {}
+
+  int set_error( const int rv, const std::string & msg,
+                 const long long pos = -1 )
+    { retval = rv; error = msg; error_pos = pos; return retval; }
+  };
+
+
+/* Test the integrity of the members in 'lzip_index' of the seekable file
+   'infd'. The file offset of infd is not modified. */
+int lzr_test_members( const int infd, const Lzip_index & lzip_index,
+                      const Cl_options & cl_opts, Lzr_result & result );
+
+/* Decompress to 'outfd' the bytes in 'range' of the decompressed data of
+   the seekable file 'infd'. The file offset of infd is not modified. */
+int lzr_decompress_range( const int infd, const int outfd,
+                          const Lzip_index & lzip_index, const Block & range,
+                          const Cl_options & cl_opts, Lzr_result & result );
+
+/* Decompress to 'outfd' the lzip stream read from 'infd', which may be a
+   pipe, up to EOF. If outfd < 0, only test the stream. */
+int lzr_decompress( const int infd, const int outfd,
+                    const Cl_options & cl_opts, Lzr_result & result );
+
+// Test the lzip data in buffer[0,size), without copying them.
+int lzr_test_buffer( const uint8_t * const buffer, const long size,
+                     const Cl_options & cl_opts, Lzr_result & result );
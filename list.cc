@@ -17,16 +17,19 @@
 
 #define _FILE_OFFSET_BITS 64
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
 #include "lzip.h"
 #include "lzip_index.h"
+#include "threads.h"
 
 
 namespace {
@@ -44,75 +47,153 @@ void list_line( const unsigned long long uncomp_size,
                   input_filename );
   }
 
+
+/* Print the listing of a file. Return its exit status. */
+int list_index( const Lzip_index & lzip_index,
+                const char * const input_filename,
+                unsigned long long & total_comp,
+                unsigned long long & total_uncomp,
+                int & files, bool & first_post )
+  {
+  if( lzip_index.retval() != 0 )
+    {
+    show_file_error( input_filename, lzip_index.error().c_str() );
+    return lzip_index.retval();
+    }
+  if( verbosity < 0 ) return 0;
+  const unsigned long long udata_size = lzip_index.udata_size();
+  const unsigned long long cdata_size = lzip_index.cdata_size();
+  total_comp += cdata_size; total_uncomp += udata_size; ++files;
+  const long members = lzip_index.members();
+  if( first_post )
+    {
+    first_post = false;
+    if( verbosity >= 1 ) std::fputs( "   dict   memb  trail ", stdout );
+    std::fputs( "  uncompressed     compressed   saved  name\n", stdout );
+    }
+  if( verbosity >= 1 )
+    std::printf( "%s %5ld %6lld ", format_ds( lzip_index.dictionary_size() ),
+                 members, lzip_index.file_size() - cdata_size );
+  list_line( udata_size, cdata_size, input_filename );
+
+  if( verbosity >= 2 && ( members > 1 ||
+      ( members == 1 && lzip_index.mblock( 0 ).pos() > 0 ) ) )
+    {
+    std::fputs( " member      data_pos      data_size     member_pos    member_size\n", stdout );
+    long long prev_end = 0;
+    for( long i = 0, gaps = 0; i < members; ++i )
+      {
+      const Block & db = lzip_index.dblock( i );
+      const Block & mb = lzip_index.mblock( i );
+      if( mb.pos() > prev_end )
+        {
+        std::printf( "   gap              -              - %14llu %14llu\n",
+                     prev_end, mb.pos() - prev_end );
+        ++gaps;
+        }
+      std::printf( "%6ld %14llu %14llu %14llu %14llu\n",
+                   i + gaps + 1, db.pos(), db.size(), mb.pos(), mb.size() );
+      prev_end = mb.end();
+      }
+    first_post = true;	// reprint heading after list of members
+    }
+  std::fflush( stdout );
+  return 0;
+  }
+
+
+struct List_file		// file being indexed by list_files
+  {
+  const char * name;
+  int infd;
+  Lzip_index * index;
+  };
+
+
+struct List_arg
+  {
+  std::vector< List_file > * files;
+  const Cl_options * cl_opts;
+  Work_queue * queue;		// files to index
+  };
+
+extern "C" void * lworker( void * arg )
+  {
+  List_arg & tmp = *(List_arg *)arg;
+  std::vector< List_file > & files = *tmp.files;
+  const Cl_options & cl_opts = *tmp.cl_opts;
+  unsigned long i;
+  while( tmp.queue->next( i ) )
+    files[i].index = new Lzip_index( files[i].infd, cl_opts,
+                           cl_opts.ignore_errors, cl_opts.ignore_errors );
+  return 0;
+  }
+
+
+/* Build the indexes of the files, sharing the files among num_workers
+   threads. Each index is built independently from the others. */
+void index_batch( std::vector< List_file > & files, const Cl_options & cl_opts,
+                  const int num_workers )
+  {
+  const int workers = std::min( (unsigned)num_workers, (unsigned)files.size() );
+  if( workers <= 1 )
+    {
+    for( unsigned i = 0; i < files.size(); ++i )
+      files[i].index = new Lzip_index( files[i].infd, cl_opts,
+                             cl_opts.ignore_errors, cl_opts.ignore_errors );
+    return;
+    }
+  Work_queue queue( files.size() );
+  List_arg list_arg;
+  list_arg.files = &files;
+  list_arg.cl_opts = &cl_opts;
+  list_arg.queue = &queue;
+  run_workers( lworker, &list_arg, workers );
+  }
+
 } // end namespace
 
 
+/* The files are opened and listed in order, and indexed in batches of up
+   to 8 files per worker thread (limited by the number of open files) to
+   hide the latency of the storage. */
 int list_files( const std::vector< std::string > & filenames,
-                const Cl_options & cl_opts )
+                const Cl_options & cl_opts, const int num_workers )
   {
   unsigned long long total_comp = 0, total_uncomp = 0;
   int files = 0, retval = 0;
   bool first_post = true;
   bool stdin_used = false;
+  const unsigned batch_size =
+    ( num_workers > 1 ) ? std::min( 8 * num_workers, 256 ) : 1;
+  std::vector< List_file > batch;
 
-  for( unsigned i = 0; i < filenames.size(); ++i )
+  for( unsigned i = 0; i < filenames.size(); )
     {
-    const bool from_stdin = ( filenames[i] == "-" );
-    if( from_stdin ) { if( stdin_used ) continue; else stdin_used = true; }
-    const char * const input_filename =
-      from_stdin ? "(stdin)" : filenames[i].c_str();
-    struct stat in_stats;				// not used
-    const int infd = from_stdin ? STDIN_FILENO :
-      open_instream( input_filename, &in_stats, false, true );
-    if( infd < 0 ) { set_retval( retval, 1 ); continue; }
-
-    const Lzip_index lzip_index( infd, cl_opts, cl_opts.ignore_errors,
-                                 cl_opts.ignore_errors );
-    close( infd );
-    if( lzip_index.retval() != 0 )
+    batch.clear();
+    for( ; i < filenames.size() && batch.size() < batch_size; ++i )
       {
-      show_file_error( input_filename, lzip_index.error().c_str() );
-      set_retval( retval, lzip_index.retval() );
-      continue;
+      const bool from_stdin = ( filenames[i] == "-" );
+      if( from_stdin ) { if( stdin_used ) continue; else stdin_used = true; }
+      const char * const input_filename =
+        from_stdin ? "(stdin)" : filenames[i].c_str();
+      struct stat in_stats;				// not used
+      const int infd = from_stdin ? STDIN_FILENO :
+        open_instream( input_filename, &in_stats, false, true );
+      if( infd < 0 ) { set_retval( retval, 1 ); continue; }
+      List_file file;
+      file.name = input_filename; file.infd = infd; file.index = 0;
+      batch.push_back( file );
       }
-    if( verbosity < 0 ) continue;
-    const unsigned long long udata_size = lzip_index.udata_size();
-    const unsigned long long cdata_size = lzip_index.cdata_size();
-    total_comp += cdata_size; total_uncomp += udata_size; ++files;
-    const long members = lzip_index.members();
-    if( first_post )
+    index_batch( batch, cl_opts, num_workers );
+    for( unsigned j = 0; j < batch.size(); ++j )
       {
-      first_post = false;
-      if( verbosity >= 1 ) std::fputs( "   dict   memb  trail ", stdout );
-      std::fputs( "  uncompressed     compressed   saved  name\n", stdout );
+      close( batch[j].infd );
+      const int tmp = list_index( *batch[j].index, batch[j].name,
+                                  total_comp, total_uncomp, files, first_post );
+      set_retval( retval, tmp );
+      delete batch[j].index;
       }
-    if( verbosity >= 1 )
-      std::printf( "%s %5ld %6lld ", format_ds( lzip_index.dictionary_size() ),
-                   members, lzip_index.file_size() - cdata_size );
-    list_line( udata_size, cdata_size, input_filename );
-
-    if( verbosity >= 2 && ( members > 1 ||
-        ( members == 1 && lzip_index.mblock( 0 ).pos() > 0 ) ) )
-      {
-      std::fputs( " member      data_pos      data_size     member_pos    member_size\n", stdout );
-      long long prev_end = 0;
-      for( long i = 0, gaps = 0; i < members; ++i )
-        {
-        const Block & db = lzip_index.dblock( i );
-        const Block & mb = lzip_index.mblock( i );
-        if( mb.pos() > prev_end )
-          {
-          std::printf( "   gap              -              - %14llu %14llu\n",
-                       prev_end, mb.pos() - prev_end );
-          ++gaps;
-          }
-        std::printf( "%6ld %14llu %14llu %14llu %14llu\n",
-                     i + gaps + 1, db.pos(), db.size(), mb.pos(), mb.size() );
-        prev_end = mb.end();
-        }
-      first_post = true;	// reprint heading after list of members
-      }
-    std::fflush( stdout );
     }
   if( verbosity >= 0 && files > 1 )
     {
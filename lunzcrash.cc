@@ -23,6 +23,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -33,6 +34,7 @@
 #include "md5.h"
 #include "mtester.h"
 #include "lzip_index.h"
+#include "threads.h"
 
 
 namespace {
@@ -50,32 +52,25 @@ bool check_member( const uint8_t * const mbuffer, const long msize,
   }
 
 
-bool compare_member( const uint8_t * const mbuffer, const long msize,
-                     const unsigned dictionary_size,
-                     const long long byte_pos, const md5_type & digest )
+bool same_member( const uint8_t * const mbuffer, const long msize,
+                  const unsigned dictionary_size, const md5_type & digest )
   {
   MD5SUM md5sum;
   LZ_mtester mtester( mbuffer, msize, dictionary_size, -1, &md5sum );
-  bool error = ( mtester.test_member() != 0 || !mtester.finished() );
-  if( !error )
-    {
-    md5_type new_digest;
-    md5sum.md5_finish( new_digest );
-    if( digest != new_digest ) error = true;
-    }
-  if( error && verbosity >= 0 )
-    std::printf( "byte %llu comparison failed\n", byte_pos );
-  return !error;
+  if( mtester.test_member() != 0 || !mtester.finished() ) return false;
+  md5_type new_digest;
+  md5sum.md5_finish( new_digest );
+  return digest == new_digest;
   }
 
 
-int test_member_rest( const LZ_mtester & master, uint8_t * const buffer2,
+int test_member_rest( const LZ_mtester & master, Trial_buffer & tbuffer,
                       long * const failure_posp,
-                      const unsigned long long byte_pos )
+                      const unsigned long long byte_pos, FILE * const f )
   {
   LZ_mtester mtester( master );		// tester with external buffer
-  mtester.duplicate_buffer( buffer2 );
-  int result = mtester.test_member( LONG_MAX, LLONG_MAX, stdout, byte_pos );
+  mtester.duplicate_buffer( tbuffer );
+  int result = mtester.test_member( LONG_MAX, LLONG_MAX, f, byte_pos );
   if( result == 0 && !mtester.finished() ) result = -1;	// false negative
   if( result != 0 ) *failure_posp = mtester.member_position();
   return result;
@@ -98,13 +93,273 @@ long next_pct_pos( const Lzip_index & lzip_index, const long i, const int pct,
   return pct_pos;
   }
 
+
+void show_progress( const int pct, const long decompressions,
+                    const std::time_t start_time )
+  {
+  const long elapsed = std::time( 0 ) - start_time;
+  if( elapsed > 0 )
+    std::fprintf( stderr, "\r%3u%% done  %6ld trials/s\r", pct,
+                  decompressions / elapsed );
+  else std::fprintf( stderr, "\r%3u%% done\r", pct );
+  }
+
+
+struct Trial			// result of decompressing a variation
+  {
+  std::string msg;		// messages printed by test_member
+  long failure_pos;
+  int result;
+  bool same;			// variation decompresses to the original data
+  };
+
+
+struct Chunk			// range of positions tested by one worker
+  {
+  long pos;
+  long end;
+  long failed_pos;		// pos where master can't advance, or -1
+  std::vector< Trial > trials;	// 8 per position (bits) or 1 (block)
+  Chunk( const long p, const long e ) : pos( p ), end( e ), failed_pos( -1 ) {}
+  };
+
+
+/* Each worker tests its chunks on a private copy of the member, with its
+   own master and trial buffer. The messages printed by test_member are
+   captured in a temporary file so that they can be printed in order.
+   If f is stdout, the messages are printed directly instead, and the
+   positions are tested one by one by the serial loop. */
+class Crash_worker
+  {
+  uint8_t * const mbuffer;	// private copy of member
+  const long long mpos;
+  const long msize;
+  const unsigned dictionary_size;
+  const md5_type & md5_orig;
+  const int sector_size;	// 0 = flip bits, else zero blocks
+  uint8_t * const block;	// saved block
+  LZ_mtester * const master;
+  Trial_buffer tbuffer;
+  FILE * const f;
+  bool failed;			// master can't advance
+
+  Crash_worker( const Crash_worker & );		// declared as private
+  void operator=( const Crash_worker & );	// declared as private
+
+  void test( Trial & trial, const unsigned long long byte_pos )
+    {
+    trial.failure_pos = 0;
+    trial.result = test_member_rest( *master, tbuffer, &trial.failure_pos,
+                                     byte_pos, f );
+    trial.same = trial.result > 0 ||
+                 same_member( mbuffer, msize, dictionary_size, md5_orig );
+    trial.msg.clear();
+    if( f == stdout ) return;
+    const long size = std::ftell( f );
+    if( size <= 0 ) return;
+    std::rewind( f );
+    trial.msg.resize( size );
+    if( std::fread( &trial.msg[0], 1, size, f ) != (unsigned long)size )
+      trial.msg.clear();
+    std::rewind( f );
+    }
+
+public:
+  Crash_worker( const uint8_t * const mbuf, const long long mp, const long ms,
+                const unsigned dict_size, const md5_type & md5,
+                const int sec_size, FILE * const file )
+    : mbuffer( new uint8_t[ms] ), mpos( mp ), msize( ms ),
+      dictionary_size( dict_size ), md5_orig( md5 ), sector_size( sec_size ),
+      block( new uint8_t[std::max( 1, sec_size )] ),
+      master( new LZ_mtester( mbuffer, msize, dictionary_size ) ),
+      tbuffer( dictionary_size ), f( file ), failed( false )
+    { std::memcpy( mbuffer, mbuf, msize ); }
+
+  ~Crash_worker() { delete master; delete[] block; delete[] mbuffer; }
+
+  bool restored() const
+    { return same_member( mbuffer, msize, dictionary_size, md5_orig ); }
+
+  // Advance the master to pos. Return false if it can't advance.
+  bool advance( const long pos )
+    {
+    const long pos_limit = pos - 16;
+    if( failed || ( pos_limit > 0 && master->test_member( pos_limit ) != -1 ) )
+      failed = true;
+    return !failed;
+    }
+
+  // Flip bit k of the byte at pos. byte_pos is passed to test_member.
+  void test_bit( const long pos, const int k, Trial & trial,
+                 const unsigned long long byte_pos )
+    {
+    mbuffer[pos] ^= 1 << k;
+    test( trial, byte_pos );
+    mbuffer[pos] ^= 1 << k;
+    }
+
+  // Zero the block at pos.
+  void test_block( const long pos, Trial & trial )
+    {
+    std::memcpy( block, mbuffer + pos, sector_size );	// save block
+    std::memset( mbuffer + pos, 0, sector_size );
+    test( trial, mpos + pos );
+    std::memcpy( mbuffer + pos, block, sector_size );	// restore block
+    }
+
+  void test_chunk( Chunk & chunk )
+    {
+    const int tpp = sector_size ? 1 : 8;	// trials per position
+    chunk.trials.resize( ( chunk.end - chunk.pos ) * tpp );
+    for( long pos = chunk.pos; pos < chunk.end; ++pos )
+      {
+      if( !advance( pos ) ) { chunk.failed_pos = pos; return; }
+      Trial * const trials = &chunk.trials[( pos - chunk.pos ) * tpp];
+      if( sector_size == 0 )
+        for( int k = 0; k < 8; ++k ) test_bit( pos, k, trials[k], mpos + pos );
+      else test_block( pos, trials[0] );
+      }
+    }
+  };
+
+
+/* Distribute the positions of a member among the workers in rounds of
+   chunks, so that the results of each round can be printed in order. */
+class Crash_pool
+  {
+  std::vector< Crash_worker * > workers;
+  std::vector< FILE * > files;
+  std::vector< Chunk > chunks_;
+  unsigned next_chunk;		// next chunk to be tested by a worker
+  unsigned current;		// chunk being printed
+  pthread_mutex_t mutex;
+
+  Crash_pool( const Crash_pool & );		// declared as private
+  void operator=( const Crash_pool & );		// declared as private
+
+public:
+  enum { chunk_positions = 16, chunks_per_worker = 4 };
+
+  Crash_pool( const int num_workers, const uint8_t * const mbuffer,
+              const long long mpos, const long msize,
+              const unsigned dictionary_size, const md5_type & md5_orig,
+              const int sector_size )
+    : next_chunk( 0 ), current( 0 )
+    {
+    xinit_mutex( &mutex );
+    for( int i = 0; i < num_workers; ++i )
+      {
+      FILE * const f = std::tmpfile();
+      if( !f ) break;
+      files.push_back( f );
+      workers.push_back( new Crash_worker( mbuffer, mpos, msize,
+                         dictionary_size, md5_orig, sector_size, f ) );
+      }
+    }
+
+  ~Crash_pool()
+    {
+    for( unsigned i = 0; i < workers.size(); ++i )
+      { delete workers[i]; std::fclose( files[i] ); }
+    xdestroy_mutex( &mutex );
+    }
+
+  bool ok() const { return !workers.empty(); }
+
+  bool restored() const
+    {
+    for( unsigned i = 0; i < workers.size(); ++i )
+      if( !workers[i]->restored() ) return false;
+    return true;
+    }
+
+  Chunk * get_chunk()		// return 0 if no more chunks in this round
+    {
+    xlock( &mutex );
+    Chunk * const chunk =
+      ( next_chunk < chunks_.size() ) ? &chunks_[next_chunk++] : 0;
+    xunlock( &mutex );
+    return chunk;
+    }
+
+  void test_round( long pos, const long end );
+
+  // Return the chunk containing pos, testing a new round if needed.
+  const Chunk & chunk_at( const long pos, const long end )
+    {
+    if( current >= chunks_.size() || pos >= chunks_.back().end )
+      { test_round( pos, end ); current = 0; }
+    while( pos >= chunks_[current].end ) ++current;
+    return chunks_[current];
+    }
+  };
+
+
+struct Crash_arg
+  {
+  Crash_pool * pool;
+  Crash_worker * worker;
+  };
+
+
+extern "C" void * cworker( void * arg )
+  {
+  const Crash_arg & tmp = *(const Crash_arg *)arg;
+  while( Chunk * const chunk = tmp.pool->get_chunk() )
+    tmp.worker->test_chunk( *chunk );
+  return 0;
+  }
+
+
+// Test the positions from pos (up to end) of the next round.
+void Crash_pool::test_round( long pos, const long end )
+  {
+  chunks_.clear(); next_chunk = 0;
+  const unsigned max_chunks = workers.size() * chunks_per_worker;
+  while( pos < end && chunks_.size() < max_chunks )
+    {
+    const long chunk_end = std::min( pos + chunk_positions, end );
+    chunks_.push_back( Chunk( pos, chunk_end ) );
+    pos = chunk_end;
+    }
+  const int num_workers = std::min( workers.size(), chunks_.size() );
+  std::vector< Crash_arg > args( num_workers );
+  for( int i = 0; i < num_workers; ++i )
+    { args[i].pool = this; args[i].worker = workers[i]; }
+  if( num_workers <= 1 ) { cworker( &args[0] ); return; }
+  run_workers( cworker, &args[0], num_workers, false );
+  }
+
+
+/* Print the messages captured by test_member. If the header line
+   "byte N" has already been printed, skip it. */
+void print_messages( const std::string & msg, const bool header )
+  {
+  if( msg.empty() ) return;
+  unsigned i = 0;
+  if( !header )
+    { i = msg.find( '\n' ); i = ( i < msg.size() ) ? i + 1 : msg.size(); }
+  std::fputs( msg.c_str() + i, stdout );
+  }
+
+
+/* Each worker has a master and a trial buffer, both of the size of the
+   dictionary. */
+int workers_for( const int num_workers, const long positions,
+                 const unsigned dictionary_size )
+  {
+  const long chunks = positions / Crash_pool::chunk_positions;
+  return limit_workers( std::max( 1L, std::min( (long)num_workers, chunks ) ),
+                        2ULL * dictionary_size );
+  }
+
 } // end namespace
 
 
 /* Test 1-bit errors in LZMA streams in file.
    Unless verbosity >= 1, print only the bytes with interesting results. */
 int lunzcrash_bit( const char * const input_filename,
-                   const Cl_options & cl_opts )
+                   const Cl_options & cl_opts, const int num_workers )
   {
   struct stat in_stats;				// not used
   const int infd = open_instream( input_filename, &in_stats, false, true );
@@ -117,6 +372,7 @@ int lunzcrash_bit( const char * const input_filename,
   if( verbosity >= 2 ) printf( "Testing file '%s'\n", input_filename );
 
   const long long cdata_size = lzip_index.cdata_size();
+  const std::time_t start_time = std::time( 0 );
   long positions = 0, decompressions = 0, successes = 0, failed_comparisons = 0;
   int pct = ( cdata_size >= 1000 && isatty( STDERR_FILENO ) ) ? 0 : 100;
   for( long i = 0; i < lzip_index.members(); ++i )
@@ -134,27 +390,40 @@ int lunzcrash_bit( const char * const input_filename,
     const long end = msize - 20;
     if( verbosity == 0 )	// give a clue of the range being tested
       std::printf( "Testing bytes %llu to %llu\n", mpos + pos, mpos + end - 1 );
-    LZ_mtester master( mbuffer, msize, dictionary_size );
-    uint8_t * const buffer2 = new uint8_t[dictionary_size];
+    // with one worker, test and print directly
+    const int workers = workers_for( num_workers, end - pos, dictionary_size );
+    Crash_pool pool( ( workers > 1 ) ? workers : 0, mbuffer, mpos, msize,
+                     dictionary_size, md5_orig, 0 );
+    Crash_worker * const serial = ( workers > 1 ) ? 0 :
+      new Crash_worker( mbuffer, mpos, msize, dictionary_size, md5_orig, 0,
+                        stdout );
+    if( !serial && !pool.ok() )
+      { show_error( "Can't create temporary file", errno ); return 1; }
     for( ; pos < end; ++pos )
       {
-      const long pos_limit = pos - 16;
-      if( pos_limit > 0 && master.test_member( pos_limit ) != -1 )
+      const Chunk * const chunk = serial ? 0 : &pool.chunk_at( pos, end );
+      if( serial ? !serial->advance( pos ) : pos == chunk->failed_pos )
         { show_error( "Can't advance master." ); return 1; }
       if( verbosity >= 0 && pos >= pct_pos )
-        { std::fprintf( stderr, "\r%3u%% done\r", pct ); ++pct;
+        { show_progress( pct, decompressions, start_time ); ++pct;
           pct_pos = next_pct_pos( lzip_index, i, pct ); }
       if( verbosity >= 1 )
         { std::printf( "byte %llu\n", mpos + pos ); printed = pos; }
       ++positions;
       const uint8_t byte = mbuffer[pos];
-      for( uint8_t mask = 1; mask != 0; mask <<= 1 )
+      for( int k = 0; k < 8; ++k )
         {
+        const uint8_t mask = 1 << k;
+        Trial serial_trial;
+        if( serial ) serial->test_bit( pos, k, serial_trial,
+                                       ( printed < pos ) ? mpos + pos : 0 );
+        const Trial & trial = serial ? serial_trial :
+                              chunk->trials[( pos - chunk->pos ) * 8 + k];
+        const long failure_pos = trial.failure_pos;
+        const int result = trial.result;
         ++decompressions;
-        mbuffer[pos] ^= mask;
-        long failure_pos = 0;
-        const int result = test_member_rest( master, buffer2, &failure_pos,
-                           ( printed < pos ) ? mpos + pos : 0 );
+        print_messages( trial.msg, printed < pos );
+        if( !trial.msg.empty() ) printed = pos;
         if( result <= 0 )
           {
           ++successes;
@@ -163,13 +432,17 @@ int lunzcrash_bit( const char * const input_filename,
             if( printed < pos )
               { std::printf( "byte %llu\n", mpos + pos ); printed = pos; }
             std::printf( "0x%02X (0x%02X^0x%02X) passed the test%s",
-                         mbuffer[pos], byte, mask, ( result < 0 ) ? "" : "\n" );
+                         byte ^ mask, byte, mask, ( result < 0 ) ? "" : "\n" );
             if( result < 0 )
               std::printf( ", but only consumed %lu bytes of %llu\n",
                            failure_pos, msize );
             }
-          if( !compare_member( mbuffer, msize, dictionary_size, mpos + pos,
-                               md5_orig ) ) ++failed_comparisons;
+          if( !trial.same )
+            {
+            if( verbosity >= 0 )
+              std::printf( "byte %llu comparison failed\n", mpos + pos );
+            ++failed_comparisons;
+            }
           }
         else if( result == 1 )
           {
@@ -194,12 +467,15 @@ int lunzcrash_bit( const char * const input_filename,
           else
             std::printf( "Unknown error code '%d'\n", result );
           }
-        mbuffer[pos] ^= mask;
         }
       }
-    delete[] buffer2;
-    if( !compare_member( mbuffer, msize, dictionary_size, mpos + pos, md5_orig ) )
+    if( serial ? !serial->restored() : !pool.restored() )
+      {
+      if( verbosity >= 0 )
+        std::printf( "byte %llu comparison failed\n", mpos + pos );
       internal_error( "Some byte was not properly restored." );
+      }
+    delete serial;
     delete[] mbuffer;
     }
 
@@ -224,7 +500,8 @@ int lunzcrash_bit( const char * const input_filename,
 /* Test zeroed blocks of given size in LZMA streams in file.
    Unless verbosity >= 1, print only the bytes with interesting results. */
 int lunzcrash_block( const char * const input_filename,
-                     const Cl_options & cl_opts, const int sector_size )
+                     const Cl_options & cl_opts, const int sector_size,
+                     const int num_workers )
   {
   struct stat in_stats;				// not used
   const int infd = open_instream( input_filename, &in_stats, false, true );
@@ -237,9 +514,9 @@ int lunzcrash_block( const char * const input_filename,
   if( verbosity >= 2 ) printf( "Testing file '%s'\n", input_filename );
 
   const long long cdata_size = lzip_index.cdata_size();
+  const std::time_t start_time = std::time( 0 );
   long decompressions = 0, successes = 0, failed_comparisons = 0;
   int pct = ( cdata_size >= 1000 && isatty( STDERR_FILENO ) ) ? 0 : 100;
-  uint8_t * const block = new uint8_t[sector_size];
   for( long i = 0; i < lzip_index.members(); ++i )
     {
     const long long mpos = lzip_index.mblock( i ).pos();
@@ -258,22 +535,30 @@ int lunzcrash_block( const char * const input_filename,
     if( verbosity >= 0 )	// give a clue of the range being tested
       std::printf( "Testing blocks of size %u from pos %llu to %llu\n",
                    sector_size, mpos + pos, mpos + end - 1 );
-    LZ_mtester master( mbuffer, msize, dictionary_size );
-    uint8_t * const buffer2 = new uint8_t[dictionary_size];
+    // with one worker, test and print directly
+    const int workers = workers_for( num_workers, end - pos, dictionary_size );
+    Crash_pool pool( ( workers > 1 ) ? workers : 0, mbuffer, mpos, msize,
+                     dictionary_size, md5_orig, sector_size );
+    Crash_worker * const serial = ( workers > 1 ) ? 0 :
+      new Crash_worker( mbuffer, mpos, msize, dictionary_size, md5_orig,
+                        sector_size, stdout );
+    if( !serial && !pool.ok() )
+      { show_error( "Can't create temporary file", errno ); return 1; }
     for( ; pos < end; ++pos )
       {
-      const long pos_limit = pos - 16;
-      if( pos_limit > 0 && master.test_member( pos_limit ) != -1 )
+      const Chunk * const chunk = serial ? 0 : &pool.chunk_at( pos, end );
+      if( serial ? !serial->advance( pos ) : pos == chunk->failed_pos )
         { show_error( "Can't advance master." ); return 1; }
       if( verbosity >= 0 && pos >= pct_pos )
-        { std::fprintf( stderr, "\r%3u%% done\r", pct ); ++pct;
+        { show_progress( pct, decompressions, start_time ); ++pct;
           pct_pos = next_pct_pos( lzip_index, i, pct, sector_size ); }
-      std::memcpy( block, mbuffer + pos, sector_size );		// save block
-      std::memset( mbuffer + pos, 0, sector_size );
+      Trial serial_trial;
+      if( serial ) serial->test_block( pos, serial_trial );
+      const Trial & trial = serial ? serial_trial : chunk->trials[pos-chunk->pos];
+      const long failure_pos = trial.failure_pos;
+      const int result = trial.result;
       ++decompressions;
-      long failure_pos = 0;
-      const int result =
-        test_member_rest( master, buffer2, &failure_pos, mpos + pos );
+      print_messages( trial.msg, true );
       if( result <= 0 )
         {
         ++successes;
@@ -285,8 +570,12 @@ int lunzcrash_block( const char * const input_filename,
             std::printf( ", but only consumed %lu bytes of %llu\n",
                          failure_pos, msize );
           }
-        if( !compare_member( mbuffer, msize, dictionary_size, mpos + pos,
-                             md5_orig ) ) ++failed_comparisons;
+        if( !trial.same )
+          {
+          if( verbosity >= 0 )
+            std::printf( "byte %llu comparison failed\n", mpos + pos );
+          ++failed_comparisons;
+          }
         }
       else if( result == 1 )
         {
@@ -308,14 +597,16 @@ int lunzcrash_block( const char * const input_filename,
         else
           std::printf( "Unknown error code '%d'\n", result );
         }
-      std::memcpy( mbuffer + pos, block, sector_size );		// restore block
       }
-    delete[] buffer2;
-    if( !compare_member( mbuffer, msize, dictionary_size, mpos + pos, md5_orig ) )
+    if( serial ? !serial->restored() : !pool.restored() )
+      {
+      if( verbosity >= 0 )
+        std::printf( "byte %llu comparison failed\n", mpos + pos );
       internal_error( "Block was not properly restored." );
+      }
+    delete serial;
     delete[] mbuffer;
     }
-  delete[] block;
 
   if( verbosity >= 0 )
     {
@@ -335,40 +626,135 @@ int lunzcrash_block( const char * const input_filename,
   }
 
 
-int md5sum_files( const std::vector< std::string > & filenames )
+namespace {
+
+struct Md5_file			// file being hashed by md5sum_files
+  {
+  const char * name;
+  int infd;
+  int read_errno;		// errno of the read error, or 0
+  md5_type digest;
+  };
+
+
+/* Hash up to 4 files at once. While all of them have data, their blocks
+   are processed by the multi-buffer MD5 code. */
+void md5_group( Md5_file * const files, const int n )
+  {
+  enum { buffer_size = 16384 };
+  uint8_t buffers[4][buffer_size];
+  MD5SUM md5sums[4];
+  bool eof[4];
+  for( int l = 0; l < 4; ++l ) eof[l] = ( l >= n );
+  while( true )
+    {
+    int len[4], full = 0, active = 0;
+    for( int l = 0; l < 4; ++l )
+      {
+      len[l] = 0;
+      if( eof[l] ) continue;
+      ++active;
+      len[l] = readblock( files[l].infd, buffers[l], buffer_size );
+      if( len[l] == buffer_size ) { ++full; continue; }
+      eof[l] = true;
+      if( errno ) { files[l].read_errno = errno; len[l] = 0; }
+      }
+    if( active == 0 ) break;
+    if( full == 4 )
+      {
+      MD5SUM * const sums[4] = { &md5sums[0], &md5sums[1], &md5sums[2],
+                                 &md5sums[3] };
+      const uint8_t * const bufs[4] = { buffers[0], buffers[1], buffers[2],
+                                        buffers[3] };
+      MD5SUM::md5_update4( sums, bufs, buffer_size );
+      }
+    else for( int l = 0; l < 4; ++l )
+      if( len[l] > 0 ) md5sums[l].md5_update( buffers[l], len[l] );
+    }
+  for( int l = 0; l < n; ++l ) md5sums[l].md5_finish( files[l].digest );
+  }
+
+
+struct Md5_arg
+  {
+  std::vector< Md5_file > * files;
+  Work_queue * queue;		// first file of each group to hash
+  };
+
+extern "C" void * md5worker( void * arg )
+  {
+  Md5_arg & tmp = *(Md5_arg *)arg;
+  std::vector< Md5_file > & files = *tmp.files;
+  unsigned long i;
+  while( tmp.queue->next( i ) )
+    md5_group( &files[i], std::min( 4U, (unsigned)( files.size() - i ) ) );
+  return 0;
+  }
+
+
+/* Hash the files in groups of 4, sharing the groups among num_workers
+   threads. */
+void md5_batch( std::vector< Md5_file > & files, const int num_workers )
+  {
+  const int groups = ( files.size() + 3 ) / 4;
+  const int workers = std::min( num_workers, groups );
+  if( workers <= 1 )
+    {
+    for( unsigned i = 0; i < files.size(); i += 4 )
+      md5_group( &files[i], std::min( 4U, (unsigned)files.size() - i ) );
+    return;
+    }
+  Work_queue queue( files.size(), 4 );
+  Md5_arg md5_arg;
+  md5_arg.files = &files;
+  md5_arg.queue = &queue;
+  run_workers( md5worker, &md5_arg, workers );
+  }
+
+} // end namespace
+
+
+/* The files are opened and their digests printed in order, in batches of
+   4 files per worker thread. */
+int md5sum_files( const std::vector< std::string > & filenames,
+                  const int num_workers )
   {
   int retval = 0;
   bool stdin_used = false;
+  const unsigned batch_size = 4 * std::max( 1, num_workers );
+  std::vector< Md5_file > files;
 
-  for( unsigned i = 0; i < filenames.size(); ++i )
+  for( unsigned i = 0; i < filenames.size(); )
     {
-    const bool from_stdin = ( filenames[i] == "-" );
-    if( from_stdin ) { if( stdin_used ) continue; else stdin_used = true; }
-    const char * const input_filename = filenames[i].c_str();
-    struct stat in_stats;				// not used
-    const int infd = from_stdin ? STDIN_FILENO :
-      open_instream( input_filename, &in_stats, false );
-    if( infd < 0 ) { set_retval( retval, 1 ); continue; }
-
-    enum { buffer_size = 16384 };
-    uint8_t buffer[buffer_size];
-    md5_type md5_digest;
-    MD5SUM md5sum;
-    while( true )
+    files.clear();
+    for( ; i < filenames.size() && files.size() < batch_size; ++i )
+      {
+      const bool from_stdin = ( filenames[i] == "-" );
+      if( from_stdin ) { if( stdin_used ) continue; else stdin_used = true; }
+      const char * const input_filename = filenames[i].c_str();
+      struct stat in_stats;				// not used
+      const int infd = from_stdin ? STDIN_FILENO :
+        open_instream( input_filename, &in_stats, false );
+      if( infd < 0 ) { set_retval( retval, 1 ); continue; }
+      Md5_file file;
+      file.name = input_filename; file.infd = infd; file.read_errno = 0;
+      files.push_back( file );
+      }
+    md5_batch( files, num_workers );
+    for( unsigned j = 0; j < files.size(); ++j )
       {
-      const int len = readblock( infd, buffer, buffer_size );
-      if( len != buffer_size && errno ) throw Error( "Read error" );
-      if( len > 0 ) md5sum.md5_update( buffer, len );
-      if( len < buffer_size ) break;
+      const Md5_file & file = files[j];
+      if( close( file.infd ) != 0 )
+        { show_file_error( file.name, "Error closing input file", errno );
+          while( ++j < files.size() ) close( files[j].infd );
+          return 1; }
+      if( file.read_errno )
+        { show_file_error( file.name, "Read error", file.read_errno );
+          set_retval( retval, 1 ); continue; }
+      for( int k = 0; k < 16; ++k ) std::printf( "%02x", file.digest.data[k] );
+      std::printf( "  %s\n", file.name );
+      std::fflush( stdout );
       }
-    md5sum.md5_finish( md5_digest );
-    if( close( infd ) != 0 )
-      { show_file_error( input_filename, "Error closing input file", errno );
-        return 1; }
-
-    for( int i = 0; i < 16; ++i ) std::printf( "%02x", md5_digest[i] );
-    std::printf( "  %s\n", input_filename );
-    std::fflush( stdout );
     }
   return retval;
   }
@@ -151,38 +151,24 @@ public:
 
 class CRC32
   {
-  uint32_t data[256];		// Table of CRCs of all 8-bit messages.
+  uint32_t data[8][256];	// Tables for slicing-by-8. data[0] is the
+				// table of CRCs of all 8-bit messages.
+  // hardware kernel for blocks of ( n * 16 >= 64 ) bytes, or null
+  uint32_t ( * hw_update )( uint32_t crc, const uint8_t * const buffer,
+                            const long size );
 
 public:
-  CRC32()
-    {
-    for( unsigned n = 0; n < 256; ++n )
-      {
-      unsigned c = n;
-      for( int k = 0; k < 8; ++k )
-        { if( c & 1 ) c = 0xEDB88320U ^ ( c >> 1 ); else c >>= 1; }
-      data[n] = c;
-      }
-    }
+  CRC32();			// selects the hardware kernel (if any)
 
-  uint32_t operator[]( const uint8_t byte ) const { return data[byte]; }
+  uint32_t operator[]( const uint8_t byte ) const { return data[0][byte]; }
 
   void update_byte( uint32_t & crc, const uint8_t byte ) const
-    { crc = data[(crc^byte)&0xFF] ^ ( crc >> 8 ); }
+    { crc = data[0][(crc^byte)&0xFF] ^ ( crc >> 8 ); }
 
-  // about as fast as it is possible without messing with endianness
   void update_buf( uint32_t & crc, const uint8_t * const buffer,
-                   const int size ) const
-    {
-    uint32_t c = crc;
-    for( int i = 0; i < size; ++i )
-      c = data[(c^buffer[i])&0xFF] ^ ( c >> 8 );
-    crc = c;
-    }
+                   const int size ) const;
   };
 
-extern const CRC32 crc32;
-
 
 inline bool isvalid_ds( const unsigned dictionary_size )
   { return dictionary_size >= min_dictionary_size &&
@@ -316,10 +302,14 @@ struct Cl_options		// command-line options
   bool ignore_marking;
   bool ignore_trailing;
   bool loose_trailing;
+  bool mmap_io;			// decode mapping the files in memory
+  int async_size;		// if > 0, size of buffers for asynchronous I/O
+  std::string index_dir;	// directory of cached indexes, or empty
 
   Cl_options()
     : ignore_empty( true ), ignore_errors( false ), ignore_marking( true ),
-      ignore_trailing( true ), loose_trailing( false ) {}
+      ignore_trailing( true ), loose_trailing( false ), mmap_io( false ),
+      async_size( 0 ) {}
   };
 
 
@@ -423,21 +413,47 @@ uint8_t * read_member( const int infd, const long long mpos,
                        const long long msize, const char * const filename );
 int byte_repair( const std::string & input_filename,
                  const std::string & default_output_filename,
-                 const Cl_options & cl_opts,
-                 const char terminator, const bool force );
+                 const Cl_options & cl_opts, const char terminator,
+                 const bool force, const bool bit_flips_first,
+                 const int num_workers );
 int debug_delay( const char * const input_filename,
                  const Cl_options & cl_opts, Block range,
                  const char terminator );
 int debug_byte_repair( const char * const input_filename,
                        const Cl_options & cl_opts, const Bad_byte & bad_byte,
-                       const char terminator );
+                       const char terminator, const bool bit_flips_first );
 int debug_decompress( const char * const input_filename,
                       const Cl_options & cl_opts, const Bad_byte & bad_byte,
                       const bool show_packets );
 
+// defined in crc32.cc
+extern const CRC32 crc32;
+
+// defined in dec_mt.cc
+unsigned long long dec_mt( const int infd, const Cl_options & cl_opts,
+                           const Pretty_print & pp, const bool testing,
+                           const int num_workers,
+                           unsigned long long & outskip );
+class Lzip_index;
+long dec_members_mt( const int infd, const Lzip_index & lzip_index,
+                     const Cl_options & cl_opts, const long first,
+                     const long last, const bool testing,
+                     const int num_workers, unsigned long long & outskip );
+
 // defined in decoder.cc
 long readblock( const int fd, uint8_t * const buf, const long size );
+long preadblock( const int fd, uint8_t * const buf, const long size,
+                 const long long pos );
 long writeblock( const int fd, const uint8_t * const buf, const long size );
+long pwriteblock( const int fd, const uint8_t * const buf, const long size,
+                  const long long pos );
+
+// defined in dict_pool.cc
+uint8_t * new_dictionary( const unsigned size );
+void delete_dictionary( uint8_t * const buffer, const unsigned size );
+void set_memory_limit( const unsigned long long limit );
+unsigned long long memory_budget();
+int limit_workers( const int num_workers, const unsigned long long worker_size );
 
 // defined in dump_remove.cc
 int dump_members( const std::vector< std::string > & filenames,
@@ -451,26 +467,28 @@ int clear_marking( const std::vector< std::string > & filenames,
 
 // defined in list.cc
 int list_files( const std::vector< std::string > & filenames,
-                const Cl_options & cl_opts );
+                const Cl_options & cl_opts, const int num_workers );
 
 // defined in lzip_index.cc
+bool fits_in_size_t( const unsigned long long size );
+std::string bad_version( const unsigned version );
 int seek_read( const int fd, uint8_t * const buf, const int size,
                const long long pos );
 
 // defined in lunzcrash.cc
 int lunzcrash_bit( const char * const input_filename,
-                   const Cl_options & cl_opts );
+                   const Cl_options & cl_opts, const int num_workers );
 int lunzcrash_block( const char * const input_filename,
-                     const Cl_options & cl_opts, const int sector_size );
-int md5sum_files( const std::vector< std::string > & filenames );
+                     const Cl_options & cl_opts, const int sector_size,
+                     const int num_workers );
+int md5sum_files( const std::vector< std::string > & filenames,
+                  const int num_workers );
 
 // defined in main.cc
 extern const char * const program_name;
 extern std::string output_filename;	// global vars for output file
 extern int outfd;
 struct stat;
-bool fits_in_size_t( const unsigned long long size );
-const char * bad_version( const unsigned version );
 const char * format_ds( const unsigned dictionary_size );
 void show_header( const unsigned dictionary_size );
 int open_instream( const char * const name, struct stat * const in_statsp,
@@ -502,11 +520,12 @@ int test_member_from_file( const int infd, const unsigned long long msize,
 int merge_files( const std::vector< std::string > & filenames,
                  const std::string & default_output_filename,
                  const Cl_options & cl_opts, const char terminator,
-                 const bool force );
+                 const bool force, const int num_workers );
 
 // defined in nrep_stats.cc
 int print_nrep_stats( const std::vector< std::string > & filenames,
-                      const Cl_options & cl_opts, const int repeated_byte );
+                      const Cl_options & cl_opts, const int repeated_byte,
+                      const int num_workers );
 
 // defined in range_dec.cc
 const char * format_num( unsigned long long num,
@@ -517,7 +536,8 @@ bool safe_seek( const int fd, const long long pos,
 int range_decompress( const std::string & input_filename,
                       const std::string & default_output_filename,
                       const Cl_options & cl_opts, Block range,
-                      const bool force, const bool to_stdout );
+                      const bool force, const bool to_stdout,
+                      const int num_workers );
 
 // defined in reproduce.cc
 int reproduce_file( const std::string & input_filename,
@@ -525,14 +545,35 @@ int reproduce_file( const std::string & input_filename,
                     const char * const lzip_name,
                     const char * const reference_filename,
                     const Cl_options & cl_opts, const int lzip_level,
-                    const char terminator, const bool force );
+                    const char terminator, const bool force,
+                    const int num_workers );
 int debug_reproduce_file( const char * const input_filename,
                           const char * const lzip_name,
                           const char * const reference_filename,
                           const Cl_options & cl_opts, const Block & range,
-                          const int sector_size, const int lzip_level );
+                          const int sector_size, const int lzip_level,
+                          const int num_workers );
 
 // defined in split.cc
 int split_file( const std::string & input_filename,
                 const std::string & default_output_filename,
                 const Cl_options & cl_opts, const bool force );
+
+// defined in stats.cc
+enum Stat_counter { st_bytes_read, st_bytes_written, st_masters,
+                    st_master_bytes, st_master_us, st_trials, st_trial_bytes,
+                    st_failed_trials, st_failed_trial_bytes, st_buffer_copies,
+                    st_buffer_copy_bytes, st_copy_file_bytes, st_children,
+                    st_dict_allocs, st_dict_reuses, st_counters };
+extern bool stats_enabled;
+void stat_add_locked( const Stat_counter counter, const unsigned long long n );
+inline void stat_add( const Stat_counter counter,
+                      const unsigned long long n = 1 )
+  { if( stats_enabled ) stat_add_locked( counter, n ); }
+unsigned long long stat_time_us();
+void enable_stats( const int fd );
+void zero_stats();
+void get_stats( unsigned long long buf[] );
+void add_stats( const unsigned long long buf[] );
+void set_child_stats( const int fd );
+void add_child_stats( FILE * const f );
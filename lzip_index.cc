@@ -19,16 +19,109 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "lzip.h"
 #include "lzip_index.h"
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+
+namespace {
+
+/* Format of the index cache file (all numbers are 8 bytes, little endian):
+   key (magic "LZIX", version, device, inode, size, mtime and ctime of the
+   lzip file in seconds and nanoseconds, max_pos, flags), CRC32 of sampled headers and trailers, largest
+   dictionary size, number of members, 4 numbers per member (data size,
+   member pos, member size, dictionary size), and CRC32 of all the above. */
+const uint8_t cache_magic[4] = { 0x4C, 0x5A, 0x49, 0x58 };	// "LZIX"
+enum { cache_version = 2, cache_samples = 16 };
+
+// nanoseconds of the times of a file, 0 if the system does not provide them
+#if defined _POSIX_C_SOURCE && _POSIX_C_SOURCE >= 200809L
+inline unsigned long long mtime_nsec( const struct stat & st )
+  { return st.st_mtim.tv_nsec; }
+inline unsigned long long ctime_nsec( const struct stat & st )
+  { return st.st_ctim.tv_nsec; }
+#else
+inline unsigned long long mtime_nsec( const struct stat & ) { return 0; }
+inline unsigned long long ctime_nsec( const struct stat & ) { return 0; }
+#endif
+
+void put_ull( std::string & s, unsigned long long num )
+  { for( int i = 0; i < 8; ++i ) { s += (char)( num & 0xFF ); num >>= 8; } }
+
+unsigned long long get_ull( const uint8_t * const p )
+  {
+  unsigned long long num = 0;
+  for( int i = 7; i >= 0; --i ) { num <<= 8; num += p[i]; }
+  return num;
+  }
+
+// Return true if any of the 8 bytes at p is zero.
+inline bool has_zero( const uint8_t * const p )
+  {
+  uint64_t w;
+  std::memcpy( &w, p, 8 );
+  return ( ( w - 0x0101010101010101ULL ) & ~w & 0x8080808080808080ULL ) != 0;
+  }
+
+
+class File_map			// read-only map of the first bytes of a file
+  {
+  void * const addr;
+  const unsigned long long size;
+
+  File_map( const File_map & );			// declared as private
+  void operator=( const File_map & );		// declared as private
+
+public:
+  File_map( const int fd, const unsigned long long sz )
+    : addr( fits_in_size_t( sz ) ?
+            mmap( 0, sz, PROT_READ, MAP_PRIVATE, fd, 0 ) : MAP_FAILED ),
+      size( sz ) {}
+  ~File_map() { if( addr != MAP_FAILED ) munmap( addr, size ); }
+
+  // return 0 if the file could not be mapped
+  const uint8_t * data() const
+    { return ( addr != MAP_FAILED ) ? (const uint8_t *)addr : 0; }
+  };
+
+
+uint32_t compute_crc( const uint8_t * const buffer, const long size )
+  {
+  uint32_t crc = 0xFFFFFFFFU;
+  crc32.update_buf( crc, buffer, size );
+  return crc ^ 0xFFFFFFFFU;
+  }
+
+} // end namespace
+
+
+bool fits_in_size_t( const unsigned long long size )	// fits also in long
+  { return ( sizeof (long) <= sizeof (size_t) && size <= LONG_MAX ) ||
+           ( sizeof (int) <= sizeof (size_t) && size <= INT_MAX ); }
+
+
+std::string bad_version( const unsigned version )
+  {
+  char buf[80];
+  snprintf( buf, sizeof buf, "Version %u member format not supported.",
+            version );
+  return buf;
+  }
+
 
 int seek_read( const int fd, uint8_t * const buf, const int size,
                const long long pos )
@@ -89,7 +182,10 @@ bool Lzip_index::read_trailer( const int fd, Lzip_trailer & trailer,
 
 /* Skip backwards the gap or trailing data ending at pos.
    'ignore_gaps' also ignores format errors and a truncated last member.
-   If successful, push member preceding gap and set pos to member header. */
+   If successful, push member preceding gap and set pos to member header.
+   The file is mapped in memory if possible. Else it is read backwards in
+   large blocks. Only the positions where the most significant bytes of
+   member_size are zero (as required by the file size) are tested. */
 bool Lzip_index::skip_gap( const int fd, unsigned long long & pos,
                            const Cl_options & cl_opts,
                            const bool ignore_bad_ds, const bool ignore_gaps )
@@ -99,70 +195,98 @@ bool Lzip_index::skip_gap( const int fd, unsigned long long & pos,
     if( ignore_gaps && !member_vector.empty() ) { pos = 0; return true; }
     return false;
     }
-  enum { block_size = 16384,
+  enum { block_size = 1 << 20,
          buffer_size = block_size + Lzip_trailer::size - 1 + Lzip_header::size };
-  uint8_t buffer[buffer_size];
-  int bsize = pos % block_size;			// total bytes in buffer
-  if( bsize <= buffer_size - block_size ) bsize += block_size;
-  int search_size = bsize;			// bytes to search for trailer
-  int rd_size = bsize;				// bytes to read from file
-  unsigned long long ipos = pos - rd_size;	// aligned to block_size
+  const File_map map( fd, pos );
+  std::vector< uint8_t > rbuffer;
+  const uint8_t * buffer = map.data();
+  long long bsize = pos;			// total bytes in buffer
+  long long search_size = bsize;		// bytes to search for trailer
+  long long rd_size = 0;			// bytes to read from file
+  unsigned long long ipos = 0;			// aligned to block_size
+  if( !buffer )
+    {
+    rbuffer.resize( buffer_size ); buffer = &rbuffer[0];
+    bsize = pos % block_size;
+    if( bsize <= buffer_size - block_size ) bsize += block_size;
+    search_size = rd_size = bsize;
+    ipos = pos - rd_size;
+    }
 
   while( true )
     {
-    if( seek_read( fd, buffer, rd_size, ipos ) != rd_size )
+    if( rd_size > 0 && seek_read( fd, &rbuffer[0], rd_size, ipos ) != rd_size )
       { set_errno_error( "Error seeking member trailer: " ); return false; }
     const uint8_t max_msb = ( ipos + search_size ) >> 56;
-    for( int i = search_size; i >= Lzip_trailer::size; --i )
-      if( buffer[i-1] <= max_msb )	// most significant byte of member_size
+    int zero_bytes = 0;		// most significant bytes of member_size == 0
+    for( int k = 7; k > 0 && ( ( ipos + search_size ) >> ( 8 * k ) ) == 0; --k )
+      ++zero_bytes;
+    for( long long i = search_size; i >= Lzip_trailer::size; --i )
+      {
+      if( zero_bytes > 0 )
         {
-        const Lzip_trailer & trailer =
-          *(const Lzip_trailer *)( buffer + i - trailer.size );
-        const unsigned long long member_size = trailer.member_size();
-        if( member_size == 0 )			// skip trailing zeros
-          { while( i > trailer.size && buffer[i-9] == 0 ) --i; continue; }
-        if( member_size > ipos + i || !trailer.check_consistency() ) continue;
-        Lzip_header header;
-        if( !read_header( fd, header, ipos + i - member_size,
-                          cl_opts.ignore_marking ) ) return false;
-        if( !header.check( ignore_bad_ds ) ) continue;
-        const Lzip_header & header2 = *(const Lzip_header *)( buffer + i );
-        const bool full_h2 = bsize - i >= header.size;
-        if( header2.check_prefix( bsize - i ) )	// next header
-          {
-          if( !ignore_gaps && member_vector.empty() )	// last member
-            {
-            if( !full_h2 ) error_ = "Last member in input file is truncated.";
-            else if( check_header( header2, ignore_bad_ds ) )
-              error_ = "Last member in input file is truncated or corrupt.";
-            retval_ = 2; return false;
-            }
-          const unsigned dictionary_size =
-                         full_h2 ? header2.dictionary_size() : 0;
-          const unsigned long long member_size = pos - ( ipos + i );
-          pos = ipos + i;
-          // approximate data and member sizes for '-i -D'
-          member_vector.push_back( Member( 0, member_size, pos,
-                                           member_size, dictionary_size ) );
-          }
-        if( !ignore_gaps && member_vector.empty() )
+        while( i - 8 >= Lzip_trailer::size && !has_zero( buffer + i - 8 ) )
+          i -= 8;
+        int k = 0;
+        while( k < zero_bytes && buffer[i-1-k] == 0 ) ++k;
+        if( k < zero_bytes ) continue;
+        }
+      else if( buffer[i-1] > max_msb ) continue;
+      const Lzip_trailer & trailer =
+        *(const Lzip_trailer *)( buffer + i - trailer.size );
+      const unsigned long long member_size = trailer.member_size();
+      if( member_size == 0 )			// skip trailing zeros
+        { while( i > trailer.size && buffer[i-9] == 0 ) --i; continue; }
+      if( member_size > ipos + i || !trailer.check_consistency() ) continue;
+      if( member_size <= (unsigned long long)i )	// header in buffer
+        {
+        const uint8_t * const p = buffer + i - member_size;
+        // read_header checks the marking before the header
+        if( !cl_opts.ignore_marking && p[Lzip_header::size] != 0 )
+          { error_ = marking_msg; retval_ = 2; return false; }
+        if( !( (const Lzip_header *)p )->check( ignore_bad_ds ) ) continue;
+        }
+      Lzip_header header;
+      if( !read_header( fd, header, ipos + i - member_size,
+                        cl_opts.ignore_marking ) ) return false;
+      if( !header.check( ignore_bad_ds ) ) continue;
+      const Lzip_header & header2 = *(const Lzip_header *)( buffer + i );
+      const bool full_h2 = bsize - i >= header.size;
+      if( header2.check_prefix( bsize - i ) )	// next header
+        {
+        if( !ignore_gaps && member_vector.empty() )	// last member
           {
-          if( !cl_opts.loose_trailing && full_h2 && header2.check_corrupt() )
-            { error_ = corrupt_mm_msg; retval_ = 2; return false; }
-          if( !cl_opts.ignore_trailing )
-            { error_ = trailing_msg; retval_ = 2; return false; }
+          if( !full_h2 ) error_ = "Last member in input file is truncated.";
+          else if( check_header( header2, ignore_bad_ds ) )
+            error_ = "Last member in input file is truncated or corrupt.";
+          retval_ = 2; return false;
           }
-        const unsigned long long data_size = trailer.data_size();
-        if( !cl_opts.ignore_empty && data_size == 0 )
-          { error_ = empty_msg; retval_ = 2; return false; }
-        pos = ipos + i - member_size;			// good member
-        const unsigned dictionary_size = header.dictionary_size();
-        if( dictionary_size_ < dictionary_size )
-          dictionary_size_ = dictionary_size;
-        member_vector.push_back( Member( 0, data_size, pos, member_size,
-                                         dictionary_size ) );
-        return true;
+        const unsigned dictionary_size =
+                       full_h2 ? header2.dictionary_size() : 0;
+        const unsigned long long member_size = pos - ( ipos + i );
+        pos = ipos + i;
+        // approximate data and member sizes for '-i -D'
+        member_vector.push_back( Member( 0, member_size, pos,
+                                         member_size, dictionary_size ) );
+        }
+      if( !ignore_gaps && member_vector.empty() )
+        {
+        if( !cl_opts.loose_trailing && full_h2 && header2.check_corrupt() )
+          { error_ = corrupt_mm_msg; retval_ = 2; return false; }
+        if( !cl_opts.ignore_trailing )
+          { error_ = trailing_msg; retval_ = 2; return false; }
         }
+      const unsigned long long data_size = trailer.data_size();
+      if( !cl_opts.ignore_empty && data_size == 0 )
+        { error_ = empty_msg; retval_ = 2; return false; }
+      pos = ipos + i - member_size;			// good member
+      const unsigned dictionary_size = header.dictionary_size();
+      if( dictionary_size_ < dictionary_size )
+        dictionary_size_ = dictionary_size;
+      member_vector.push_back( Member( 0, data_size, pos, member_size,
+                                       dictionary_size ) );
+      return true;
+      }
     if( ipos == 0 )
       {
       if( ignore_gaps && !member_vector.empty() )
@@ -180,11 +304,145 @@ bool Lzip_index::skip_gap( const int fd, unsigned long long & pos,
     search_size = bsize - Lzip_header::size;
     rd_size = block_size;
     ipos -= rd_size;
-    std::memcpy( buffer + rd_size, buffer, buffer_size - rd_size );
+    std::memcpy( &rbuffer[rd_size], &rbuffer[0], buffer_size - rd_size );
     }
   }
 
 
+/* Set 'name' to the name of the cache file for fd and return the key
+   identifying the file and the options used to build the index.
+   Return an empty key if fd is not a regular file. */
+std::string Lzip_index::cache_key( const int fd, const Cl_options & cl_opts,
+                                   const bool ignore_bad_ds,
+                                   const bool ignore_gaps,
+                                   const long long max_pos,
+                                   std::string & name ) const
+  {
+  std::string key;
+  struct stat st;
+  if( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) ) return key;
+  key.append( (const char *)cache_magic, 4 ); key += (char)cache_version;
+  put_ull( key, st.st_dev ); put_ull( key, st.st_ino );
+  put_ull( key, st.st_size );
+  put_ull( key, st.st_mtime ); put_ull( key, mtime_nsec( st ) );
+  put_ull( key, st.st_ctime ); put_ull( key, ctime_nsec( st ) );
+  put_ull( key, max_pos );
+  key += (char)( cl_opts.ignore_empty + 2 * cl_opts.ignore_marking +
+                 4 * cl_opts.ignore_trailing + 8 * cl_opts.loose_trailing +
+                 16 * ignore_bad_ds + 32 * ignore_gaps );
+  char buf[80];
+  snprintf( buf, sizeof buf, "/%llx-%llx.lzidx",
+            (unsigned long long)st.st_dev, (unsigned long long)st.st_ino );
+  name = cl_opts.index_dir; name += buf;
+  return key;
+  }
+
+
+/* Compute the CRC32 of the headers and trailers of up to cache_samples
+   members evenly spaced in the file. Return false if read error. */
+bool Lzip_index::sample_crc( const int fd, uint32_t & crc ) const
+  {
+  const long n = member_vector.size();
+  const int samples = std::min( (long)cache_samples, n );
+  crc = 0xFFFFFFFFU;
+  for( int s = 0; s < samples; ++s )
+    {
+    const Block & mb = member_vector[( samples > 1 ) ?
+                       ( n - 1 ) * s / ( samples - 1 ) : 0].mblock;
+    Lzip_header header; Lzip_trailer trailer;
+    if( seek_read( fd, header.data, header.size, mb.pos() ) != header.size ||
+        seek_read( fd, trailer.data, trailer.size, mb.end() - trailer.size ) !=
+        trailer.size ) return false;
+    crc32.update_buf( crc, header.data, header.size );
+    crc32.update_buf( crc, trailer.data, trailer.size );
+    }
+  crc ^= 0xFFFFFFFFU;
+  return true;
+  }
+
+
+/* Load the index from the cache file 'name' if it matches 'key' and the
+   samples of fd. Return false (with an empty index) otherwise. */
+bool Lzip_index::load_cache( const int fd, const std::string & name,
+                             const std::string & key )
+  {
+  const int cfd = open( name.c_str(), O_RDONLY | O_BINARY );
+  if( cfd < 0 ) return false;
+  const unsigned long header_size = key.size() + 24;
+  struct stat st;
+  std::vector< uint8_t > buf;
+  bool ok = fstat( cfd, &st ) == 0 && st.st_size >= (long)header_size + 8 &&
+            st.st_size <= INT_MAX;
+  if( ok )
+    {
+    buf.resize( st.st_size );
+    ok = readblock( cfd, &buf[0], buf.size() ) == (long)buf.size();
+    }
+  close( cfd );
+  if( !ok || std::memcmp( &buf[0], key.data(), key.size() ) != 0 ||
+      get_ull( &buf[buf.size()-8] ) != compute_crc( &buf[0], buf.size() - 8 ) )
+    return false;
+  const uint8_t * p = &buf[key.size()];
+  const uint32_t stored_crc = get_ull( p );
+  const unsigned long long ds = get_ull( p + 8 );
+  const unsigned long long n = get_ull( p + 16 );
+  if( n == 0 || n > ( buf.size() - header_size - 8 ) / 32 ||
+      buf.size() != header_size + n * 32 + 8 ) return false;
+  p += 24;
+  long long dpos = 0, mend = 0;
+  for( unsigned long long i = 0; i < n; ++i, p += 32 )
+    {
+    const long long dsize = get_ull( p ), mpos = get_ull( p + 8 );
+    const long long msize = get_ull( p + 16 );
+    if( dsize < 0 || mpos < mend || msize <= 0 || mpos + msize > insize ||
+        dpos + dsize < dpos ) { member_vector.clear(); return false; }
+    member_vector.push_back( Member( dpos, dsize, mpos, msize,
+                                     get_ull( p + 24 ) ) );
+    dpos += dsize; mend = mpos + msize;
+    }
+  uint32_t crc;
+  if( !sample_crc( fd, crc ) || crc != stored_crc )
+    { member_vector.clear(); return false; }
+  dictionary_size_ = ds;
+  return true;
+  }
+
+
+// Write the index to the cache file 'name'. Errors are ignored.
+void Lzip_index::save_cache( const int fd, const std::string & name,
+                             const std::string & key ) const
+  {
+  uint32_t crc;
+  if( !sample_crc( fd, crc ) ) return;
+  std::string s( key );
+  put_ull( s, crc ); put_ull( s, dictionary_size_ );
+  put_ull( s, member_vector.size() );
+  for( unsigned long i = 0; i < member_vector.size(); ++i )
+    {
+    const Member & m = member_vector[i];
+    put_ull( s, m.dblock.size() ); put_ull( s, m.mblock.pos() );
+    put_ull( s, m.mblock.size() ); put_ull( s, m.dictionary_size );
+    }
+  if( s.size() > INT_MAX - 8 ) return;
+  put_ull( s, compute_crc( (const uint8_t *)s.data(), s.size() ) );
+  // write a temporary file and rename it, so that readers never see a
+  // partially written index
+  char buf[48];		// unique for each thread of each process
+  snprintf( buf, sizeof buf, ".%ld.%lx.tmp", (long)getpid(),
+            (unsigned long)this );
+  const std::string tmp_name( name + buf );
+  const int cfd = open( tmp_name.c_str(),
+                        O_CREAT | O_WRONLY | O_TRUNC | O_BINARY,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+  if( cfd < 0 ) return;
+  const bool ok = writeblock( cfd, (const uint8_t *)s.data(), s.size() ) ==
+                  (long)s.size();
+  if( close( cfd ) != 0 || !ok ||
+      std::rename( tmp_name.c_str(), name.c_str() ) != 0 )
+    std::remove( tmp_name.c_str() );
+  }
+
+
 Lzip_index::Lzip_index( const int infd, const Cl_options & cl_opts,
                         const bool ignore_bad_ds, const bool ignore_gaps,
                         const long long max_pos )
@@ -198,6 +456,14 @@ Lzip_index::Lzip_index( const int infd, const Cl_options & cl_opts,
     { error_ = "Input file is too long (2^63 bytes or more).";
       retval_ = 2; return; }
 
+  std::string cache_name, key;
+  if( cl_opts.index_dir.size() )
+    {
+    key = cache_key( infd, cl_opts, ignore_bad_ds, ignore_gaps, max_pos,
+                     cache_name );
+    if( key.size() && load_cache( infd, cache_name, key ) ) return;
+    }
+
   Lzip_header header;
   if( !read_header( infd, header, 0, cl_opts.ignore_marking ) ||
       !check_header( header, ignore_bad_ds ) ) return;
@@ -261,6 +527,7 @@ Lzip_index::Lzip_index( const int infd, const Cl_options & cl_opts,
     if( member_vector[i].mblock.end() > member_vector[i+1].mblock.pos() )
       internal_error( "two mblocks overlap after constructing a Lzip_index." );
     }
+  if( key.size() ) save_cache( infd, cache_name, key );
   }
 
 
@@ -50,6 +50,14 @@ class Lzip_index
   bool skip_gap( const int fd, unsigned long long & pos,
                  const Cl_options & cl_opts,
                  const bool ignore_bad_ds, const bool ignore_gaps );
+  std::string cache_key( const int fd, const Cl_options & cl_opts,
+                         const bool ignore_bad_ds, const bool ignore_gaps,
+                         const long long max_pos, std::string & name ) const;
+  bool sample_crc( const int fd, uint32_t & crc ) const;
+  bool load_cache( const int fd, const std::string & name,
+                   const std::string & key );
+  void save_cache( const int fd, const std::string & name,
+                   const std::string & key ) const;
 
 public:
   Lzip_index()
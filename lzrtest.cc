@@ -0,0 +1,125 @@
+/* Lzrtest - Test driver for liblziprecover.a
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+   Usage: lzrtest t|d|b file
+          lzrtest r pos size file
+
+   Call the function of liblziprecover.a selected by the first argument on
+   the file (t = lzr_test_members, d = lzr_decompress, b = lzr_test_buffer,
+   r = lzr_decompress_range). Decompressed data are written to stdout. The
+   number of members and the data size are written to stderr, or the error
+   returned by the function if it fails.
+
+   Exit status: the value returned by the function, or 1 if the file can't
+   be read.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "lzip.h"
+#include "lzip_index.h"
+#include "liblziprecover.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+
+namespace {
+
+const char * const prog_name = "lzrtest";
+
+void show_usage()
+  {
+  std::fprintf( stderr, "Usage: %s t|d|b file\n"
+                        "       %s r pos size file\n",
+                prog_name, prog_name );
+  }
+
+
+int file_error( const char * const name, const char * const msg )
+  {
+  std::fprintf( stderr, "%s: %s: %s: %s\n", prog_name, name, msg,
+                std::strerror( errno ) );
+  return 1;
+  }
+
+
+int test_buffer( const int infd, const char * const name,
+                 const Cl_options & cl_opts, Lzr_result & result )
+  {
+  struct stat st;
+  if( fstat( infd, &st ) != 0 ) return file_error( name, "Can't stat" );
+  const long size = st.st_size;
+  std::vector< uint8_t > buffer( size + 1 );	// avoid &buffer[0] if empty
+  if( readblock( infd, &buffer[0], size ) != size )
+    return file_error( name, "Read error" );
+  return lzr_test_buffer( &buffer[0], size, cl_opts, result );
+  }
+
+} // end namespace
+
+
+int main( const int argc, const char * const argv[] )
+  {
+  const char mode = ( argc >= 2 ) ? argv[1][0] : 0;
+  if( ( argc != 3 || std::strchr( "tdb", mode ) == 0 ) &&
+      ( argc != 5 || mode != 'r' ) )
+    { show_usage(); return 1; }
+  const char * const name = argv[argc-1];
+  const int infd = open( name, O_RDONLY | O_BINARY );
+  if( infd < 0 ) return file_error( name, "Can't open input file" );
+
+  const Cl_options cl_opts;
+  Lzr_result result;
+  int retval = 0;
+  if( mode == 'd' ) retval = lzr_decompress( infd, STDOUT_FILENO, cl_opts, result );
+  else if( mode == 'b' ) retval = test_buffer( infd, name, cl_opts, result );
+  else
+    {
+    const Lzip_index lzip_index( infd, cl_opts );
+    if( mode == 't' )
+      retval = lzr_test_members( infd, lzip_index, cl_opts, result );
+    else
+      {
+      const Block range( std::strtoll( argv[2], 0, 0 ),
+                         std::strtoll( argv[3], 0, 0 ) );
+      retval = lzr_decompress_range( infd, STDOUT_FILENO, lzip_index, range,
+                                     cl_opts, result );
+      }
+    }
+  close( infd );
+  if( retval != 0 && result.retval == 0 ) return retval;	// read error
+  if( result.retval == 0 )
+    std::fprintf( stderr, "%ld members, %llu bytes\n", result.members,
+                  result.data_size );
+  else
+    std::fprintf( stderr, "%s: %s: %s (pos %lld)\n", prog_name, name,
+                  result.error.c_str(), result.error_pos );
+  return result.retval;
+  }
@@ -32,6 +32,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <new>
+#include <queue>
 #include <string>
 #include <vector>
 #include <fcntl.h>
@@ -39,6 +40,10 @@
 #include <unistd.h>
 #include <utime.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#if !defined __MSVCRT__ && !defined __DJGPP__
+#include <sys/mman.h>
+#endif
 #if defined __MSVCRT__ || defined __OS2__ || defined __DJGPP__
 #include <io.h>
 #if defined __MSVCRT__
@@ -62,6 +67,10 @@
 #include "arg_parser.h"
 #include "lzip.h"
 #include "decoder.h"
+#include "lzip_index.h"
+#include "md5.h"
+#include "threads.h"
+#include "async_io.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -76,10 +85,6 @@
 #error "Environments where 'size_t' is narrower than 'long' are not supported."
 #endif
 
-bool fits_in_size_t( const unsigned long long size )	// fits also in long
-  { return ( sizeof (long) <= sizeof (size_t) && size <= LONG_MAX ) ||
-           ( sizeof (int) <= sizeof (size_t) && size <= INT_MAX ); }
-
 int verbosity = 0;
 
 const char * const program_name = "lziprecover";
@@ -142,16 +147,24 @@ void show_help()
                "  -k, --keep                    keep (don't delete) input files\n"
                "  -l, --list                    print (un)compressed file sizes\n"
                "  -m, --merge                   repair errors in file using several copies\n"
+               "  -n, --threads=<n>             set number of worker threads [1]\n"
+               "      --jobs=<n>                repair, reproduce, or test <n> files at once\n"
                "  -o, --output=<file>           place the output into <file>\n"
                "  -q, --quiet                   suppress all messages\n"
                "  -R, --byte-repair             try to repair a corrupt byte in file\n"
+               "      --repair-strategy=<s>     try bit flips first (bits) or all values [bits]\n"
                "  -s, --split                   split multimember file in single-member files\n"
                "  -t, --test                    test compressed file integrity\n"
                "  -v, --verbose                 be verbose (a 2nd -v gives more)\n"
                "      --dump=<list>:d:e:t       dump members, damaged/empty, tdata to stdout\n"
                "      --remove=<list>:d:e:t     remove members, tdata from files in place\n"
                "      --strip=<list>:d:e:t      copy files to stdout stripping members given\n"
+               "      --async-io=<bytes>        read and write in background threads in -d, -t\n"
+               "      --digests[=<file>]        print CRC32 and MD5 of decompressed data\n"
+               "      --memory-limit=<bytes>    limit the dictionary memory used by threads\n"
+               "      --mmap-io                 decompress regular files into mapped output\n"
                "      --empty-error             exit with error status if empty member in file\n"
+               "      --index-cache=<dir>       keep the indexes of the files read in <dir>\n"
                "      --marking-error           exit with error status if 1st LZMA byte not 0\n"
                "      --loose-trailing          allow trailing data seeming corrupt header\n"
                "      --clear-marking           reset the first LZMA byte of each member\n" );
@@ -165,7 +178,8 @@ void show_help()
                  "  -W, --debug-decompress=<pos>,<val>  set pos to val and decompress to stdout\n"
                  "  -X, --show-packets[=<pos>,<val>]  show in stdout the decoded LZMA packets\n"
                  "  -Y, --debug-delay=<range>         find max error detection delay in <range>\n"
-                 "  -Z, --debug-byte-repair=<pos>,<val>  test repair one-byte error at <pos>\n" );
+                 "  -Z, --debug-byte-repair=<pos>,<val>  test repair one-byte error at <pos>\n"
+                 "      --stats[=<fd>]                print counters of expensive steps at exit\n" );
     }
   std::printf( "\nIf no file names are given, or if a file is '-', lziprecover decompresses\n"
                "from standard input to standard output.\n"
@@ -196,15 +210,6 @@ void Pretty_print::operator()( const char * const msg, FILE * const f ) const
   }
 
 
-const char * bad_version( const unsigned version )
-  {
-  static char buf[80];
-  snprintf( buf, sizeof buf, "Version %u member format not supported.",
-            version );
-  return buf;
-  }
-
-
 const char * format_ds( const unsigned dictionary_size )
   {
   enum { bufsize = 16, factor = 1024, n = 3 };
@@ -368,6 +373,17 @@ void parse_u( const char * const arg, const char * const option_name,
   }
 
 
+// Recognized strategies: bits bytes
+bool parse_repair_strategy( const char * const arg,
+                            const char * const option_name )
+  {
+  if( std::strcmp( arg, "bits" ) == 0 ) return true;
+  if( std::strcmp( arg, "bytes" ) == 0 ) return false;
+  show_option_error( arg, "Invalid argument in", option_name );
+  std::exit( 1 );
+  }
+
+
 int extension_index( const std::string & name )
   {
   for( int eindex = 0; known_extensions[eindex].from; ++eindex )
@@ -651,15 +667,159 @@ bool show_trailing_data( const uint8_t * const data, const int size,
   }
 
 
+/* Computes the CRC32 and MD5 of the data of each member and of the whole
+   stream while they are decoded, and prints them to 'file'. */
+class Stream_digest : public Data_sink
+  {
+  FILE * const file;
+  const char * const name;
+  MD5SUM member_md5;
+  MD5SUM stream_md5;
+  uint32_t stream_crc;
+  long members;
+
+  void print( MD5SUM & md5sum, const uint32_t crc, const long member )
+    {
+    md5_type digest;
+    md5sum.md5_finish( digest );
+    for( int i = 0; i < 16; ++i ) std::fprintf( file, "%02x", digest.data[i] );
+    if( member > 0 )
+      std::fprintf( file, "  %08X  %s:%ld\n", crc, name, member );
+    else std::fprintf( file, "  %08X  %s\n", crc, name );
+    }
+
+public:
+  Stream_digest( FILE * const f, const char * const n )
+    : file( f ), name( n ), stream_crc( 0xFFFFFFFFU ), members( 0 ) {}
+
+  void start_member() { member_md5.reset(); ++members; }
+
+  void write_data( const uint8_t * const buf, const int size )
+    {
+    member_md5.md5_update( buf, size );
+    stream_md5.md5_update( buf, size );
+    crc32.update_buf( stream_crc, buf, size );
+    }
+
+  void print_member( const uint32_t crc ) { print( member_md5, crc, members ); }
+  void print_stream()
+    { print( stream_md5, stream_crc ^ 0xFFFFFFFFU, 0 ); std::fflush( file ); }
+  };
+
+
+#if defined MAP_SHARED && defined _POSIX_ADVISORY_INFO && \
+    _POSIX_ADVISORY_INFO > 0
+#define MMAP_IO
+#endif
+
+/* Input and output files of decompress mapped in memory, so that the data
+   are decoded from the input and into the output without copying them.
+   The output file is allocated in advance with the size of the data found
+   by Lzip_index to avoid running out of space while writing the mapping,
+   plus one byte required by LZ_decoder. */
+class Mapped_files
+  {
+  const uint8_t * in_;
+  long long in_size_;
+  uint8_t * out_;
+  long long out_size_;
+  int ofd;
+
+  Mapped_files( const Mapped_files & );		// declared as private
+  void operator=( const Mapped_files & );	// declared as private
+
+public:
+  Mapped_files()
+    : in_( 0 ), in_size_( 0 ), out_( 0 ), out_size_( 0 ), ofd( -1 ) {}
+  ~Mapped_files() { unmap(); }
+
+  const uint8_t * in() const { return in_; }
+  long long in_size() const { return in_size_; }
+  uint8_t * out() const { return out_; }
+  uint8_t * out_end() const { return out_ ? out_ + out_size_ + 1 : 0; }
+
+  // Return false (not an error) if the files can't be mapped.
+  bool map( const int infd, const int outfd, const Cl_options & cl_opts )
+    {
+#ifdef MMAP_IO
+    struct stat st;
+    if( fstat( outfd, &st ) != 0 || !S_ISREG( st.st_mode ) ||
+        st.st_size != 0 || lseek( outfd, 0, SEEK_CUR ) != 0 ) return false;
+    const Lzip_index lzip_index( infd, cl_opts );
+    if( lseek( infd, 0, SEEK_SET ) != 0 || lzip_index.retval() != 0 ||
+        !fits_in_size_t( lzip_index.file_size() ) ||
+        !fits_in_size_t( lzip_index.udata_size() + 1 ) ) return false;
+    const long long isize = lzip_index.file_size();
+    const long long osize = lzip_index.udata_size();
+    if( posix_fallocate( outfd, 0, osize + 1 ) != 0 )
+      { if( ftruncate( outfd, 0 ) != 0 ) {} return false; }
+    void * const ip = mmap( 0, isize, PROT_READ, MAP_PRIVATE, infd, 0 );
+    void * const op = mmap( 0, osize + 1, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            outfd, 0 );
+    if( ip == MAP_FAILED || op == MAP_FAILED )
+      {
+      if( ip != MAP_FAILED ) munmap( ip, isize );
+      if( op != MAP_FAILED ) munmap( op, osize + 1 );
+      if( ftruncate( outfd, 0 ) != 0 ) {}
+      return false;
+      }
+    madvise( ip, isize, MADV_SEQUENTIAL );	// errors are ignored
+    in_ = (const uint8_t *)ip; in_size_ = isize;
+    out_ = (uint8_t *)op; out_size_ = osize; ofd = outfd;
+    return true;
+#else
+    return false;
+#endif
+    }
+
+  /* Unmap the files and set the size of the output file to the size of
+     the data decoded. Return false if error. */
+  bool unmap( const unsigned long long data_size = 0 )
+    {
+#ifdef MMAP_IO
+    if( !out_ ) return true;
+    munmap( (void *)in_, in_size_ ); munmap( out_, out_size_ + 1 );
+    in_ = 0; out_ = 0;
+    stat_add( st_bytes_written, data_size );
+    return ftruncate( ofd, data_size ) == 0 &&
+           lseek( ofd, data_size, SEEK_SET ) == (long long)data_size;
+#else
+    return true;
+#endif
+    }
+  };
+
+
 int decompress( const unsigned long long cfile_size, const int infd,
                 const Cl_options & cl_opts, const Pretty_print & pp,
-                const bool testing )
+                const bool testing, const int num_workers,
+                FILE * const digest_file )
   {
   unsigned long long partial_file_pos = 0;
-  Range_decoder rdec( infd );
+  unsigned long long outskip = 0;	// data already written by dec_mt
+  unsigned long long data_pos = 0;	// data decoded into mapped output
+  Stream_digest stream_digest( digest_file, pp.name() );
+  Stream_digest * const digest = digest_file ? &stream_digest : 0;
+  Mapped_files maps;
+  // data are not written after a decoder error, so -i can't be honored
+  if( cl_opts.mmap_io && cfile_size > 0 && !testing && outfd >= 0 &&
+      !cl_opts.ignore_errors ) maps.map( infd, outfd, cl_opts );
+  /* progress and per-member messages require serial decoding, and the MD5
+     of the stream must be computed in order */
+  if( num_workers > 1 && cfile_size > 0 && verbosity < 2 && !digest &&
+      !maps.out() )
+    partial_file_pos =
+      dec_mt( infd, cl_opts, pp, testing, num_workers, outskip );
+  // read ahead only regular files, as reading a pipe may block forever
+  Range_decoder rdec( infd, ( cfile_size > 0 ) ? cl_opts.async_size : 0,
+                      maps.in(), maps.in_size() );
+  const bool async_write = ( cl_opts.async_size > 0 && !testing &&
+                             outfd >= 0 && !maps.out() );
+  Async_writer writer( async_write ? outfd : -1, cl_opts.async_size );
   int retval = 0;
 
-  for( bool first_member = true; ; first_member = false )
+  for( bool first_member = ( partial_file_pos == 0 ); ;
+       first_member = false )
     {
     Lzip_header header;
     rdec.reset_member_position();
@@ -689,7 +849,7 @@ int decompress( const unsigned long long cfile_size, const int infd,
       if( cl_opts.ignore_errors ) { pp.reset(); continue; } else break;
       }
     if( !header.check_version() )
-      { pp( bad_version( header.version() ) ); retval = 2;
+      { pp( bad_version( header.version() ).c_str() ); retval = 2;
         if( cl_opts.ignore_errors ) { pp.reset(); continue; } else break; }
     const unsigned dictionary_size = header.dictionary_size();
     if( !isvalid_ds( dictionary_size ) )
@@ -698,10 +858,16 @@ int decompress( const unsigned long long cfile_size, const int infd,
 
     if( verbosity >= 2 || ( verbosity == 1 && first_member ) ) pp();
 
-    LZ_decoder decoder( rdec, dictionary_size, outfd );
+    if( digest ) digest->start_member();
+    LZ_decoder decoder( rdec, dictionary_size, maps.out() ? -1 : outfd,
+                        outskip, -1ULL, async_write ? &writer : 0, digest,
+                        maps.out() ? maps.out() + data_pos : 0,
+                        maps.out_end() );
+    outskip = 0;
     show_dprogress( cfile_size, partial_file_pos, &rdec, &pp );	// init
     const int result = decoder.decode_member( cl_opts, pp );
     partial_file_pos += rdec.member_position();
+    data_pos += decoder.data_position();
     if( result != 0 )
       {
       retval = 2;
@@ -716,15 +882,169 @@ int decompress( const unsigned long long cfile_size, const int infd,
       else if( result == 6 ) { pp( marking_msg ); break; }
       if( cl_opts.ignore_errors ) { pp.reset(); continue; } else break;
       }
+    if( digest ) digest->print_member( decoder.crc() );
     if( verbosity >= 2 )
       { std::fputs( testing ? "ok\n" : "done\n", stderr ); pp.reset(); }
     }
+  writer.finish();
+  if( !maps.unmap( data_pos ) )
+    { show_file_error( pp.name(), "Error setting size of output file", errno );
+      return 1; }
+  if( digest && retval == 0 ) digest->print_stream();
   if( verbosity == 1 && retval == 0 )
     std::fputs( testing ? "ok\n" : "done\n", stderr );
   if( retval == 2 && cl_opts.ignore_errors ) retval = 0;
   return retval;
   }
 
+
+struct File_job			// file processed in a child process
+  {
+  pid_t pid;			// > 0 = running, 0 = not started or finished
+  int status;			// exit status of the child
+  FILE * out;			// standard output of the child
+  FILE * err;			// standard error of the child
+  FILE * stats;			// counters of the child if --stats
+  unsigned long long memory;	// dictionary size of the file, or 0
+  bool sized;			// memory has been set
+  File_job() : pid( 0 ), status( 0 ), out( 0 ), err( 0 ), stats( 0 ),
+               memory( 0 ), sized( false ) {}
+  };
+
+
+/* Return the dictionary size of the file, or 0 if unknown. If the indexes
+   are cached, return the largest dictionary size in the index, which the
+   child then reads from the cache. Else read just the header of the first
+   member instead of building an index that the child would build again. */
+unsigned long long file_memory( const std::string & filename,
+                                const Cl_options & cl_opts )
+  {
+  const int infd = open( filename.c_str(), O_RDONLY | O_BINARY );
+  if( infd < 0 ) return 0;
+  unsigned long long memory = 0;
+  if( cl_opts.index_dir.size() )
+    {
+    const Lzip_index lzip_index( infd, cl_opts );
+    if( lzip_index.retval() == 0 ) memory = lzip_index.dictionary_size();
+    }
+  else
+    {
+    Lzip_header header;
+    if( readblock( infd, header.data, header.size ) == header.size &&
+        header.check() ) memory = header.dictionary_size();
+    }
+  close( infd );
+  return memory;
+  }
+
+
+void show_job_output( FILE * const f, FILE * const to )
+  {
+  if( !f ) return;
+  std::rewind( f );
+  uint8_t buffer[4096];
+  size_t size;
+  while( ( size = std::fread( buffer, 1, sizeof buffer, f ) ) > 0 )
+    std::fwrite( buffer, 1, size, to );
+  std::fflush( to );
+  std::fclose( f );
+  }
+
+
+/* Process each file in its own child process, running up to 'num_jobs'
+   children at once. A child is not started while the dictionary sizes of
+   the files being processed would add up to more than memory_budget()
+   (except when no other child is running). The dictionary size of each
+   file is read when the file is about to be started.
+   The standard output and error of each child are collected in temporary
+   files and shown in the order of the files, so that the messages about
+   different files are not mixed. To bound the number of temporary files,
+   a file is not started while more than 4 * num_jobs files wait to be
+   shown. The counters of --stats of each child are added to those of the
+   parent.
+   Return the index of the file to be processed in the child, or -1 in the
+   parent after all the children have finished. In the parent, 'retval' is
+   set to the highest exit status and 'failed' to the number of files that
+   failed. */
+int run_jobs( const std::vector< std::string > & filenames,
+              const Cl_options & cl_opts, const int num_jobs,
+              int & retval, int & failed )
+  {
+  const int files = filenames.size();
+  std::vector< File_job > jobs( files );
+  const unsigned long long budget = memory_budget();
+  int next = 0;				// next file to be started
+  int shown = 0;			// next file whose output is shown
+  int running = 0;
+  unsigned long long used = 0;		// memory of the running children
+  const int max_ahead = 4 * num_jobs;
+  retval = 0; failed = 0;
+  while( shown < files )
+    {
+    while( next < files && running < num_jobs && next - shown < max_ahead )
+      {
+      File_job & job = jobs[next];
+      if( !job.sized )
+        { job.memory = file_memory( filenames[next], cl_opts );
+          job.sized = true; }
+      if( running > 0 && used + job.memory > budget ) break;
+      job.out = std::tmpfile();
+      job.err = job.out ? std::tmpfile() : 0;
+      job.stats = ( job.err && stats_enabled ) ? std::tmpfile() : 0;
+      if( !job.out || !job.err || ( stats_enabled && !job.stats ) )
+        {
+        show_error( "Can't create temporary file", errno );
+        if( job.out ) { std::fclose( job.out ); job.out = 0; }
+        if( job.err ) { std::fclose( job.err ); job.err = 0; }
+        job.status = 1; ++next; continue;
+        }
+      std::fflush( stdout ); std::fflush( stderr );
+      const pid_t pid = fork();
+      if( pid == 0 )			// child (process file 'next')
+        {
+        if( dup2( fileno( job.out ), STDOUT_FILENO ) < 0 ||
+            dup2( fileno( job.err ), STDERR_FILENO ) < 0 ) _exit( 1 );
+        if( job.stats ) set_child_stats( fileno( job.stats ) );
+        return next;
+        }
+      if( pid < 0 )
+        { show_error( "Can't fork job", errno ); job.status = 1; }
+      else
+        { job.pid = pid; ++running; used += job.memory;
+          stat_add( st_children ); }
+      ++next;
+      }
+    if( running > 0 )			// wait for any child
+      {
+      int status;
+      const pid_t pid = wait( &status );
+      if( pid < 0 )
+        {
+        if( errno == EINTR ) continue;
+        show_error( "Error waiting termination of job", errno );
+        std::exit( 1 );
+        }
+      for( int i = shown; i < next; ++i )
+        if( jobs[i].pid == pid )
+          {
+          jobs[i].pid = 0; --running; used -= jobs[i].memory;
+          jobs[i].status = WIFEXITED( status ) ? WEXITSTATUS( status ) : 1;
+          break;
+          }
+      }
+    while( shown < next && jobs[shown].pid == 0 )	// show in order
+      {
+      File_job & job = jobs[shown++];
+      show_job_output( job.out, stdout );
+      show_job_output( job.err, stderr );
+      add_child_stats( job.stats );
+      set_retval( retval, job.status );
+      if( job.status != 0 ) ++failed;
+      }
+    }
+  return -1;
+  }
+
 } // end namespace
 
 void set_signal_handler() { set_signals( signal_handler ); }
@@ -799,6 +1119,7 @@ int main( const int argc, const char * const argv[] )
   Bad_byte bad_byte;
   Member_list member_list;
   std::string default_output_filename;
+  const char * digest_filename = 0;	// print digests of -d, -t to file
   const char * lzip_name = "lzip";		// default is lzip
   const char * reference_filename = 0;
   Mode program_mode = m_none;
@@ -806,14 +1127,19 @@ int main( const int argc, const char * const argv[] )
 				// '0'..'9' = level, 'a' = all levels
 				// -5..-273 = match length, -1 = all lengths
   int repeated_byte = -1;	// 0 to 255, or -1 for all values
+  int num_workers = 1;		// start this many worker threads
+  int num_jobs = 1;		// process this many files at once
+  unsigned long long memory_limit = 0;	// 0 = no limit
   Cl_options cl_opts;		// command-line options
+  bool bit_flips_first = true;	// strategy of --byte-repair
   bool force = false;
   bool keep_input_files = false;
   bool to_stdout = false;
   if( argc > 0 ) invocation_name = argv[0];
 
-  enum { opt_cm = 256, opt_du, opt_eer, opt_lt, opt_lzl, opt_lzn, opt_mer,
-         opt_ref, opt_rem, opt_st };
+  enum { opt_aio = 256, opt_cm, opt_dig, opt_du, opt_eer, opt_ic, opt_job,
+         opt_lt, opt_lzl, opt_lzn, opt_mer, opt_mem, opt_mio, opt_ref,
+         opt_rem, opt_rst, opt_sts, opt_st };
   const Arg_parser::Option options[] =
     {
     { 'a', "trailing-error",     Arg_parser::no  },
@@ -845,15 +1171,23 @@ int main( const int argc, const char * const argv[] )
     { 'X', "show-packets",       Arg_parser::maybe },
     { 'Y', "debug-delay",        Arg_parser::yes },
     { 'Z', "debug-byte-repair",  Arg_parser::yes },
+    { opt_aio, "async-io",       Arg_parser::yes },
     { opt_cm,  "clear-marking",  Arg_parser::no  },
+    { opt_dig, "digests",        Arg_parser::maybe },
     { opt_du,  "dump",           Arg_parser::yes },
     { opt_eer, "empty-error",    Arg_parser::no  },
+    { opt_ic,  "index-cache",    Arg_parser::yes },
+    { opt_job, "jobs",           Arg_parser::yes },
     { opt_lt,  "loose-trailing", Arg_parser::no  },
     { opt_lzl, "lzip-level",     Arg_parser::yes },
     { opt_lzn, "lzip-name",      Arg_parser::yes },
     { opt_mer, "marking-error",  Arg_parser::no  },
+    { opt_mem, "memory-limit",   Arg_parser::yes },
+    { opt_mio, "mmap-io",        Arg_parser::no  },
     { opt_ref, "reference-file", Arg_parser::yes },
     { opt_rem, "remove",         Arg_parser::yes },
+    { opt_rst, "repair-strategy", Arg_parser::yes },
+    { opt_sts, "stats",          Arg_parser::maybe },
     { opt_st,  "strip",          Arg_parser::yes },
     {  0, 0,                     Arg_parser::no  } };
 
@@ -887,7 +1221,7 @@ int main( const int argc, const char * const argv[] )
       case 'l': set_mode( program_mode, m_list ); break;
       case 'm': set_mode( program_mode, m_merge ); break;
       case 'M': set_mode( program_mode, m_md5sum ); break;
-      case 'n': break;
+      case 'n': num_workers = getnum( arg, pn, 0, 1, max_workers ); break;
       case 'o': if( sarg == "-" ) to_stdout = true;
                 else { default_output_filename = sarg; } break;
       case 'q': verbosity = -1; break;
@@ -907,18 +1241,29 @@ int main( const int argc, const char * const argv[] )
                 parse_range( arg, pn, range ); break;
       case 'Z': set_mode( program_mode, m_debug_byte_repair );
                 bad_byte.parse_bb( arg, pn ); break;
+      case opt_aio: cl_opts.async_size = getnum( arg, pn, 0, 4096, 1 << 30 );
+                    break;
       case opt_cm: set_mode( program_mode, m_clear_marking );
                    cl_opts.ignore_marking = true; break;
+      case opt_dig: digest_filename = arg; break;
       case opt_du: set_mode( program_mode, m_dump );
                    member_list.parse_ml( arg, pn, cl_opts ); break;
       case opt_eer: cl_opts.ignore_empty = false; break;
+      case opt_ic:  cl_opts.index_dir = sarg; break;
+      case opt_job: num_jobs = getnum( arg, pn, 0, 1, max_workers ); break;
       case opt_lt:  cl_opts.loose_trailing = true; break;
       case opt_lzl: lzip_level = parse_lzip_level( arg, pn ); break;
       case opt_lzn: lzip_name = arg; break;
       case opt_mer: cl_opts.ignore_marking = false; break;
+      case opt_mem: memory_limit = getnum( arg, pn, 0, 1, LLONG_MAX );
+                    set_memory_limit( memory_limit ); break;
+      case opt_mio: cl_opts.mmap_io = true; break;
       case opt_ref: reference_filename = arg; break;
       case opt_rem: set_mode( program_mode, m_remove );
                     member_list.parse_ml( arg, pn, cl_opts ); break;
+      case opt_rst: bit_flips_first = parse_repair_strategy( arg, pn ); break;
+      case opt_sts: enable_stats( arg[0] ? getnum( arg, pn, 0, 0, INT_MAX ) : 2 );
+                    break;
       case opt_st: set_mode( program_mode, m_strip );
                    member_list.parse_ml( arg, pn, cl_opts ); break;
       default: internal_error( "uncaught option." );
@@ -944,6 +1289,32 @@ int main( const int argc, const char * const argv[] )
     if( filenames.back() != "-" ) filenames_given = true;
     }
 
+  /* Repair, reproduce, or test several files at once, each one in its own
+     process. Several files can be repaired or reproduced only this way. */
+  int job_index = -1;			// file tested by this job, or -1
+  if( filenames.size() > 1 &&
+      ( program_mode == m_byte_repair || program_mode == m_reproduce ||
+        ( program_mode == m_test && num_jobs > 1 &&
+          ( !digest_filename || !digest_filename[0] ) &&
+          std::find( filenames.begin(), filenames.end(), "-" ) ==
+          filenames.end() ) ) )
+    {
+    if( program_mode != m_test && default_output_filename.size() )
+      { show_error( "Option '-o' can't be used with more than 1 file.", 0,
+                    true ); return 1; }
+    int retval, failed;
+    const int i = run_jobs( filenames, cl_opts, num_jobs, retval, failed );
+    if( i < 0 )				// parent
+      {
+      if( program_mode == m_test && failed > 0 && verbosity >= 1 )
+        std::fprintf( stderr, "%s: warning: %d %s failed the test.\n",
+                      program_name, failed, ( failed == 1 ) ? "file" : "files" );
+      return retval;
+      }
+    if( program_mode == m_test ) job_index = i;
+    else filenames.assign( 1, filenames[i] );
+    }
+
   const char terminator = isatty( STDOUT_FILENO ) ? '\r' : '\n';
   try {
   switch( program_mode )
@@ -953,13 +1324,14 @@ int main( const int argc, const char * const argv[] )
     case m_byte_repair:
       one_file( filenames.size() );
       return byte_repair( filenames[0], default_output_filename, cl_opts,
-                          terminator, force );
+                          terminator, force, bit_flips_first, num_workers );
     case m_clear_marking:
       at_least_one_file( filenames.size() );
       return clear_marking( filenames, cl_opts );
     case m_debug_byte_repair:
       one_file( filenames.size() );
-      return debug_byte_repair( filenames[0].c_str(), cl_opts, bad_byte, terminator );
+      return debug_byte_repair( filenames[0].c_str(), cl_opts, bad_byte,
+                                terminator, bit_flips_first );
     case m_debug_decompress:
       one_file( filenames.size() );
       return debug_decompress( filenames[0].c_str(), cl_opts, bad_byte, false );
@@ -978,13 +1350,14 @@ int main( const int argc, const char * const argv[] )
       if( filenames.size() < 2 )
         { show_error( "You must specify at least 2 files.", 0, true ); return 1; }
       return merge_files( filenames, default_output_filename, cl_opts,
-                          terminator, force );
+                          terminator, force, num_workers );
     case m_nrep_stats:
-      return print_nrep_stats( filenames, cl_opts, repeated_byte );
+      return print_nrep_stats( filenames, cl_opts, repeated_byte,
+                               num_workers );
     case m_range_dec:
       one_file( filenames.size() );
       return range_decompress( filenames[0], default_output_filename,
-                               cl_opts, range, force, to_stdout );
+                               cl_opts, range, force, to_stdout, num_workers );
     case m_remove:
       at_least_one_file( filenames.size() );
       return remove_members( filenames, cl_opts, member_list );
@@ -994,10 +1367,12 @@ int main( const int argc, const char * const argv[] )
         { show_error( "You must specify a reference file.", 0, true ); return 1; }
       if( range.size() > 0 )
         return debug_reproduce_file( filenames[0].c_str(), lzip_name,
-                 reference_filename, cl_opts, range, sector_size, lzip_level );
+                 reference_filename, cl_opts, range, sector_size, lzip_level,
+                 num_workers );
       else
         return reproduce_file( filenames[0], default_output_filename, lzip_name,
-                 reference_filename, cl_opts, lzip_level, terminator, force );
+                 reference_filename, cl_opts, lzip_level, terminator, force,
+                 num_workers );
     case m_show_packets:
       one_file( filenames.size() );
       return debug_decompress( filenames[0].c_str(), cl_opts, bad_byte, true );
@@ -1007,10 +1382,11 @@ int main( const int argc, const char * const argv[] )
     case m_test: break;
     case m_unzcrash_bit:
       one_file( filenames.size() );
-      return lunzcrash_bit( filenames[0].c_str(), cl_opts );
+      return lunzcrash_bit( filenames[0].c_str(), cl_opts, num_workers );
     case m_unzcrash_block:
       one_file( filenames.size() );
-      return lunzcrash_block( filenames[0].c_str(), cl_opts, sector_size );
+      return lunzcrash_block( filenames[0].c_str(), cl_opts, sector_size,
+                              num_workers );
     }
     }
   catch( std::bad_alloc & ) { show_error( mem_msg ); cleanup_and_fail( 1 ); }
@@ -1018,8 +1394,9 @@ int main( const int argc, const char * const argv[] )
 
   if( filenames.empty() ) filenames.push_back("-");
 
-  if( program_mode == m_list ) return list_files( filenames, cl_opts );
-  if( program_mode == m_md5sum ) return md5sum_files( filenames );
+  if( program_mode == m_list )	// one table for all the files
+    return list_files( filenames, cl_opts, std::max( num_workers, num_jobs ) );
+  if( program_mode == m_md5sum ) return md5sum_files( filenames, num_workers );
 
   if( program_mode != m_alone_to_lz && program_mode != m_decompress &&
       program_mode != m_test )
@@ -1039,9 +1416,29 @@ int main( const int argc, const char * const argv[] )
 
   Pretty_print pp( filenames );
 
+  /* Digests go to standard output unless the decompressed data go there.
+     ("-" with one_to_one also writes the data to standard output). */
+  FILE * digest_file = 0;
+  if( digest_filename && program_mode != m_alone_to_lz )
+    {
+    if( digest_filename[0] )
+      {
+      digest_file = std::fopen( digest_filename, "w" );
+      if( !digest_file )
+        { show_file_error( digest_filename, "Can't create digest file",
+                           errno ); return 1; }
+      }
+    else if( program_mode == m_test || ( outfd < 0 &&
+             std::find( filenames.begin(), filenames.end(), "-" ) ==
+             filenames.end() ) ) digest_file = stdout;
+    else digest_file = stderr;
+    }
+
   int failed_tests = 0;
   int retval = 0;
   const bool one_to_one = !to_stdout && program_mode != m_test && !to_file;
+  // the output file must be readable to be mapped
+  const bool mapped_output = cl_opts.mmap_io && program_mode == m_decompress;
   bool stdin_used = false;
   struct stat in_stats;
   for( unsigned i = 0; i < filenames.size(); ++i )
@@ -1049,6 +1446,7 @@ int main( const int argc, const char * const argv[] )
     std::string input_filename;
     int infd;
 
+    if( job_index >= 0 && (int)i != job_index ) continue;
     pp.set_name( filenames[i] );
     if( filenames[i] == "-" )
       {
@@ -1067,7 +1465,7 @@ int main( const int argc, const char * const argv[] )
         {
         if( program_mode == m_alone_to_lz ) set_a_outname( input_filename );
         else set_d_outname( input_filename, extension_index( input_filename ) );
-        if( !open_outstream( force, true ) )
+        if( !open_outstream( force, true, mapped_output ) )
           { close( infd ); set_retval( retval, 1 ); continue; }
         }
       }
@@ -1078,7 +1476,8 @@ int main( const int argc, const char * const argv[] )
     if( to_file && outfd < 0 )		// open outfd after checking infd
       {
       output_filename = default_output_filename;
-      if( !open_outstream( force, false ) || !check_tty_out( program_mode ) )
+      if( !open_outstream( force, false, mapped_output ) ||
+          !check_tty_out( program_mode ) )
         return 1;	// check tty only once and don't try to delete a tty
       }
 
@@ -1092,7 +1491,8 @@ int main( const int argc, const char * const argv[] )
       if( program_mode == m_alone_to_lz )
         tmp = alone_to_lz( infd, pp );
       else
-        tmp = decompress( cfile_size, infd, cl_opts, pp, program_mode == m_test );
+        tmp = decompress( cfile_size, infd, cl_opts, pp,
+                          program_mode == m_test, num_workers, digest_file );
       }
     catch( std::bad_alloc & ) { pp( mem_msg ); tmp = 1; }
     catch( Error & e ) { pp(); show_error( e.msg, errno ); tmp = 1; }
@@ -1118,7 +1518,14 @@ int main( const int argc, const char * const argv[] )
     show_error( "Error closing stdout", errno );
     set_retval( retval, 1 );
     }
-  if( failed_tests > 0 && verbosity >= 1 && filenames.size() > 1 )
+  if( digest_file && digest_file != stdout && digest_file != stderr &&
+      std::fclose( digest_file ) != 0 )
+    {
+    show_file_error( digest_filename, "Error closing digest file", errno );
+    set_retval( retval, 1 );
+    }
+  if( failed_tests > 0 && verbosity >= 1 && filenames.size() > 1 &&
+      job_index < 0 )
     std::fprintf( stderr, "%s: warning: %d %s failed the test.\n",
                   program_name, failed_tests,
                   ( failed_tests == 1 ) ? "file" : "files" );
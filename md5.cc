@@ -24,6 +24,7 @@
 #include <stdint.h>
 
 #include "md5.h"
+#include "simd.h"
 
 
 namespace {
@@ -50,16 +51,11 @@ namespace {
 #define II(a, b, c, d, x, s, ac) \
   { a += I(b, c, d) + x + ac; ROTATE_LEFT(a, s); a += b; }
 
-} // end namespace
-
-
-void MD5SUM::md5_process_block( const uint8_t block[64] )
+/* The 64 steps of MD5 on one block. T is uint32_t for one stream, or a
+   vector of uint32_t holding the same word of several streams. */
+template< typename T >
+inline void md5_rounds( T & a, T & b, T & c, T & d, const T x[16] )
   {
-  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], x[16];
-
-  for( int i = 0, j = 0; i < 16; ++i, j += 4 )	// fill x in little endian
-    x[i] = block[j] | (block[j+1] << 8) | (block[j+2] << 16) | (block[j+3] << 24);
-
   /* Round 1 */
   FF (a, b, c, d, x[ 0],  7, 0xD76AA478);	//  1
   FF (d, a, b, c, x[ 1], 12, 0xE8C7B756);	//  2
@@ -131,6 +127,19 @@ void MD5SUM::md5_process_block( const uint8_t block[64] )
   II (d, a, b, c, x[11], 10, 0xBD3AF235);	// 62
   II (c, d, a, b, x[ 2], 15, 0x2AD7D2BB);	// 63
   II (b, c, d, a, x[ 9], 21, 0xEB86D391);	// 64
+  }
+
+} // end namespace
+
+
+void MD5SUM::md5_process_block( const uint8_t block[64] )
+  {
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], x[16];
+
+  for( int i = 0, j = 0; i < 16; ++i, j += 4 )	// fill x in little endian
+    x[i] = block[j] | (block[j+1] << 8) | (block[j+2] << 16) | (block[j+3] << 24);
+
+  md5_rounds( a, b, c, d, x );
 
   // add the processed values to the context
   state[0] += a; state[1] += b; state[2] += c; state[3] += d;
@@ -188,6 +197,59 @@ void MD5SUM::md5_finish( md5_type & digest )
   }
 
 
+/* Process one block of each of the 4 contexts at once. */
+void MD5SUM::md5_process_block4( MD5SUM * const md5sums[4],
+                                 const uint8_t * const blocks[4] )
+  {
+#ifdef VECTOR16
+  v4u32 a, b, c, d, x[16];
+  for( int l = 0; l < 4; ++l )
+    {
+    a[l] = md5sums[l]->state[0]; b[l] = md5sums[l]->state[1];
+    c[l] = md5sums[l]->state[2]; d[l] = md5sums[l]->state[3];
+    const uint8_t * const block = blocks[l];
+    for( int i = 0, j = 0; i < 16; ++i, j += 4 )
+      x[i][l] = block[j] | (block[j+1] << 8) | (block[j+2] << 16) |
+                ((uint32_t)block[j+3] << 24);
+    }
+  const v4u32 a0 = a, b0 = b, c0 = c, d0 = d;
+  md5_rounds( a, b, c, d, x );
+  a += a0; b += b0; c += c0; d += d0;
+  for( int l = 0; l < 4; ++l )
+    { md5sums[l]->state[0] = a[l]; md5sums[l]->state[1] = b[l];
+      md5sums[l]->state[2] = c[l]; md5sums[l]->state[3] = d[l]; }
+#else
+  for( int l = 0; l < 4; ++l ) md5sums[l]->md5_process_block( blocks[l] );
+#endif
+  }
+
+
+/* Update 4 contexts with 'len' bytes of their respective buffers. The
+   result is the same as calling md5_update for each of them, but the full
+   blocks are processed 4 at a time if all the contexts are at a block
+   boundary.
+*/
+void MD5SUM::md5_update4( MD5SUM * const md5sums[4],
+                          const uint8_t * const buffers[4],
+                          const unsigned long len )
+  {
+  unsigned long i = 0;
+  if( ( ( md5sums[0]->count | md5sums[1]->count | md5sums[2]->count |
+          md5sums[3]->count ) & 0x3F ) == 0 )
+    {
+    for( ; i + 63 < len; i += 64 )
+      {
+      const uint8_t * const blocks[4] = { buffers[0] + i, buffers[1] + i,
+                                          buffers[2] + i, buffers[3] + i };
+      md5_process_block4( md5sums, blocks );
+      }
+    for( int l = 0; l < 4; ++l ) md5sums[l]->count += i;
+    }
+  for( int l = 0; l < 4; ++l )
+    if( len > i ) md5sums[l]->md5_update( buffers[l] + i, len - i );
+  }
+
+
 void compute_md5( const uint8_t * const buffer, const unsigned long len,
                   md5_type & digest )
   {
@@ -37,6 +37,8 @@ class MD5SUM
   uint8_t ibuf[64];		// input buffer with space for a block
 
   void md5_process_block( const uint8_t block[64] );
+  static void md5_process_block4( MD5SUM * const md5sums[4],
+                                  const uint8_t * const blocks[4] );
 
 public:
   MD5SUM() { reset(); }
@@ -52,6 +54,9 @@ public:
 
   void md5_update( const uint8_t * const buffer, const unsigned long len );
   void md5_finish( md5_type & digest );
+  static void md5_update4( MD5SUM * const md5sums[4],
+                           const uint8_t * const buffers[4],
+                           const unsigned long len );
   };
 
 void compute_md5( const uint8_t * const buffer, const unsigned long len,
@@ -26,12 +26,15 @@
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
 #include "lzip.h"
 #include "decoder.h"
 #include "lzip_index.h"
+#include "mtester.h"
+#include "threads.h"
 
 
 Block Block::split( const long long pos )
@@ -49,9 +52,15 @@ namespace {
 
 bool pending_newline = false;
 
+/* pending_newline is only set at verbosity level 2 or higher, when members
+   are merged one at a time. Don't write it otherwise, as the member workers
+   call this concurrently. */
 void print_pending_newline( const char terminator )
-  { if( pending_newline && terminator != '\n' ) std::fputc( '\n', stdout );
-    pending_newline = false; }
+  {
+  if( !pending_newline ) return;
+  if( terminator != '\n' ) std::fputc( '\n', stdout );
+  pending_newline = false;
+  }
 
 
 bool file_crc( uint32_t & crc, const int infd, const char * const filename )
@@ -117,8 +126,58 @@ void combine( std::vector< Block > & block_vector, std::vector< Block > & bv )
   }
 
 
-// positions in 'block_vector' are absolute file positions.
-// blocks in 'block_vector' are ascending and don't overlap.
+/* Differences between 2 copies of a member. A block of differences ends
+   at the first 2 consecutive equal bytes. */
+struct Pair_diff
+  {
+  std::vector< Block > bv;
+  long long begin;		// begin of block. -1 means no block
+  bool prev_equal;
+
+  Pair_diff() : begin( -1 ), prev_equal( true ) {}
+
+  void equal( const long long mpos, const long long pos )
+    {
+    if( !prev_equal ) prev_equal = true;
+    else if( begin >= 0 )				// end block
+      { bv.push_back( Block( mpos + begin, pos - 1 - begin ) ); begin = -1; }
+    }
+
+  void different( const long long pos )
+    { prev_equal = false; if( begin < 0 ) begin = pos; }	// begin block
+
+  void finish( const long long mpos, const long long pos )
+    { if( begin >= 0 )
+        bv.push_back( Block( mpos + begin, pos - prev_equal - begin ) ); }
+  };
+
+
+// Return the size of the span starting at i that is equal in all buffers.
+int equal_span( const std::vector< uint8_t * > & buffers, const int i,
+                const int size )
+  {
+  enum { chunk = 64 };
+  int j = i;
+  while( true )
+    {
+    const int len = std::min( (int)chunk, size - j );
+    if( len <= 0 ) break;
+    unsigned k = 1;
+    while( k < buffers.size() &&
+           std::memcmp( buffers[0] + j, buffers[k] + j, len ) == 0 ) ++k;
+    if( k < buffers.size() ) break;
+    j += len;
+    }
+  return j - i;
+  }
+
+
+/* Compare all the copies of the member in a single pass. Spans that are
+   equal in all the files are skipped with memcmp, and the pairs of files
+   are compared byte by byte only where some copy differs. The files are
+   read with pread, so that several members can be compared at once.
+   positions in 'block_vector' are absolute file positions.
+   blocks in 'block_vector' are ascending and don't overlap. */
 bool diff_member( const long long mpos, const long long msize,
                   const std::vector< std::string > & filenames,
                   const std::vector< int > & infd_vector,
@@ -126,64 +185,53 @@ bool diff_member( const long long mpos, const long long msize,
                   std::vector< int > & color_vector )
   {
   const int files = infd_vector.size();
-  const int buffer_size = 65536;
-  uint8_t * const buffer1 = new uint8_t[buffer_size];
-  uint8_t * const buffer2 = new uint8_t[buffer_size];
-  int next_color = 1;
+  const int buffer_size = 1 << 20;
+  std::vector< uint8_t * > buffers( files );
+  std::vector< Pair_diff > pair_diffs( files * ( files - 1 ) / 2 );
+  for( int i = 0; i < files; ++i ) buffers[i] = new uint8_t[buffer_size];
+  long long partial_pos = 0;
 
   bool error = false;
-  for( int i1 = 0; i1 < files && !error; ++i1 )
+  while( partial_pos < msize )
     {
-    for( int i2 = i1 + 1; i2 < files && !error; ++i2 )
+    const int size = std::min( (long long)buffer_size, msize - partial_pos );
+    for( int i = 0; i < files; ++i )
+      if( preadblock( infd_vector[i], buffers[i], size,
+                      mpos + partial_pos ) != size )
+        { show_file_error( filenames[i].c_str(), "Error reading input file",
+                           errno ); error = true; break; }
+    if( error ) break;
+    for( int i = 0; i < size; )
       {
-      if( color_vector[i1] != 0 && color_vector[i1] == color_vector[i2] )
-        continue;
-      std::vector< Block > bv;
-      long long partial_pos = 0;
-      const char * const filename1 = filenames[i1].c_str();
-      const char * const filename2 = filenames[i2].c_str();
-      const int fd1 = infd_vector[i1], fd2 = infd_vector[i2];
-      int begin = -1;			// begin of block. -1 means no block
-      bool prev_equal = true;
-      if( !safe_seek( fd1, mpos, filename1 ) ||
-          !safe_seek( fd2, mpos, filename2 ) ) { error = true; break; }
-
-      while( partial_pos < msize )
-        {
-        const int size = std::min( (long long)buffer_size, msize - partial_pos );
-        const int rd = readblock( fd1, buffer1, size );
-        if( rd != size && errno )
-          { show_file_error( filename1, "Error reading input file", errno );
-            error = true; break; }
-        if( rd > 0 )
-          {
-          if( readblock( fd2, buffer2, rd ) != rd )
-            { show_file_error( filename2, "Error reading input file", errno );
-              error = true; break; }
-          for( int i = 0; i < rd; ++i )
-            {
-            if( buffer1[i] != buffer2[i] )
-              {
-              prev_equal = false;
-              if( begin < 0 ) begin = partial_pos + i;	// begin block
-              }
-            else if( !prev_equal ) prev_equal = true;
-            else if( begin >= 0 )			// end block
-              {
-              Block b( mpos + begin, partial_pos + i - 1 - begin );
-              begin = -1;
-              bv.push_back( b );
-              }
-            }
-          partial_pos += rd;
-          }
-        if( rd < buffer_size ) break;			// EOF
-        }
-      if( begin >= 0 )					// finish last block
+      const long long pos = partial_pos + i;
+      const int span = equal_span( buffers, i, size );
+      if( span >= 2 )		// all pairs are equal. Skip span.
         {
-        Block b( mpos + begin, partial_pos - prev_equal - begin );
-        bv.push_back( b );
+        for( unsigned k = 0; k < pair_diffs.size(); ++k )
+          { pair_diffs[k].equal( mpos, pos );
+            pair_diffs[k].equal( mpos, pos + 1 ); }
+        i += span; continue;
         }
+      for( int i1 = 0, k = 0; i1 < files; ++i1 )
+        for( int i2 = i1 + 1; i2 < files; ++i2, ++k )
+          if( buffers[i1][i] != buffers[i2][i] ) pair_diffs[k].different( pos );
+          else pair_diffs[k].equal( mpos, pos );
+      ++i;
+      }
+    partial_pos += size;
+    }
+  for( int i = 0; i < files; ++i ) delete[] buffers[i];
+  if( error ) return false;
+
+  int next_color = 1;
+  for( int i1 = 0, k = 0; i1 < files; ++i1 )
+    {
+    for( int i2 = i1 + 1; i2 < files; ++i2, ++k )
+      {
+      if( color_vector[i1] != 0 && color_vector[i1] == color_vector[i2] )
+        continue;
+      std::vector< Block > & bv = pair_diffs[k].bv;
+      pair_diffs[k].finish( mpos, partial_pos );
       if( bv.empty() )		// members are identical, set to same color
         {
         if( color_vector[i1] == 0 )
@@ -198,8 +246,7 @@ bool diff_member( const long long mpos, const long long msize,
       }
     if( color_vector[i1] == 0 ) color_vector[i1] = next_color++;
     }
-  delete[] buffer2; delete[] buffer1;
-  return !error;
+  return true;
   }
 
 
@@ -348,13 +395,337 @@ bool color_done( const std::vector< int > & color_vector, const int i )
   }
 
 
+/* Copies in memory of the member being merged, one per input file.
+   Variations are assembled and tested in memory. Only the variation that
+   passes the test is written to the output file. */
+class Member_copies
+  {
+  std::vector< uint8_t * > buffers;
+
+  Member_copies( const Member_copies & );	// declared as private
+  void operator=( const Member_copies & );	// declared as private
+
+public:
+  const long long mpos;
+  const long long msize;
+
+  Member_copies( const long long mpos_, const long long msize_ )
+    : mpos( mpos_ ), msize( msize_ ) {}
+  ~Member_copies()
+    { for( unsigned i = 0; i < buffers.size(); ++i ) delete[] buffers[i]; }
+
+  bool read( const std::vector< std::string > & filenames,
+             const std::vector< int > & infd_vector )
+    {
+    for( unsigned i = 0; i < infd_vector.size(); ++i )
+      {
+      uint8_t * const buffer = new uint8_t[msize];
+      buffers.push_back( buffer );
+      if( preadblock( infd_vector[i], buffer, msize, mpos ) != msize )
+        { show_file_error( filenames[i].c_str(), "Error reading input file",
+                           errno ); return false; }
+      }
+    return true;
+    }
+
+  const uint8_t * buffer( const int i ) const { return buffers[i]; }
+
+  void copy_block( uint8_t * const vbuffer, const int i, const Block & b ) const
+    { const long j = b.pos() - mpos;
+      std::memcpy( vbuffer + j, buffers[i] + j, b.size() ); }
+
+  void copy_byte( uint8_t * const vbuffer, const int i,
+                  const long long pos ) const
+    { vbuffer[pos-mpos] = buffers[i][pos-mpos]; }
+  };
+
+
+/* Test the variation of the member in vbuffer.
+   'failure_pos' is relative to the beginning of the member. */
+bool test_variation( const uint8_t * const vbuffer, const long msize,
+                     long long * const failure_posp = 0 )
+  {
+  const Lzip_header & header = *(const Lzip_header *)vbuffer;
+  const unsigned dictionary_size = header.dictionary_size();
+  if( !header.check_magic() || !header.check_version() ||
+      !isvalid_ds( dictionary_size ) )
+    { if( failure_posp ) *failure_posp = Lzip_header::size; return false; }
+  LZ_mtester mtester( vbuffer, msize, dictionary_size );
+  if( mtester.test_member() == 0 && mtester.finished() ) return true;
+  if( failure_posp ) *failure_posp = mtester.member_position();
+  return false;
+  }
+
+
+bool write_variation( const Member_copies & mc, const uint8_t * const vbuffer )
+  {
+  if( pwriteblock( outfd, vbuffer, mc.msize, mc.mpos ) == mc.msize ) return true;
+  show_file_error( output_filename.c_str(), "Error writing output file", errno );
+  return false;
+  }
+
+
+struct Merge_arg;
+typedef bool (*Try_pair)( Merge_arg & ma, uint8_t * const vbuffer,
+                          const int pair );
+
+struct Merge_arg		// state shared by the merge workers
+  {
+  const Member_copies * mc;
+  const std::vector< Block > * block_vector;
+  std::vector< int > pair_i1;	// file to read the first blocks from
+  std::vector< int > pair_i2;	// file to read the rest of blocks from
+  Try_pair try_pair;
+  int files;
+  Work_queue * queue;		// pairs to be tried (ascending)
+  int found_pair;		// lowest pair merged, or INT_MAX
+  const uint8_t * found_buffer;	// variation of the member found
+  char terminator;
+  pthread_mutex_t mutex;
+
+  // variation number shown to the user
+  int var( const int pair ) const
+    { const int i1 = pair_i1[pair], i2 = pair_i2[pair];
+      return ( i1 * ( files - 1 ) ) + i2 - ( i2 > i1 ) + 1; }
+
+  // a lower pair has already been merged
+  bool abandoned( const int pair )
+    { xlock( &mutex ); const bool ab = ( pair > found_pair );
+      xunlock( &mutex ); return ab; }
+  };
+
+struct Merge_worker
+  {
+  Merge_arg * ma;
+  uint8_t * vbuffer;		// private variation of the member
+  };
+
+
+/* Try the pairs of files in ascending order, as the serial loop does.
+   When a pair is merged, no more pairs are handed out, and the higher pairs
+   being tried are abandoned, so the result is the same as that of the
+   serial search. */
+extern "C" void * mworker( void * arg )
+  {
+  const Merge_worker & mw = *(const Merge_worker *)arg;
+  Merge_arg & ma = *mw.ma;
+  unsigned long pair;
+
+  while( ma.queue->next( pair ) )
+    if( ma.try_pair( ma, mw.vbuffer, pair ) )
+      {
+      xlock( &ma.mutex );
+      if( (int)pair < ma.found_pair )
+        { ma.found_pair = pair; ma.found_buffer = mw.vbuffer; }
+      xunlock( &ma.mutex );
+      ma.queue->stop();
+      break;			// keep the variation in vbuffer
+      }
+  return 0;
+  }
+
+
+/* Return how many workers, up to num_workers, fit in memory along with the
+   copies of a member of size msize read from the files. Each worker needs
+   its own variation of the member and the dictionary of its tester.
+   Return 0 if not even one worker fits. */
+int merge_workers( const long long msize, const unsigned dictionary_size,
+                   const int files, const int num_workers )
+  {
+  if( msize <= 0 || msize > LONG_MAX ) return 0;
+  const unsigned long long budget = memory_budget();
+  const unsigned long long copies = files * (unsigned long long)msize;
+  const unsigned long long worker_size = msize + dictionary_size;
+  if( copies + worker_size > budget ) return 0;
+  return std::min( (unsigned long long)num_workers,
+                   ( budget - copies ) / worker_size );
+  }
+
+
+/* Try 'try_pair' on every pair of files of different colors, sharing the
+   pairs among 'workers' threads. Copy the first variation found to vbuffer. */
+bool try_merge_pairs( const Member_copies & mc, uint8_t * const vbuffer,
+                      const std::vector< Block > & block_vector,
+                      const std::vector< int > & color_vector,
+                      const Try_pair try_pair, const char terminator,
+                      const int num_workers )
+  {
+  const int files = color_vector.size();
+  Merge_arg ma;
+  for( int i1 = 0; i1 < files; ++i1 )
+    for( int i2 = 0; i2 < files; ++i2 )
+      if( i1 != i2 && color_vector[i1] != color_vector[i2] &&
+          !color_done( color_vector, i1 ) )
+        { ma.pair_i1.push_back( i1 ); ma.pair_i2.push_back( i2 ); }
+  if( ma.pair_i1.empty() ) return false;
+  ma.mc = &mc;
+  ma.block_vector = &block_vector;
+  ma.try_pair = try_pair;
+  ma.files = files;
+  Work_queue queue( ma.pair_i1.size() );
+  ma.queue = &queue;
+  ma.found_pair = INT_MAX;
+  ma.found_buffer = 0;
+  ma.terminator = terminator;
+  xinit_mutex( &ma.mutex );
+
+  const Lzip_header & header = *(const Lzip_header *)mc.buffer( 0 );
+  const int workers = std::max( 1, merge_workers( mc.msize,
+    header.dictionary_size(), files,
+    std::min( num_workers, (int)ma.pair_i1.size() ) ) );
+  std::vector< Merge_worker > worker_args( workers );
+  for( int i = 0; i < workers; ++i )
+    {
+    worker_args[i].ma = &ma;
+    worker_args[i].vbuffer = ( i == 0 ) ? vbuffer : new uint8_t[mc.msize];
+    std::memcpy( worker_args[i].vbuffer, mc.buffer( 0 ), mc.msize );
+    }
+  if( workers <= 1 ) mworker( &worker_args[0] );
+  else run_workers( mworker, &worker_args[0], workers, false );
+  const bool done = ma.found_buffer;
+  if( done && ma.found_buffer != vbuffer )
+    std::memcpy( vbuffer, ma.found_buffer, mc.msize );
+  for( int i = 1; i < workers; ++i ) delete[] worker_args[i].vbuffer;
+  xdestroy_mutex( &ma.mutex );
+  return done;
+  }
+
+
+void show_variation( Merge_arg & ma, const int pair, const char * const what,
+                     const long long value )
+  {
+  xlock( &ma.mutex );
+  std::printf( "  Trying variation %d of %d, %s %lld        %c", ma.var( pair ),
+               ma.files * ( ma.files - 1 ), what, value, ma.terminator );
+  std::fflush( stdout ); pending_newline = true;
+  xunlock( &ma.mutex );
+  }
+
+
 // try dividing blocks in 2 color groups at every gap
-bool try_merge_member2( const std::vector< std::string > & filenames,
-                        const long long mpos, const long long msize,
+bool try_pair2( Merge_arg & ma, uint8_t * const vbuffer, const int pair )
+  {
+  const Member_copies & mc = *ma.mc;
+  const std::vector< Block > & block_vector = *ma.block_vector;
+  const int blocks = block_vector.size();
+  const int i1 = ma.pair_i1[pair], i2 = ma.pair_i2[pair];
+
+  for( int bi = 0; bi < blocks; ++bi )
+    mc.copy_block( vbuffer, i2, block_vector[bi] );
+  for( int bi = 0; bi + 1 < blocks; ++bi )
+    {
+    if( ma.abandoned( pair ) ) break;
+    if( verbosity >= 2 ) show_variation( ma, pair, "block", bi + 1 );
+    mc.copy_block( vbuffer, i1, block_vector[bi] );
+    long long failure_pos = 0;
+    if( test_variation( vbuffer, mc.msize, &failure_pos ) ) return true;
+    if( mc.mpos + failure_pos < block_vector[bi].end() ) break;
+    }
+  return false;
+  }
+
+
+// merge a single block split at every possible position
+bool try_pair1( Merge_arg & ma, uint8_t * const vbuffer, const int pair )
+  {
+  const Member_copies & mc = *ma.mc;
+  const Block & block = (*ma.block_vector)[0];
+  const long long pos = block.pos();
+  const int i1 = ma.pair_i1[pair], i2 = ma.pair_i2[pair];
+
+  mc.copy_block( vbuffer, i2, block );
+  for( long long i = 0; i + 1 < block.size(); ++i )
+    {
+    if( ma.abandoned( pair ) ) break;
+    if( verbosity >= 2 ) show_variation( ma, pair, "position", pos + i );
+    mc.copy_byte( vbuffer, i1, pos + i );
+    long long failure_pos = 0;
+    if( test_variation( vbuffer, mc.msize, &failure_pos ) ) return true;
+    if( mc.mpos + failure_pos <= pos + i ) break;
+    }
+  return false;
+  }
+
+
+// try dividing blocks in 2 color groups at every gap
+bool try_merge_member2( const Member_copies & mc, uint8_t * const vbuffer,
+                        const std::vector< Block > & block_vector,
+                        const std::vector< int > & color_vector,
+                        const char terminator, const int num_workers )
+  {
+  return try_merge_pairs( mc, vbuffer, block_vector, color_vector, try_pair2,
+                          terminator, num_workers );
+  }
+
+
+/* Merge block by block.
+   Return value: -1 = too many damaged blocks, 0 = not done, 1 = done */
+int try_merge_member( const Member_copies & mc, uint8_t * const vbuffer,
+                      const std::vector< Block > & block_vector,
+                      const std::vector< int > & color_vector,
+                      const char terminator )
+  {
+  const int blocks = block_vector.size();
+  const int files = color_vector.size();
+  const long variations = ipow( files, blocks );
+  if( variations >= LONG_MAX ) return -1;
+  int bi = 0;					// block index
+  std::vector< int > file_idx( blocks, 0 );	// file to read each block from
+  std::memcpy( vbuffer, mc.buffer( 0 ), mc.msize );
+  bool done = false;
+
+  while( bi >= 0 )
+    {
+    if( verbosity >= 2 )
+      {
+      long var = 0;
+      for( int i = 0; i < blocks; ++i )
+        var = ( var * files ) + file_idx[i];
+      std::printf( "  Trying variation %ld of %ld %c",
+                   var + 1, variations, terminator );
+      std::fflush( stdout ); pending_newline = true;
+      }
+    for( ; bi < blocks; ++bi )
+      mc.copy_block( vbuffer, file_idx[bi], block_vector[bi] );
+    long long failure_pos = 0;
+    if( test_variation( vbuffer, mc.msize, &failure_pos ) )
+      { done = true; break; }
+    while( bi > 0 && mc.mpos + failure_pos < block_vector[bi-1].pos() ) --bi;
+    while( --bi >= 0 )
+      {
+      while( ++file_idx[bi] < files &&
+             color_done( color_vector, file_idx[bi] ) );
+      if( file_idx[bi] < files ) break;
+      file_idx[bi] = 0;
+      }
+    }
+  return done;
+  }
+
+
+// merge a single block split at every possible position
+bool try_merge_member1( const Member_copies & mc, uint8_t * const vbuffer,
                         const std::vector< Block > & block_vector,
                         const std::vector< int > & color_vector,
-                        const std::vector< int > & infd_vector,
-                        const char terminator )
+                        const char terminator, const int num_workers )
+  {
+  if( block_vector.size() != 1 || block_vector[0].size() <= 1 ) return false;
+  return try_merge_pairs( mc, vbuffer, block_vector, color_vector, try_pair1,
+                          terminator, num_workers );
+  }
+
+
+/* The functions below merge the member in the output file, which is a copy
+   of the first input file, reading the blocks from the input files. They
+   are used if the copies of the member don't fit in memory. */
+
+// try dividing blocks in 2 color groups at every gap
+bool try_merge_file2( const std::vector< std::string > & filenames,
+                      const long long mpos, const long long msize,
+                      const std::vector< Block > & block_vector,
+                      const std::vector< int > & color_vector,
+                      const std::vector< int > & infd_vector,
+                      const char terminator )
   {
   const int blocks = block_vector.size();
   const int files = infd_vector.size();
@@ -395,25 +766,19 @@ bool try_merge_member2( const std::vector< std::string > & filenames,
   }
 
 
-// merge block by block
-bool try_merge_member( const std::vector< std::string > & filenames,
-                       const long long mpos, const long long msize,
-                       const std::vector< Block > & block_vector,
-                       const std::vector< int > & color_vector,
-                       const std::vector< int > & infd_vector,
-                       const char terminator )
+/* Merge block by block.
+   Return value: -1 = too many damaged blocks, 0 = not done, 1 = done */
+int try_merge_file( const std::vector< std::string > & filenames,
+                    const long long mpos, const long long msize,
+                    const std::vector< Block > & block_vector,
+                    const std::vector< int > & color_vector,
+                    const std::vector< int > & infd_vector,
+                    const char terminator )
   {
   const int blocks = block_vector.size();
   const int files = infd_vector.size();
   const long variations = ipow( files, blocks );
-  if( variations >= LONG_MAX )
-    {
-    if( files > 2 )
-      show_error( "Too many damaged blocks. Try merging fewer files." );
-    else
-      show_error( "Too many damaged blocks. Merging is not possible." );
-    cleanup_and_fail( 2 );
-    }
+  if( variations >= LONG_MAX ) return -1;
   int bi = 0;					// block index
   std::vector< int > file_idx( blocks, 0 );	// file to read each block from
 
@@ -455,12 +820,12 @@ bool try_merge_member( const std::vector< std::string > & filenames,
 
 
 // merge a single block split at every possible position
-bool try_merge_member1( const std::vector< std::string > & filenames,
-                        const long long mpos, const long long msize,
-                        const std::vector< Block > & block_vector,
-                        const std::vector< int > & color_vector,
-                        const std::vector< int > & infd_vector,
-                        const char terminator )
+bool try_merge_file1( const std::vector< std::string > & filenames,
+                      const long long mpos, const long long msize,
+                      const std::vector< Block > & block_vector,
+                      const std::vector< int > & color_vector,
+                      const std::vector< int > & infd_vector,
+                      const char terminator )
   {
   if( block_vector.size() != 1 || block_vector[0].size() <= 1 ) return false;
   const long long pos = block_vector[0].pos();
@@ -503,6 +868,278 @@ bool try_merge_member1( const std::vector< std::string > & filenames,
   return false;
   }
 
+
+// Return true if the copies of a member of size msize fit in memory.
+bool member_fits_in_memory( const long long msize,
+                            const unsigned dictionary_size, const int files )
+  { return merge_workers( msize, dictionary_size, files, 1 ) > 0; }
+
+
+// Like merge_member below, but reading the blocks from the files.
+int merge_member_from_files( const std::vector< std::string > & filenames,
+                             const std::vector< int > & infd_vector,
+                             const Lzip_index & lzip_index, const long j,
+                             std::vector< Block > & block_vector,
+                             const std::vector< int > & color_vector,
+                             const char terminator )
+  {
+  const long long mpos = lzip_index.mblock( j ).pos();
+  const long long msize = lzip_index.mblock( j ).size();
+  if( !safe_seek( outfd, mpos, output_filename.c_str() ) ) return 1;
+  if( block_vector.empty() )
+    {
+    if( lzip_index.members() > 1 && test_member_from_file( outfd, msize ) == 0 )
+      return 0;
+    return 2;
+    }
+
+  if( verbosity >= 2 )
+    {
+    std::printf( "Merging member %ld of %ld  (%lu error%s)\n",
+                 j + 1, lzip_index.members(), (long)block_vector.size(),
+                 ( block_vector.size() == 1 ) ? "" : "s" );
+    std::fflush( stdout );
+    }
+
+  int done = 0;
+  if( block_vector.size() > 1 )
+    {
+    maybe_cluster_blocks( block_vector );
+    done = try_merge_file2( filenames, mpos, msize, block_vector,
+                            color_vector, infd_vector, terminator );
+    print_pending_newline( terminator );
+    }
+  // With just one member and one differing block the merge can't succeed.
+  if( !done && ( lzip_index.members() > 1 || block_vector.size() > 1 ) )
+    {
+    done = try_merge_file( filenames, mpos, msize, block_vector,
+                           color_vector, infd_vector, terminator );
+    print_pending_newline( terminator );
+    }
+  if( !done )
+    {
+    done = try_merge_file1( filenames, mpos, msize, block_vector,
+                            color_vector, infd_vector, terminator );
+    print_pending_newline( terminator );
+    }
+  if( done < 0 ) return 3;
+  if( !done )
+    {
+    if( verbosity >= 3 )
+      for( unsigned i = 0; i < block_vector.size(); ++i )
+        std::fprintf( stderr, "area %2d from position %6lld to %6lld\n", i + 1,
+                      block_vector[i].pos(), block_vector[i].end() - 1 );
+    return 4;
+    }
+  return 0;
+  }
+
+
+/* Merge member j of the input files and write it to the output file.
+   Return value: 0 = merged or not damaged, 1 = I/O error (already shown),
+   2 = damaged and identical in all files, 3 = too many damaged blocks,
+   4 = error areas overlap. */
+int merge_member( const std::vector< std::string > & filenames,
+                  const std::vector< int > & infd_vector,
+                  const Lzip_index & lzip_index, const long j,
+                  const char terminator, const int num_workers )
+  {
+  const int files = filenames.size();
+  const long long mpos = lzip_index.mblock( j ).pos();
+  const long long msize = lzip_index.mblock( j ).size();
+  // vector of data blocks differing among the copies of the current member
+  std::vector< Block > block_vector;
+  // different color means members are different
+  std::vector< int > color_vector( files, 0 );
+  if( !diff_member( mpos, msize, filenames, infd_vector, block_vector,
+                    color_vector ) ) return 1;
+  if( !member_fits_in_memory( msize, lzip_index.dictionary_size( j ),
+                              files ) )
+    return merge_member_from_files( filenames, infd_vector, lzip_index, j,
+                                    block_vector, color_vector, terminator );
+
+  Member_copies mc( mpos, msize );
+  if( !mc.read( filenames, infd_vector ) ) return 1;
+  if( block_vector.empty() )
+    {
+    if( lzip_index.members() > 1 && test_variation( mc.buffer( 0 ), msize ) )
+      return 0;
+    return 2;
+    }
+
+  if( verbosity >= 2 )
+    {
+    std::printf( "Merging member %ld of %ld  (%lu error%s)\n",
+                 j + 1, lzip_index.members(), (long)block_vector.size(),
+                 ( block_vector.size() == 1 ) ? "" : "s" );
+    std::fflush( stdout );
+    }
+
+  uint8_t * const vbuffer = new uint8_t[msize];
+  int done = 0;
+  if( block_vector.size() > 1 )
+    {
+    maybe_cluster_blocks( block_vector );
+    done = try_merge_member2( mc, vbuffer, block_vector, color_vector,
+                              terminator, num_workers );
+    print_pending_newline( terminator );
+    }
+  // With just one member and one differing block the merge can't succeed.
+  if( !done && ( lzip_index.members() > 1 || block_vector.size() > 1 ) )
+    {
+    done = try_merge_member( mc, vbuffer, block_vector, color_vector,
+                             terminator );
+    print_pending_newline( terminator );
+    }
+  if( !done )
+    {
+    done = try_merge_member1( mc, vbuffer, block_vector, color_vector,
+                              terminator, num_workers );
+    print_pending_newline( terminator );
+    }
+  int retval = 0;
+  if( done < 0 ) retval = 3;
+  else if( !done )
+    {
+    if( verbosity >= 3 )
+      for( unsigned i = 0; i < block_vector.size(); ++i )
+        std::fprintf( stderr, "area %2d from position %6lld to %6lld\n", i + 1,
+                      block_vector[i].pos(), block_vector[i].end() - 1 );
+    retval = 4;
+    }
+  else if( !write_variation( mc, vbuffer ) ) retval = 1;
+  delete[] vbuffer;
+  return retval;
+  }
+
+
+// Show the error returned by merge_member for member j, and exit.
+void merge_error( const int status, const long j, const int files )
+  {
+  if( status == 2 && verbosity >= 0 )
+    std::fprintf( stderr, "Member %ld is damaged and identical in all files."
+                          " Merging is not possible.\n", j + 1 );
+  if( status == 3 )
+    {
+    if( files > 2 )
+      show_error( "Too many damaged blocks. Try merging fewer files." );
+    else
+      show_error( "Too many damaged blocks. Merging is not possible." );
+    }
+  if( status == 4 )
+    show_error( "Some error areas overlap. Merging is not possible." );
+  cleanup_and_fail( ( status == 1 ) ? 1 : 2 );
+  }
+
+
+struct Member_arg		// state shared by the member workers
+  {
+  const std::vector< std::string > * filenames;
+  const std::vector< int > * infd_vector;
+  const Lzip_index * lzip_index;
+  Work_queue * queue;		// members to be merged (ascending)
+  long failed;			// lowest member that failed, or LONG_MAX
+  int status;			// value returned by merge_member for 'failed'
+  pthread_mutex_t mutex;	// protects failed and status
+  };
+
+
+/* Merge members in ascending order. When a member fails, no more members
+   are handed out; only the lower members already started are finished, so
+   the member reported is the same that the serial loop would report. */
+extern "C" void * jworker( void * arg )
+  {
+  Member_arg & ma = *(Member_arg *)arg;
+  unsigned long j;
+
+  while( ma.queue->next( j ) )
+    {
+    const int status = merge_member( *ma.filenames, *ma.infd_vector,
+                                     *ma.lzip_index, j, '\n', 1 );
+    if( status != 0 )
+      {
+      xlock( &ma.mutex );
+      if( (long)j < ma.failed ) { ma.failed = j; ma.status = status; }
+      xunlock( &ma.mutex );
+      ma.queue->stop();
+      }
+    }
+  return 0;
+  }
+
+
+/* Merge several members at once, each one in its own thread, so that the
+   total time is about that of the slowest member instead of the sum.
+   Return false if the memory budget is not enough for more than one worker,
+   and the members are then merged serially. */
+bool merge_members_mt( const std::vector< std::string > & filenames,
+                       const std::vector< int > & infd_vector,
+                       const Lzip_index & lzip_index, const int num_workers )
+  {
+  long long max_msize = 0;
+  for( long j = 0; j < lzip_index.members(); ++j )
+    max_msize = std::max( max_msize, lzip_index.mblock( j ).size() );
+  // the members merged from the files share the file offsets
+  if( !member_fits_in_memory( max_msize, lzip_index.dictionary_size(),
+                              filenames.size() ) ) return false;
+  // without --memory-limit, keep the copies of all the workers in the budget
+  const unsigned long long worker_size = lzip_index.dictionary_size() +
+    ( filenames.size() + 1 ) * (unsigned long long)max_msize;
+  const int workers = std::min( (unsigned long long)std::min( (long)num_workers,
+    lzip_index.members() ), memory_budget() / worker_size );
+  if( workers <= 1 ) return false;
+  Work_queue queue( lzip_index.members() );
+  Member_arg ma;
+  ma.filenames = &filenames;
+  ma.infd_vector = &infd_vector;
+  ma.lzip_index = &lzip_index;
+  ma.queue = &queue;
+  ma.failed = LONG_MAX;
+  ma.status = 0;
+  xinit_mutex( &ma.mutex );
+  run_workers( jworker, &ma, workers );
+  xdestroy_mutex( &ma.mutex );
+  if( ma.failed < LONG_MAX )
+    merge_error( ma.status, ma.failed, filenames.size() );
+  return true;
+  }
+
+#if defined __linux__ && defined __GLIBC__ && \
+    ( __GLIBC__ > 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ >= 27 ) )
+#define KERNEL_COPY
+#endif
+
+#ifdef KERNEL_COPY
+/* Copy up to max_size bytes (no limit if max_size < 0) inside the kernel,
+   with copy_file_range (which may share the blocks instead of copying them)
+   to a regular file, or with splice to a pipe. Return the number of bytes
+   copied. Stop at the first error or at EOF, and leave the rest of the copy
+   (and the reporting of errors) to the loop of copy_file. */
+long long kernel_copy( const int infd, const int outfd,
+                       const long long max_size )
+  {
+  struct stat st;
+  if( fstat( outfd, &st ) != 0 ) return 0;
+  const bool to_pipe = S_ISFIFO( st.st_mode );
+  if( !to_pipe && !S_ISREG( st.st_mode ) ) return 0;
+  const long long chunk_size = 1 << 30;
+  long long copied_size = 0;
+  while( max_size < 0 || copied_size < max_size )
+    {
+    const size_t size = ( max_size < 0 ) ? chunk_size :
+                        std::min( chunk_size, max_size - copied_size );
+    const ssize_t n = to_pipe ?
+      splice( infd, 0, outfd, 0, size, SPLICE_F_MOVE ) :
+      copy_file_range( infd, 0, outfd, 0, size, 0 );
+    if( n > 0 ) copied_size += n;
+    else if( n < 0 && errno == EINTR ) continue;
+    else break;
+    }
+  errno = 0;
+  return copied_size;
+  }
+#endif
+
 } // end namespace
 
 
@@ -512,9 +1149,13 @@ bool try_merge_member1( const std::vector< std::string > & filenames,
 bool copy_file( const int infd, const int outfd, const long long max_size )
   {
   const int buffer_size = 65536;
-  // remaining number of bytes to copy
-  long long rest = ( ( max_size >= 0 ) ? max_size : buffer_size );
+#ifdef KERNEL_COPY
+  long long copied_size = kernel_copy( infd, outfd, max_size );
+#else
   long long copied_size = 0;
+#endif
+  // remaining number of bytes to copy
+  long long rest = ( ( max_size >= 0 ) ? max_size - copied_size : buffer_size );
   uint8_t * const buffer = new uint8_t[buffer_size];
   bool error = false;
 
@@ -536,6 +1177,7 @@ bool copy_file( const int infd, const int outfd, const long long max_size )
     if( rd < size ) break;				// EOF
     }
   delete[] buffer;
+  stat_add( st_copy_file_bytes, copied_size );
   if( !error && max_size >= 0 && copied_size != max_size )
     { show_error( "Input file ends unexpectedly." ); error = true; }
   return !error;
@@ -570,7 +1212,7 @@ int test_member_from_file( const int infd, const unsigned long long msize,
 int merge_files( const std::vector< std::string > & filenames,
                  const std::string & default_output_filename,
                  const Cl_options & cl_opts, const char terminator,
-                 const bool force )
+                 const bool force, const int num_workers )
   {
   const int files = filenames.size();
   std::vector< int > infd_vector( files );
@@ -589,67 +1231,16 @@ int merge_files( const std::vector< std::string > & filenames,
   if( !copy_file( infd_vector[0], outfd ) )		// copy whole file
     cleanup_and_fail( 1 );
 
-  for( long j = 0; j < lzip_index.members(); ++j )
-    {
-    const long long mpos = lzip_index.mblock( j ).pos();
-    const long long msize = lzip_index.mblock( j ).size();
-    // vector of data blocks differing among the copies of the current member
-    std::vector< Block > block_vector;
-    // different color means members are different
-    std::vector< int > color_vector( files, 0 );
-    if( !diff_member( mpos, msize, filenames, infd_vector, block_vector,
-        color_vector ) || !safe_seek( outfd, mpos, output_filename.c_str() ) )
-      cleanup_and_fail( 1 );
-
-    if( block_vector.empty() )
-      {
-      if( lzip_index.members() > 1 && test_member_from_file( outfd, msize ) == 0 )
-        continue;
-      if( verbosity >= 0 )
-        std::fprintf( stderr, "Member %ld is damaged and identical in all files."
-                              " Merging is not possible.\n", j + 1 );
-      cleanup_and_fail( 2 );
-      }
-
-    if( verbosity >= 2 )
-      {
-      std::printf( "Merging member %ld of %ld  (%lu error%s)\n",
-                   j + 1, lzip_index.members(), (long)block_vector.size(),
-                   ( block_vector.size() == 1 ) ? "" : "s" );
-      std::fflush( stdout );
-      }
-
-    bool done = false;
-    if( block_vector.size() > 1 )
-      {
-      maybe_cluster_blocks( block_vector );
-      done = try_merge_member2( filenames, mpos, msize, block_vector,
-                                color_vector, infd_vector, terminator );
-      print_pending_newline( terminator );
-      }
-    // With just one member and one differing block the merge can't succeed.
-    if( !done && ( lzip_index.members() > 1 || block_vector.size() > 1 ) )
-      {
-      done = try_merge_member( filenames, mpos, msize, block_vector,
-                               color_vector, infd_vector, terminator );
-      print_pending_newline( terminator );
-      }
-    if( !done )
-      {
-      done = try_merge_member1( filenames, mpos, msize, block_vector,
-                                color_vector, infd_vector, terminator );
-      print_pending_newline( terminator );
-      }
-    if( !done )
+  /* The progress of 'Trying variation' shown with -vv can't be shown for
+     several members at once. */
+  if( num_workers <= 1 || lzip_index.members() <= 1 || verbosity >= 2 ||
+      !merge_members_mt( filenames, infd_vector, lzip_index, num_workers ) )
+    for( long j = 0; j < lzip_index.members(); ++j )
       {
-      if( verbosity >= 3 )
-        for( unsigned i = 0; i < block_vector.size(); ++i )
-          std::fprintf( stderr, "area %2d from position %6lld to %6lld\n", i + 1,
-                        block_vector[i].pos(), block_vector[i].end() - 1 );
-      show_error( "Some error areas overlap. Merging is not possible." );
-      cleanup_and_fail( 2 );
+      const int status = merge_member( filenames, infd_vector, lzip_index, j,
+                                       terminator, num_workers );
+      if( status != 0 ) merge_error( status, j, files );
       }
-    }
 
   if( !close_outstream( &in_stats ) ) return 1;
   if( verbosity >= 1 )
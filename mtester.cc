@@ -66,15 +66,56 @@ void LZ_mtester::print_block( const int len )
 
 void LZ_mtester::duplicate_buffer( uint8_t * const buffer2 )
   {
+  stat_add( st_buffer_copies );
   if( data_position() > 0 )
-    std::memcpy( buffer2, buffer, std::min( data_position(),
-                                    (unsigned long long)dictionary_size ) );
+    {
+    const unsigned long long size =
+      std::min( data_position(), (unsigned long long)dictionary_size );
+    std::memcpy( buffer2, buffer, size );
+    stat_add( st_buffer_copy_bytes, size );
+    }
   else buffer2[dictionary_size-1] = 0;		// prev_byte of first byte
   buffer = buffer2;
   buffer_is_external = true;
   }
 
 
+/* Make data a copy of the dictionary of the master, whose data position is
+   dpos. If data already holds a copy of the same master, copy only the range
+   of data positions written since the last copy. */
+uint8_t * Trial_buffer::sync( const uint8_t * const mbuffer,
+                              const unsigned long long dpos )
+  {
+  const unsigned long long end = std::max( dirty_dpos, dpos );
+  stat_add( st_buffer_copies );
+  if( master_buffer == mbuffer && dpos >= sync_dpos &&
+      end - sync_dpos < dictionary_size )
+    {
+    unsigned i = sync_dpos % dictionary_size;
+    unsigned long long size = end - sync_dpos;
+    stat_add( st_buffer_copy_bytes, size );
+    while( size > 0 )
+      {
+      const unsigned len = std::min( size,
+                             (unsigned long long)( dictionary_size - i ) );
+      std::memcpy( data + i, mbuffer + i, len );
+      size -= len; i = 0;
+      }
+    }
+  else if( dpos > 0 )
+    {
+    const unsigned long long size =
+      std::min( dpos, (unsigned long long)dictionary_size );
+    std::memcpy( data, mbuffer, size );
+    stat_add( st_buffer_copy_bytes, size );
+    }
+  else data[dictionary_size-1] = 0;		// prev_byte of first byte
+  master_buffer = mbuffer;
+  sync_dpos = dirty_dpos = dpos;
+  return data;
+  }
+
+
 void LZ_mtester::flush_data()
   {
   if( pos > stream_pos )
@@ -82,6 +123,10 @@ void LZ_mtester::flush_data()
     const int size = pos - stream_pos;
     crc32.update_buf( crc_, buffer + stream_pos, size );
     if( md5sum ) md5sum->md5_update( buffer + stream_pos, size );
+    const unsigned long long dpos = partial_data_pos + stream_pos;
+    if( output && dpos < output_size )
+      std::memcpy( output + dpos, buffer + stream_pos,
+                   std::min( (unsigned long long)size, output_size - dpos ) );
     if( outfd >= 0 && writeblock( outfd, buffer + stream_pos, size ) != size )
       throw Error( "Write error" );
     if( pos >= dictionary_size )
@@ -140,18 +185,18 @@ bool LZ_mtester::check_trailer( FILE * const f, unsigned long long byte_pos )
   }
 
 
-/* Return value: 0 = OK, 1 = decoder error, 2 = unexpected EOF,
-                 3 = trailer error, 4 = unknown marker found,
-                 -1 = pos_limit reached. */
-int LZ_mtester::test_member( const unsigned long mpos_limit,
-                             const unsigned long long dpos_limit,
-                             FILE * const f, const unsigned long long byte_pos )
+/* Decoding loop of test_member. The trials of --byte-repair, --merge, and
+   --unzcrash test whole members, so the checks of the position limits are
+   compiled only into the instance used by the callers that set limits. */
+template< bool check_limits >
+int LZ_mtester::test_loop( const unsigned long mpos_limit,
+                           const unsigned long long dpos_limit,
+                           FILE * const f, const unsigned long long byte_pos )
   {
-  if( mpos_limit < Lzip_header::size + 5 ) return -1;
-  if( member_position() == Lzip_header::size ) rdec.load();
   while( !rdec.finished() )
     {
-    if( member_position() >= mpos_limit || data_position() >= dpos_limit )
+    if( check_limits &&
+        ( member_position() >= mpos_limit || data_position() >= dpos_limit ) )
       { flush_data(); return -1; }
     const int pos_state = data_position() & pos_state_mask;
     if( rdec.decode_bit( bm_match[state()][pos_state] ) == 0 )	// 1st bit
@@ -237,6 +282,39 @@ int LZ_mtester::test_member( const unsigned long mpos_limit,
   }
 
 
+/* Return value: 0 = OK, 1 = decoder error, 2 = unexpected EOF,
+                 3 = trailer error, 4 = unknown marker found,
+                 -1 = pos_limit reached. */
+int LZ_mtester::test_member( const unsigned long mpos_limit,
+                             const unsigned long long dpos_limit,
+                             FILE * const f, const unsigned long long byte_pos )
+  {
+  if( mpos_limit < Lzip_header::size + 5 ) return -1;
+  if( member_position() == Lzip_header::size ) rdec.load();
+  if( !stats_enabled )
+    {
+    if( mpos_limit == LONG_MAX && dpos_limit == LLONG_MAX )
+      return test_loop< false >( mpos_limit, dpos_limit, f, byte_pos );
+    return test_loop< true >( mpos_limit, dpos_limit, f, byte_pos );
+    }
+  const unsigned long long dpos = data_position();
+  if( mpos_limit == LONG_MAX && dpos_limit == LLONG_MAX )	// trial
+    {
+    const int result = test_loop< false >( mpos_limit, dpos_limit, f, byte_pos );
+    stat_add( st_trials ); stat_add( st_trial_bytes, data_position() - dpos );
+    if( result != 0 )
+      { stat_add( st_failed_trials );
+        stat_add( st_failed_trial_bytes, data_position() - dpos ); }
+    return result;
+    }
+  const unsigned long long start = stat_time_us();		// master
+  const int result = test_loop< true >( mpos_limit, dpos_limit, f, byte_pos );
+  stat_add( st_masters ); stat_add( st_master_bytes, data_position() - dpos );
+  stat_add( st_master_us, stat_time_us() - start );
+  return result;
+  }
+
+
 /* Return value: 0 = OK, 1 = decoder error, 2 = unexpected EOF,
                  3 = trailer error, 4 = unknown marker found. */
 int LZ_mtester::debug_decode_member( const long long dpos, const long long mpos,
@@ -371,3 +449,37 @@ int LZ_mtester::debug_decode_member( const long long dpos, const long long mpos,
   flush_data();
   return 2;
   }
+
+
+Mtester_checkpoints::Mtester_checkpoints( const uint8_t * const ibuf,
+                          const long ibuf_size, const unsigned dict_size,
+                          const unsigned long begin, const unsigned long end,
+                          const unsigned long interval )
+  : buffer( ibuf ), buffer_size( ibuf_size ), dictionary_size( dict_size )
+  {
+  if( interval == 0 ) return;
+  LZ_mtester mtester( buffer, buffer_size, dictionary_size );
+  for( unsigned long pos = begin; pos < end; pos += interval )
+    {
+    if( mtester.test_member( pos ) != -1 ) break;	// error before pos
+    LZ_mtester * const cp = new LZ_mtester( mtester );
+    cp->duplicate_buffer();
+    cp_vector.push_back( cp );
+    }
+  }
+
+
+/* Return a new tester decoded up to pos_limit, starting from the last
+   checkpoint not beyond pos_limit, or 0 if pos_limit can't be reached. */
+LZ_mtester * Mtester_checkpoints::prepare_master( const unsigned long pos_limit ) const
+  {
+  int i = cp_vector.size() - 1;
+  while( i >= 0 && cp_vector[i]->member_position() > pos_limit ) --i;
+  LZ_mtester * master;
+  if( i >= 0 )
+    { master = new LZ_mtester( *cp_vector[i] ); master->duplicate_buffer(); }
+  else master = new LZ_mtester( buffer, buffer_size, dictionary_size );
+  if( master->test_member( pos_limit ) == -1 ) return master;
+  delete master;
+  return 0;
+  }
@@ -17,7 +17,7 @@
 
 class Range_mtester
   {
-  const uint8_t * const buffer;		// input buffer
+  const uint8_t * buffer;		// input buffer
   const long buffer_size;
   long pos;				// current pos in buffer
   uint32_t code;
@@ -37,6 +37,8 @@ public:
 
   bool finished() { return pos >= buffer_size; }
   unsigned long member_position() const { return pos; }
+  // continue reading from a copy of the input buffer
+  void set_buffer( const uint8_t * const buf ) { buffer = buf; }
 
   uint8_t get_byte()
     {
@@ -234,6 +236,35 @@ len3:
 
 class MD5SUM;		// forward declaration
 
+/* Dictionary buffer reused by the successive trial testers copied from the
+   same master. Only the part of the dictionary changed since the last copy
+   (written by the last trial or by the master advancing) is copied again
+   from the master, instead of the whole dictionary for each trial. */
+class Trial_buffer
+  {
+  uint8_t * const data;
+  const unsigned dictionary_size;
+  const uint8_t * master_buffer;	// buffer copied into data, or 0
+  unsigned long long sync_dpos;		// data pos of master at last copy
+  unsigned long long dirty_dpos;	// end of data written since last copy
+
+  Trial_buffer( const Trial_buffer & );		// declared as private
+  void operator=( const Trial_buffer & );	// declared as private
+
+public:
+  explicit Trial_buffer( const unsigned dict_size )
+    : data( new_dictionary( dict_size ) ), dictionary_size( dict_size ),
+      master_buffer( 0 ), sync_dpos( 0 ), dirty_dpos( 0 ) {}
+  ~Trial_buffer() { delete_dictionary( data, dictionary_size ); }
+
+  // must be called before copying from a master different from the last one
+  void reset() { master_buffer = 0; }
+  uint8_t * sync( const uint8_t * const mbuffer,
+                  const unsigned long long dpos );
+  void written( const unsigned long long dpos )
+    { if( dirty_dpos < dpos ) dirty_dpos = dpos; }
+  };
+
 class LZ_mtester
   {
   unsigned long long partial_data_pos;
@@ -258,6 +289,9 @@ class LZ_mtester
   unsigned max_marker_size_;		// maximum marker size found
   bool pos_wrapped;
   bool buffer_is_external;
+  Trial_buffer * trial_buffer;		// buffer shared with previous trials
+  uint8_t * output;			// if not null, copy the data here
+  unsigned long long output_size;	// bytes copied at most to output
 
   Bit_model bm_literal[1<<literal_context_bits][0x300];
   Bit_model bm_match[State::states][pos_states];
@@ -276,6 +310,10 @@ class LZ_mtester
   void print_block( const int len );
   void flush_data();
   bool check_trailer( FILE * const f = 0, unsigned long long byte_pos = 0 );
+  template< bool check_limits >
+  int test_loop( const unsigned long mpos_limit,
+                 const unsigned long long dpos_limit,
+                 FILE * const f, const unsigned long long byte_pos );
 
   uint8_t peek_prev() const
     { return buffer[((pos > 0) ? pos : dictionary_size)-1]; }
@@ -343,7 +381,7 @@ public:
     partial_data_pos( 0 ),
     rdec( ibuf, ibuf_size ),
     dictionary_size( dict_size ),
-    buffer( new uint8_t[dictionary_size] ),
+    buffer( new_dictionary( dictionary_size ) ),
     pos( 0 ),
     stream_pos( 0 ),
     crc_( 0xFFFFFFFFU ),
@@ -358,11 +396,15 @@ public:
     max_rep0( 0 ),
     max_packet_size_( 0 ),
     max_marker_size_( 0 ),
-    pos_wrapped( false ), buffer_is_external( false )
+    pos_wrapped( false ), buffer_is_external( false ), trial_buffer( 0 ),
+    output( 0 ), output_size( 0 )
     // prev_byte of first byte; also for peek( 0 ) on corrupt file
     { buffer[dictionary_size-1] = 0; }
 
-  ~LZ_mtester() { if( !buffer_is_external ) delete[] buffer; }
+  ~LZ_mtester()
+    { if( trial_buffer ) trial_buffer->written( data_position() );
+      if( !buffer_is_external ) delete_dictionary( buffer, dictionary_size );
+    }
 
   unsigned crc() const { return crc_ ^ 0xFFFFFFFFU; }
   unsigned long long data_position() const { return partial_data_pos + pos; }
@@ -383,6 +425,19 @@ public:
       *prev_bufferp = buffer + pos; return buffer; }
 
   void duplicate_buffer( uint8_t * const buffer2 );
+  // give a copy made with the copy constructor its own buffer
+  void duplicate_buffer()
+    { duplicate_buffer( new_dictionary( dictionary_size ) );
+      buffer_is_external = false; }
+  // give a copy made with the copy constructor the buffer of a trial
+  void duplicate_buffer( Trial_buffer & tb )
+    { buffer = tb.sync( buffer, data_position() );
+      buffer_is_external = true; trial_buffer = &tb; }
+  void set_input_buffer( const uint8_t * const ibuf )
+    { rdec.set_buffer( ibuf ); }
+  // copy the first osize bytes of data decoded to obuf
+  void set_output( uint8_t * const obuf, const unsigned long long osize )
+    { output = obuf; output_size = osize; }
 
   // these two functions set max_rep0
   int test_member( const unsigned long mpos_limit = LONG_MAX,
@@ -393,3 +448,29 @@ public:
   int debug_decode_member( const long long dpos, const long long mpos,
                            const bool show_packets );
   };
+
+
+/* Snapshots of the full state of a LZ_mtester taken every 'interval' bytes
+   of the member, from 'begin' to 'end'. Searches moving backwards in the
+   member can then resume decoding from the nearest snapshot instead of
+   decoding again the whole member from the beginning. */
+class Mtester_checkpoints
+  {
+  const uint8_t * const buffer;
+  const long buffer_size;
+  const unsigned dictionary_size;
+  std::vector< LZ_mtester * > cp_vector;	// in increasing position order
+
+  Mtester_checkpoints( const Mtester_checkpoints & );	// declared as private
+  void operator=( const Mtester_checkpoints & );	// declared as private
+
+public:
+  Mtester_checkpoints( const uint8_t * const ibuf, const long ibuf_size,
+                       const unsigned dict_size, const unsigned long begin,
+                       const unsigned long end, const unsigned long interval );
+  ~Mtester_checkpoints()
+    { for( unsigned i = 0; i < cp_vector.size(); ++i ) delete cp_vector[i]; }
+
+  int size() const { return cp_vector.size(); }
+  LZ_mtester * prepare_master( const unsigned long pos_limit ) const;
+  };
@@ -24,81 +24,233 @@
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "lzip.h"
 #include "lzip_index.h"
+#include "simd.h"
+#include "threads.h"
+
+
+namespace {
+
+/* Return the position of the first byte in [pos,end) equal to the byte
+   following it, or end if none is found. buffer[end] is read. */
+long find_pair( const uint8_t * const buffer, long pos, const long end )
+  {
+#ifdef VECTOR16
+  // compare 16 bytes with the same bytes shifted by one position
+  while( pos + 16 <= end )
+    {
+    v16u8 a, b;
+    std::memcpy( &a, buffer + pos, 16 );
+    std::memcpy( &b, buffer + pos + 1, 16 );
+    const v16u8 eq = ( a == b );
+    uint64_t w[2];
+    std::memcpy( w, &eq, 16 );
+    if( w[0] | w[1] ) break;
+    pos += 16;
+    }
+#endif
+  while( pos < end && buffer[pos] != buffer[pos+1] ) ++pos;
+  return pos;
+  }
+
+
+struct Nrep_unit			// LZMA data of a member
+  {
+  const uint8_t * buffer;
+  long pos, end;
+  unsigned long number;			// position of the member in the scan
+  int name;				// index of the file in filenames
+  };
+
+struct Nrep_counts
+  {
+  std::vector< unsigned long > len_vector;
+  unsigned long long lzma_size;
+  unsigned long best_pos;
+  unsigned long best_unit;		// number of the member with best_pos
+  int best_name;
+
+  Nrep_counts() : lzma_size( 0 ), best_pos( 0 ), best_unit( 0 ),
+                  best_name( -1 ) {}
+
+  /* Add the counts of a thread. The longest sequence found first is kept
+     if several threads found sequences of the same length. */
+  void add( const Nrep_counts & c )
+    {
+    lzma_size += c.lzma_size;
+    if( c.len_vector.size() > len_vector.size() ||
+        ( c.len_vector.size() == len_vector.size() && c.best_name >= 0 &&
+          ( best_name < 0 || c.best_unit < best_unit ) ) )
+      { best_pos = c.best_pos; best_unit = c.best_unit;
+        best_name = c.best_name; }
+    if( c.len_vector.size() > len_vector.size() )
+      len_vector.resize( c.len_vector.size() );
+    for( unsigned len = 2; len < c.len_vector.size(); ++len )
+      len_vector[len] += c.len_vector[len];
+    }
+  };
+
+
+void scan_unit( const Nrep_unit & unit, const int repeated_byte,
+                Nrep_counts & counts )
+  {
+  const bool count_all = ( repeated_byte < 0 || repeated_byte >= 256 );
+  const uint8_t * const buffer = unit.buffer;
+  std::vector< unsigned long > & len_vector = counts.len_vector;
+  long pos = unit.pos;
+  const long end = unit.end;
+  counts.lzma_size += end - pos;
+  while( ( pos = find_pair( buffer, pos, end ) ) < end )
+    {
+    const uint8_t byte = buffer[pos];
+    unsigned len = 2;
+    pos += 2;
+    while( pos < end && buffer[pos] == byte ) { ++pos; ++len; }
+    if( !count_all && repeated_byte != (int)byte ) continue;
+    if( len >= len_vector.size() ) { len_vector.resize( len + 1 );
+      counts.best_name = unit.name; counts.best_unit = unit.number;
+      counts.best_pos = pos - len; }
+    ++len_vector[len];
+    }
+  }
+
+
+struct Nrep_arg
+  {
+  const std::vector< Nrep_unit > * units;
+  Nrep_counts * counts;			// counts of this thread
+  Work_queue * queue;			// units to scan
+  int repeated_byte;
+  };
+
+extern "C" void * nworker( void * arg )
+  {
+  const Nrep_arg & tmp = *(const Nrep_arg *)arg;
+  const std::vector< Nrep_unit > & units = *tmp.units;
+  unsigned long u;
+  while( tmp.queue->next( u ) )
+    scan_unit( units[u], tmp.repeated_byte, *tmp.counts );
+  return 0;
+  }
+
+
+/* Scan the members of a batch, sharing them among num_workers threads,
+   each with its own histogram. The histograms are added at the end. */
+void scan_batch( const std::vector< Nrep_unit > & units,
+                 const int repeated_byte, const int num_workers,
+                 Nrep_counts & counts )
+  {
+  const int workers = std::min( (unsigned)num_workers, (unsigned)units.size() );
+  if( workers <= 1 )
+    {
+    Nrep_counts c;
+    for( unsigned u = 0; u < units.size(); ++u )
+      scan_unit( units[u], repeated_byte, c );
+    counts.add( c );
+    return;
+    }
+  Work_queue queue( units.size() );
+  std::vector< Nrep_counts > thread_counts( workers );
+  std::vector< Nrep_arg > nrep_args( workers );
+  for( int i = 0; i < workers; ++i )
+    {
+    nrep_args[i].units = &units;
+    nrep_args[i].counts = &thread_counts[i];
+    nrep_args[i].queue = &queue;
+    nrep_args[i].repeated_byte = repeated_byte;
+    }
+  run_workers( nworker, &nrep_args[0], workers, false );
+  Nrep_counts c;
+  for( int i = 0; i < workers; ++i ) c.add( thread_counts[i] );
+  counts.add( c );
+  }
+
+} // end namespace
 
 
 /* Show how well the frequency of sequences of N repeated bytes in LZMA data
    matches the value expected for random data. ( 1 / 2^( 8 * N ) )
    Print cumulative data for all files followed by the name of the first
    file with the longest sequence.
+   The files are mapped in batches of up to 4 files per worker thread, and
+   the members of each batch are scanned in parallel.
 */
 int print_nrep_stats( const std::vector< std::string > & filenames,
-                      const Cl_options & cl_opts, const int repeated_byte )
+                      const Cl_options & cl_opts, const int repeated_byte,
+                      const int num_workers )
   {
-  std::vector< unsigned long > len_vector;
-  unsigned long long lzma_size = 0;		// total size of LZMA data
-  unsigned long best_pos = 0;
-  int best_name = -1, retval = 0;
+  Nrep_counts counts;
+  int retval = 0;
   const bool count_all = ( repeated_byte < 0 || repeated_byte >= 256 );
+  const unsigned batch_size = 4 * std::max( 1, num_workers );
+  // limit the address space mapped at once
+  const unsigned long long max_mapped =
+    ( sizeof (void *) > 4 ) ? 1ULL << 40 : 1ULL << 29;
+  unsigned long total_units = 0;
   bool stdin_used = false;
-  for( unsigned i = 0; i < filenames.size(); ++i )
+  std::vector< std::pair< const uint8_t *, unsigned long long > > maps;
+  std::vector< Nrep_unit > units;
+  for( unsigned i = 0; i < filenames.size(); )
     {
-    const bool from_stdin = ( filenames[i] == "-" );
-    if( from_stdin ) { if( stdin_used ) continue; else stdin_used = true; }
-    const char * const input_filename =
-      from_stdin ? "(stdin)" : filenames[i].c_str();
-    struct stat in_stats;				// not used
-    const int infd = from_stdin ? STDIN_FILENO :
-      open_instream( input_filename, &in_stats, false, true );
-    if( infd < 0 ) { set_retval( retval, 1 ); continue; }
-
-    const Lzip_index lzip_index( infd, cl_opts, cl_opts.ignore_errors,
-                                 cl_opts.ignore_errors );
-    if( lzip_index.retval() != 0 )
+    maps.clear(); units.clear();
+    unsigned long long mapped = 0;
+    for( ; i < filenames.size() && maps.size() < batch_size &&
+           mapped < max_mapped; ++i )
       {
-      show_file_error( input_filename, lzip_index.error().c_str() );
-      set_retval( retval, lzip_index.retval() );
+      const bool from_stdin = ( filenames[i] == "-" );
+      if( from_stdin ) { if( stdin_used ) continue; else stdin_used = true; }
+      const char * const input_filename =
+        from_stdin ? "(stdin)" : filenames[i].c_str();
+      struct stat in_stats;				// not used
+      const int infd = from_stdin ? STDIN_FILENO :
+        open_instream( input_filename, &in_stats, false, true );
+      if( infd < 0 ) { set_retval( retval, 1 ); continue; }
+
+      const Lzip_index lzip_index( infd, cl_opts, cl_opts.ignore_errors,
+                                   cl_opts.ignore_errors );
+      if( lzip_index.retval() != 0 )
+        {
+        show_file_error( input_filename, lzip_index.error().c_str() );
+        set_retval( retval, lzip_index.retval() );
+        close( infd );
+        continue;
+        }
+      const unsigned long long cdata_size = lzip_index.cdata_size();
+      if( !fits_in_size_t( cdata_size ) )		// mmap uses size_t
+        { show_file_error( input_filename, "Input file is too large for mmap." );
+          set_retval( retval, 1 ); close( infd ); continue; }
+      const uint8_t * const buffer =
+        (const uint8_t *)mmap( 0, cdata_size, PROT_READ, MAP_PRIVATE, infd, 0 );
       close( infd );
-      continue;
-      }
-    const unsigned long long cdata_size = lzip_index.cdata_size();
-    if( !fits_in_size_t( cdata_size ) )		// mmap uses size_t
-      { show_file_error( input_filename, "Input file is too large for mmap." );
-        set_retval( retval, 1 ); close( infd ); continue; }
-    const uint8_t * const buffer =
-      (const uint8_t *)mmap( 0, cdata_size, PROT_READ, MAP_PRIVATE, infd, 0 );
-    close( infd );
-    if( buffer == MAP_FAILED )
-      { show_file_error( input_filename, "Can't mmap", errno );
-        set_retval( retval, 1 ); continue; }
-    for( long j = 0; j < lzip_index.members(); ++j )
-      {
-      const Block & mb = lzip_index.mblock( j );
-      long pos = mb.pos() + 7;			// skip header (+1 byte) and
-      const long end = mb.end() - 20;		// trailer of each member
-      lzma_size += end - pos;
-      while( pos < end )
+      if( buffer == MAP_FAILED )
+        { show_file_error( input_filename, "Can't mmap", errno );
+          set_retval( retval, 1 ); continue; }
+      maps.push_back( std::make_pair( buffer, cdata_size ) );
+      mapped += cdata_size;
+      for( long j = 0; j < lzip_index.members(); ++j )
         {
-        const uint8_t byte = buffer[pos++];
-        if( buffer[pos] == byte )
-          {
-          unsigned len = 2;
-          ++pos;
-          while( pos < end && buffer[pos] == byte ) { ++pos; ++len; }
-          if( !count_all && repeated_byte != (int)byte ) continue;
-          if( len >= len_vector.size() ) { len_vector.resize( len + 1 );
-            best_name = i; best_pos = pos - len; }
-          ++len_vector[len];
-          }
+        const Block & mb = lzip_index.mblock( j );
+        Nrep_unit unit;
+        unit.buffer = buffer;
+        unit.pos = mb.pos() + 7;		// skip header (+1 byte) and
+        unit.end = mb.end() - 20;		// trailer of each member
+        unit.number = total_units++;
+        unit.name = i;
+        units.push_back( unit );
         }
       }
-    munmap( (void *)buffer, cdata_size );
+    scan_batch( units, repeated_byte, num_workers, counts );
+    for( unsigned j = 0; j < maps.size(); ++j )
+      munmap( (void *)maps[j].first, maps[j].second );
     }
+  const std::vector< unsigned long > & len_vector = counts.len_vector;
+  const unsigned long long lzma_size = counts.lzma_size;
 
   if( verbosity < 0 ) return retval;
   if( count_all )
@@ -114,8 +266,8 @@ int print_nrep_stats( const std::vector< std::string > & filenames,
                    "(expected 1 every %sB)\n",
                    len, len_vector[len], lzma_size / len_vector[len],
                    format_num( 1ULL << ( 8 * ( len - count_all ) ), -1ULL, -1 ) );
-  if( best_name >= 0 )
+  if( counts.best_name >= 0 )
     std::printf( "Longest sequence found at position %lu of '%s'\n",
-                 best_pos, filenames[best_name].c_str() );
+                 counts.best_pos, filenames[counts.best_name].c_str() );
   return retval;
   }
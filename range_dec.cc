@@ -35,9 +35,12 @@
 
 namespace {
 
+/* 'written' is the amount of data of the member already written to outfd
+   (after outskip) by dec_members_mt. */
 bool decompress_member( const int infd, const Cl_options & cl_opts,
           const Pretty_print & pp, const unsigned long long mpos,
-          const unsigned long long outskip, const unsigned long long outend )
+          const unsigned long long outskip, const unsigned long long outend,
+          const unsigned long long written )
   {
   Range_decoder rdec( infd );
   Lzip_header header;
@@ -46,13 +49,13 @@ bool decompress_member( const int infd, const Cl_options & cl_opts,
     { pp( "File ends unexpectedly at member header." ); return false; }
   if( !header.check_magic() ) { pp( bad_magic_msg ); return false; }
   if( !header.check_version() )
-    { pp( bad_version( header.version() ) ); return false; }
+    { pp( bad_version( header.version() ).c_str() ); return false; }
   const unsigned dictionary_size = header.dictionary_size();
   if( !isvalid_ds( dictionary_size ) ) { pp( bad_dict_msg ); return false; }
 
   if( verbosity >= 2 ) pp();
 
-  LZ_decoder decoder( rdec, dictionary_size, outfd, outskip, outend );
+  LZ_decoder decoder( rdec, dictionary_size, outfd, outskip + written, outend );
   const int result = decoder.decode_member( cl_opts, pp );
   if( result != 0 )
     {
@@ -124,7 +127,8 @@ bool safe_seek( const int fd, const long long pos,
 int range_decompress( const std::string & input_filename,
                       const std::string & default_output_filename,
                       const Cl_options & cl_opts, Block range,
-                      const bool force, const bool to_stdout )
+                      const bool force, const bool to_stdout,
+                      const int num_workers )
   {
   const char * const filename = input_filename.c_str();
   struct stat in_stats;
@@ -162,19 +166,32 @@ int range_decompress( const std::string & input_filename,
   bool error = false;
   for( long i = 0; i < lzip_index.members(); ++i )
     {
-    const Block & db = lzip_index.dblock( i );
-    if( range.overlaps( db ) )
-      {
-      if( verbosity >= 3 && lzip_index.members() > 1 )
-        std::fprintf( stderr, "Decompressing member %3ld\n", i + 1 );
-      const long long outskip = std::max( 0LL, range.pos() - db.pos() );
-      const long long outend = std::min( db.size(), range.end() - db.pos() );
-      const long long mpos = lzip_index.mblock( i ).pos();
-      if( !safe_seek( infd, mpos, filename ) ) cleanup_and_fail( 1 );
-      if( !decompress_member( infd, cl_opts, pp, mpos, outskip, outend ) )
-        { if( cl_opts.ignore_errors ) error = true; else cleanup_and_fail( 2 ); }
-      pp.reset();
+    if( !range.overlaps( lzip_index.dblock( i ) ) ) continue;
+    unsigned long long written = 0;	// data written by dec_members_mt
+    if( num_workers > 1 && verbosity <= 1 && !cl_opts.ignore_errors &&
+        lzip_index.dblock( i ).pos() >= range.pos() )
+      {				// decode in parallel the members fully in range
+      long last = i;
+      while( last < lzip_index.members() &&
+             lzip_index.dblock( last ).end() <= range.end() ) ++last;
+      if( last - i >= 2 )
+        {
+        i = dec_members_mt( infd, lzip_index, cl_opts, i, last, false,
+                            num_workers, written );
+        if( i >= last ) { i = last - 1; continue; }
+        }
       }
+    const Block & db = lzip_index.dblock( i );
+    if( verbosity >= 3 && lzip_index.members() > 1 )
+      std::fprintf( stderr, "Decompressing member %3ld\n", i + 1 );
+    const long long outskip = std::max( 0LL, range.pos() - db.pos() );
+    const long long outend = std::min( db.size(), range.end() - db.pos() );
+    const long long mpos = lzip_index.mblock( i ).pos();
+    if( !safe_seek( infd, mpos, filename ) ) cleanup_and_fail( 1 );
+    if( !decompress_member( infd, cl_opts, pp, mpos, outskip, outend,
+                            written ) )
+      { if( cl_opts.ignore_errors ) error = true; else cleanup_and_fail( 2 ); }
+    pp.reset();
     }
   if( close( infd ) != 0 )
     { show_file_error( filename, "Error closing input file", errno );
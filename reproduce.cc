@@ -23,6 +23,7 @@
 #include <csignal>
 #include <cstdio>
 #include <cstring>
+#include <new>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -35,6 +36,7 @@
 #include "md5.h"
 #include "mtester.h"
 #include "lzip_index.h"
+#include "threads.h"
 
 
 namespace {
@@ -52,6 +54,15 @@ int fatal_retval = 0;
 int fatal( const int retval )
   { if( fatal_retval == 0 ) fatal_retval = retval; return retval; }
 
+pid_t compressor_pid = 0;	// compressor running, killed with the job
+
+// Kill the compressor of a reproduction job killed by kill_job.
+extern "C" void job_term_handler( int )
+  {
+  if( compressor_pid > 0 ) kill( compressor_pid, SIGKILL );
+  _exit( 2 );
+  }
+
 // Return the position of the damaged area in the member, or -1 if error.
 long zeroed_sector_pos( const uint8_t * const mbuffer, const long msize,
                         const char * const input_filename,
@@ -290,62 +301,139 @@ bool good_status( const pid_t pid, const char * const name, const bool finished
   }
 
 
+// data shared by all the reproduction attempts on a member
+struct Repro_data
+  {
+  uint8_t * mbuffer;
+  long msize;
+  long long dsize;
+  const uint8_t * prefix;	// decompressed data up to good_dsize, or 0
+  unsigned long long good_dsize;
+  long begin;
+  long end;
+  const uint8_t * rbuf;
+  long rsize;
+  long offset;
+  unsigned dictionary_size;
+  };
+
+
 /* Feed to lzip through 'ofd' the data decompressed up to 'good_dsize'
-   (master->data_position) followed by the reference data from byte at
-   offset 'offset' of reference file, up to a total of 'dsize' bytes. */
-bool feed_data( uint8_t * const mbuffer, const long msize,
-                const long long dsize, const unsigned long long good_dsize,
-                const uint8_t * const rbuf, const long rsize,
-                const long offset, const unsigned dictionary_size,
-                const int ofd )
+   (read from the cached 'prefix', or decompressed again from the member if
+   the prefix is not cached) followed by the reference data from byte at
+   offset 'offset' of reference file, up to a total of 'dsize' bytes.
+   EPIPE is not an error; it means that the attempt has been abandoned at
+   the first mismatch and the compressor has been stopped. */
+bool feed_data( const Repro_data & rd, const int ofd )
   {
-  LZ_mtester mtester( mbuffer, msize, dictionary_size, ofd );
-  if( mtester.test_member( LONG_MAX, good_dsize ) != -1 ||
-      good_dsize != mtester.data_position() )
-    { show_error( "Error decompressing prefix data for compressor." );
-      return false; }
+  if( rd.prefix )
+    {
+    if( writeblock( ofd, rd.prefix, rd.good_dsize ) != (long long)rd.good_dsize )
+      { if( errno == EPIPE ) return true;
+        show_error( "Error writing prefix data to compressor", errno );
+        return false; }
+    }
+  else if( rd.good_dsize > 0 )
+    {
+    LZ_mtester mtester( rd.mbuffer, rd.msize, rd.dictionary_size, ofd );
+    bool done = false;
+    try { done = mtester.test_member( LONG_MAX, rd.good_dsize ) == -1 &&
+                 rd.good_dsize == mtester.data_position(); }
+    catch( Error & )				// write error
+      { if( errno == EPIPE ) return true;
+        show_error( "Error writing prefix data to compressor", errno );
+        return false; }
+    if( !done )
+      { show_error( "Error decompressing prefix data for compressor." );
+        return false; }
+    }
   // limit reference data to remaining decompressed data in member
-  const long size =
-    std::min( (unsigned long long)rsize - offset, dsize - good_dsize );
-  if( writeblock( ofd, rbuf + offset, size ) != size )
-    { show_error( "Error writing reference data to compressor", errno );
+  const long size = std::min( (unsigned long long)rd.rsize - rd.offset,
+                              rd.dsize - rd.good_dsize );
+  if( writeblock( ofd, rd.rbuf + rd.offset, size ) != size )
+    { if( errno == EPIPE ) return true;
+      show_error( "Error writing reference data to compressor", errno );
       return false; }
   return true;
   }
 
 
+/* Decompress the member up to 'good_dsize' once into memory, so that the
+   data feeders of all the attempts share it (the reproduction jobs through
+   copy-on-write) instead of decompressing the prefix again for each attempt.
+   The prefix is not cached if larger than a quarter of the memory budget.
+   Return the address of the data, or 0 if not cached. */
+uint8_t * cache_prefix( const uint8_t * const mbuffer, const long msize,
+                        const unsigned long long good_dsize,
+                        const unsigned dictionary_size )
+  {
+  if( good_dsize == 0 || good_dsize > memory_budget() / 4 ||
+      !fits_in_size_t( good_dsize ) ) return 0;
+  uint8_t * const prefix = new( std::nothrow ) uint8_t[good_dsize];
+  if( !prefix ) return 0;
+  LZ_mtester mtester( mbuffer, msize, dictionary_size );
+  mtester.set_output( prefix, good_dsize );
+  if( mtester.test_member( LONG_MAX, good_dsize ) != -1 ||
+      good_dsize != mtester.data_position() )
+    { delete[] prefix; return 0; }	// the feeders will show the error
+  return prefix;
+  }
+
+
+bool show_progress = true;	// false in reproduction jobs
+
+enum { no_msg = 0, crc_msg = 1, tail_msg = 2 };	// final messages
+const char * const crc_final_msg =
+  "  Zeroed sector reproduced, but CRC does not match."
+  " (Multiple damages in file?).\n";
+const char * const tail_final_msg =
+  "  Zeroed sector reproduced, but data after it does not"
+  " match. (Maybe wrong reference data or lzip version).\n";
+
+void set_final_msg( const int msg )
+  {
+  if( msg == crc_msg ) final_msg = crc_final_msg;
+  else if( msg == tail_msg && !final_msg ) final_msg = tail_final_msg;
+  }
+
+
+struct Feeder_arg
+  {
+  const Repro_data * rd;
+  int ofd;			// pipe to compressor
+  bool ok;
+  };
+
+// Feed the data to the compressor from a thread instead of a child process.
+extern "C" void * fworker( void * arg )
+  {
+  Feeder_arg & fa = *(Feeder_arg *)arg;
+  const Repro_data & rd = *fa.rd;
+  fa.ok = feed_data( rd, fa.ofd );
+  if( close( fa.ofd ) != 0 && fa.ok ) { show_close_error(); fa.ok = false; }
+  return 0;
+  }
+
+
 /* Try to reproduce the zeroed sector.
    Return value: -1 = failure, 0 = success, > 0 = fatal error. */
-int try_reproduce( uint8_t * const mbuffer, const long msize,
-                   const long long dsize, const unsigned long long good_dsize,
-                   const long begin, const long end,
-                   const uint8_t * const rbuf, const long rsize,
-                   const long offset, const unsigned dictionary_size,
-                   const char ** const lzip_argv, MD5SUM * const md5sump,
-                   const char terminator, const bool auto0 = false )
+int try_reproduce( const Repro_data & rd, const char ** const lzip_argv,
+                   MD5SUM * const md5sump, const char terminator,
+                   const bool auto0 = false )
   {
+  uint8_t * const mbuffer = rd.mbuffer;
+  const long begin = rd.begin;
+  const long end = rd.end;
   int fda[2];				// pipe to compressor
   int fda2[2];				// pipe from compressor
   if( pipe( fda ) < 0 || pipe( fda2 ) < 0 )
     { show_error( "Can't create pipe", errno ); return fatal( 1 ); }
-  const pid_t pid = fork();
-  if( pid == 0 )			// child 1 (compressor feeder)
-    {
-    if( close( fda[0] ) != 0 ||
-        close( fda2[0] ) != 0 || close( fda2[1] ) != 0 ||
-        !feed_data( mbuffer, msize, dsize, good_dsize, rbuf, rsize, offset,
-                    dictionary_size, fda[1] ) )
-      { close( fda[1] ); _exit( 2 ); }
-    if( close( fda[1] ) != 0 )
-      { show_close_error(); _exit( 2 ); }
-    _exit( 0 );
-    }
-  if( pid < 0 )			// parent
-    { show_fork_error( "data feeder" ); return fatal( 1 ); }
-
+  /* Fork the compressor before starting the feeder thread, so that only
+     the forking thread is duplicated in the child. */
   const pid_t pid2 = fork();
-  if( pid2 == 0 )			// child 2 (compressor)
+  if( pid2 == 0 )			// child (compressor)
     {
+    std::signal( SIGPIPE, SIG_DFL );
     if( dup2( fda[0], STDIN_FILENO ) >= 0 &&
         dup2( fda2[1], STDOUT_FILENO ) >= 0 &&
         close( fda[0] ) == 0 && close( fda[1] ) == 0 &&
@@ -355,65 +443,82 @@ int try_reproduce( uint8_t * const mbuffer, const long msize,
     _exit( 2 );
     }
   if( pid2 < 0 )			// parent
-    { show_fork_error( lzip_argv[0] ); return fatal( 1 ); }
+    { show_fork_error( lzip_argv[0] ); close( fda[0] ); close( fda[1] );
+      close( fda2[0] ); close( fda2[1] ); return fatal( 1 ); }
+  stat_add( st_children );
+  compressor_pid = pid2;
+  close( fda[0] ); close( fda2[1] );
 
-  close( fda[0] ); close( fda[1] ); close( fda2[1] );
-  const long xend = std::min( end + 4, msize );
+  // ignore SIGPIPE so that the feeder gets EPIPE if the compressor stops
+  void (* const old_handler)( int ) = std::signal( SIGPIPE, SIG_IGN );
+  Feeder_arg fa;
+  fa.rd = &rd; fa.ofd = fda[1]; fa.ok = true;
+  pthread_t feeder;
+  xcreate( &feeder, fworker, &fa );
+  const long xend = std::min( end + 4, rd.msize );
   int retval = 0;				// -1 = mismatch
   bool first_post = true;
   bool same_ds = true;				// reproduced DS == header DS
   bool tail_mismatch = false;			// mismatch after end
+  bool abandoned = false;			// output diverged from mbuffer
   for( long i = 0; i < xend; )
     {
     enum { buffer_size = 16384 };		// 65536 makes it slower
     uint8_t buffer[buffer_size];
-    if( verbosity >= 2 && i >= 65536 && terminator )
+    if( verbosity >= 2 && i >= 65536 && terminator && show_progress )
       {
       if( first_post )
         { first_post = false; print_pending_newline( terminator ); }
       std::printf( "  Reproducing position %ld %c", i, terminator );
       std::fflush( stdout ); pending_newline = true;
       }
-    const int rd = readblock( fda2[0], buffer, buffer_size );
+    // compare the output as soon as it arrives instead of filling the buffer
+    int rd_size;
+    do rd_size = read( fda2[0], buffer, buffer_size );
+    while( rd_size < 0 && errno == EINTR );
     // not enough reference data to fill zeroed sector at this level
-    if( rd <= 0 ) { if( i < end ) retval = -1; break; }
+    if( rd_size <= 0 ) { if( i < end ) retval = -1; break; }
     int j = 0;
     /* Compare reproduced bytes with data in mbuffer.
        Do not fail because of a mismatch beyond the end of the zeroed sector
        to prevent the reproduction from failing because of the reference file
        just covering the zeroed sector. */
-    for( ; j < rd && i < begin; ++j, ++i )
+    for( ; j < rd_size && i < begin; ++j, ++i )
       if( mbuffer[i] != buffer[j] )			// mismatch
         {
-        if( i != 5 ) { retval = -1; goto done; }	// ignore different DS
-        const Lzip_header * header = (const Lzip_header *)buffer;
-        if( header->dictionary_size() != dictionary_size ) same_ds = false;
+        if( i != 5 )				// ignore different DS
+          { retval = -1; abandoned = true; goto done; }
+        Lzip_header header;		// buffer may not start at the header
+        header.data[5] = buffer[j];
+        if( header.dictionary_size() != rd.dictionary_size ) same_ds = false;
         }
     // copy reproduced bytes into zeroed sector of mbuffer
-    for( ; j < rd && i < end; ++j, ++i ) mbuffer[i] = buffer[j];
-    for( ; j < rd && i < xend; ++j, ++i )
-      if( mbuffer[i] != buffer[j] ) { tail_mismatch = true; goto done; }
+    for( ; j < rd_size && i < end; ++j, ++i ) mbuffer[i] = buffer[j];
+    for( ; j < rd_size && i < xend; ++j, ++i )
+      if( mbuffer[i] != buffer[j] )
+        { tail_mismatch = true; abandoned = true; goto done; }
     }
 done:
   if( !first_post && terminator ) print_pending_newline( terminator );
+  /* Stop the compressor at once if its output has diverged, instead of
+     letting it compress the rest of the data until its next write fails. */
+  if( abandoned ) kill( pid2, SIGTERM );
   if( close( fda2[0] ) != 0 ) { show_close_error( "compressor" ); retval = 1; }
-  if( !good_status( pid, "data feeder", false ) ||
-      !good_status( pid2, lzip_argv[0], false ) ) retval = auto0 ? -1 : 1;
+  bool compressor_ok = true;		// exit status of a killed one is moot
+  if( abandoned ) wait_for_child( pid2, lzip_argv[0] );
+  else compressor_ok = good_status( pid2, lzip_argv[0], false );
+  compressor_pid = 0;
+  xjoin( feeder );
+  std::signal( SIGPIPE, old_handler );
+  if( !compressor_ok || !fa.ok ) retval = auto0 ? -1 : 1;
   if( retval == 0 )		// test whole member after reproduction
     {
     if( md5sump ) md5sump->reset();
-    LZ_mtester mtester( mbuffer, msize, dictionary_size, -1, md5sump );
+    LZ_mtester mtester( mbuffer, rd.msize, rd.dictionary_size, -1, md5sump );
     if( mtester.test_member() != 0 || !mtester.finished() )
       {
       if( verbosity >= 2 && same_ds && begin >= 4096 && terminator )
-        {
-        if( !tail_mismatch )
-          final_msg = "  Zeroed sector reproduced, but CRC does not match."
-                      " (Multiple damages in file?).\n";
-        else if( !final_msg )
-          final_msg = "  Zeroed sector reproduced, but data after it does not"
-                      " match. (Maybe wrong reference data or lzip version).\n";
-        }
+        set_final_msg( tail_mismatch ? tail_msg : crc_msg );
       retval = -1;		// incorrect reproduction of zeroed sector
       }
     }
@@ -421,13 +526,173 @@ done:
   }
 
 
+struct Attempt			// compressor options of a reproduction attempt
+  {
+  char option[8];		// compression level or match length limit
+  int len;			// match length limit, or 0 if level
+  bool auto0;			// level 0 not requested by the user
+  };
+
+void show_attempt( const Attempt & a, const char terminator )
+  {
+  if( verbosity >= 1 && terminator )
+    {
+    if( a.len == 0 ) std::printf( "Trying level %s %c", a.option, terminator );
+    else std::printf( "Trying match length limit %d %c", a.len, terminator );
+    std::fflush( stdout ); pending_newline = true;
+    }
+  }
+
+int run_attempt( const Repro_data & rd, const Attempt & a,
+                 const char * const lzip_name, const char * const dict_str,
+                 MD5SUM * const md5sump, const char terminator )
+  {
+  const bool level0 = ( a.len == 0 && a.option[1] == '0' );
+  const char * lzip_argv[4] = { lzip_name, a.option, dict_str, 0 };
+  if( level0 ) lzip_argv[2] = 0;	// use the dictionary size of level 0
+  return try_reproduce( rd, lzip_argv, md5sump, terminator, a.auto0 );
+  }
+
+
+struct Job			// reproduction attempt run in a child process
+  {
+  pid_t pid;
+  int fd;			// pipe from child
+  Job() : pid( 0 ), fd( -1 ) {}
+  };
+
+/* Result sent by a job through its pipe: return value of try_reproduce,
+   final message set, and fatal_retval; followed by the counters of the job
+   if --stats, and by the zeroed sector if the reproduction succeeded.
+   The counters of the jobs killed are lost. */
+enum { result_size = 3,
+       stats_size = st_counters * sizeof (unsigned long long) };
+
+bool start_job( Job & job, const Repro_data & rd, const Attempt & a,
+                const char * const lzip_name, const char * const dict_str,
+                const char terminator )
+  {
+  int fda[2];
+  if( pipe( fda ) < 0 )
+    { show_error( "Can't create pipe", errno ); return false; }
+  std::fflush( stdout );		// don't duplicate buffered output
+  const pid_t pid = fork();
+  if( pid == 0 )			// child (reproduction job)
+    {
+    std::signal( SIGTERM, job_term_handler );
+    close( fda[0] );
+    if( stats_enabled ) zero_stats();
+    show_progress = false; final_msg = 0;
+    const int ret = run_attempt( rd, a, lzip_name, dict_str, 0, terminator );
+    const uint8_t result[result_size] = { (uint8_t)( ret + 1 ),
+      (uint8_t)( ( final_msg == crc_final_msg ) ? crc_msg :
+                 ( final_msg == tail_final_msg ) ? tail_msg : no_msg ),
+      (uint8_t)fatal_retval };
+    const long size = rd.end - rd.begin;
+    std::fflush( stdout );
+    unsigned long long stats[st_counters];
+    if( stats_enabled ) get_stats( stats );
+    if( writeblock( fda[1], result, result_size ) != result_size ||
+        ( stats_enabled &&
+          writeblock( fda[1], (const uint8_t *)stats, stats_size ) !=
+          stats_size ) ||
+        ( ret == 0 &&
+          writeblock( fda[1], rd.mbuffer + rd.begin, size ) != size ) )
+      _exit( 2 );
+    _exit( 0 );
+    }
+  if( pid < 0 )
+    { show_fork_error( "reproduction job" ); close( fda[0] ); close( fda[1] );
+      return false; }
+  stat_add( st_children );
+  close( fda[1] );
+  job.pid = pid; job.fd = fda[0];
+  return true;
+  }
+
+void kill_job( Job & job )
+  {
+  if( job.pid <= 0 ) return;
+  close( job.fd ); kill( job.pid, SIGTERM );	// the job kills its lzip
+  wait_for_child( job.pid, "reproduction job" ); job.pid = 0;
+  }
+
+// Return value: like try_reproduce.
+int finish_job( Job & job, const Repro_data & rd )
+  {
+  uint8_t result[result_size];
+  const long size = rd.end - rd.begin;
+  bool error = true;
+  int ret = 1;
+  if( readblock( job.fd, result, result_size ) == result_size )
+    {
+    ret = (int)result[0] - 1;
+    set_final_msg( result[1] );
+    if( result[2] ) fatal( result[2] );
+    error = false;
+    unsigned long long stats[st_counters];
+    if( stats_enabled )
+      {
+      if( readblock( job.fd, (uint8_t *)stats, stats_size ) == stats_size )
+        add_stats( stats );
+      else error = true;
+      }
+    if( !error && ret == 0 &&
+        readblock( job.fd, rd.mbuffer + rd.begin, size ) != size ) error = true;
+    }
+  close( job.fd );
+  if( wait_for_child( job.pid, "reproduction job" ) != 0 ) error = true;
+  job.pid = 0;
+  if( error )
+    { show_error( "Reproduction job terminated with error status." );
+      ret = fatal( 1 ); }
+  return ret;
+  }
+
+
+/* Run the attempts concurrently in up to 'workers' child processes, but
+   check their results in order, so that the first attempt that succeeds
+   (or fails fatally) is the same as in the serial search. The attempts
+   following it are killed. */
+int run_attempts_mt( const Repro_data & rd,
+                     const std::vector< Attempt > & attempts,
+                     const char * const lzip_name, const char * const dict_str,
+                     MD5SUM * const md5sump, const char terminator,
+                     const int workers )
+  {
+  const int attempts_size = attempts.size();
+  std::vector< Job > jobs( attempts_size );
+  int next = 0;				// next attempt to be started
+  int ret = 2;
+  for( int k = 0; k < attempts_size; ++k )
+    {
+    for( ; next < attempts_size && next < k + workers; ++next )
+      if( !start_job( jobs[next], rd, attempts[next], lzip_name, dict_str,
+                      terminator ) ) break;
+    show_attempt( attempts[k], terminator );
+    if( next <= k ) { ret = fatal( 1 ); break; }	// can't start job
+    ret = finish_job( jobs[k], rd );
+    if( ret >= 0 ) break;
+    ret = 2;
+    }
+  for( int k = 0; k < next; ++k ) kill_job( jobs[k] );
+  if( ret == 0 && md5sump )		// compute md5 of reproduced member
+    {
+    md5sump->reset();
+    LZ_mtester mtester( rd.mbuffer, rd.msize, rd.dictionary_size, -1, md5sump );
+    mtester.test_member();
+    }
+  return ret;
+  }
+
+
 // Return value: -1 = master failed, 0 = success, > 0 = failure
 int reproduce_member( uint8_t * const mbuffer, const long msize,
                       const long long dsize, const char * const lzip_name,
                       const char * const reference_filename,
                       const long begin, const long size,
                       const int lzip_level, MD5SUM * const md5sump,
-                      const char terminator )
+                      const char terminator, const int num_workers )
   {
   struct stat st;
   const int rfd = open_instream( reference_filename, &st, false, true );
@@ -465,51 +730,56 @@ int reproduce_member( uint8_t * const mbuffer, const long msize,
       delete master; return 2; }
 
   const unsigned long long good_dsize = master->data_position();
-  const long end = begin + size;
-  char level_str[8] = "-0";	// compression level or match length limit
-  char dict_str[16];
-  snprintf( dict_str, sizeof dict_str, "-s%u", dictionary_size );
-  const char * lzip0_argv[3] = { lzip_name, "-0", 0 };
-  const char * lzip_argv[4] = { lzip_name, level_str, dict_str, 0 };
+  delete master;
+  uint8_t * const prefix =
+    cache_prefix( mbuffer, msize, good_dsize, dictionary_size );
+  Repro_data rd;
+  rd.mbuffer = mbuffer; rd.msize = msize; rd.dsize = dsize;
+  rd.prefix = prefix; rd.good_dsize = good_dsize;
+  rd.begin = begin; rd.end = begin + size;
+  rd.rbuf = rbuf; rd.rsize = rsize; rd.offset = offset;
+  rd.dictionary_size = dictionary_size;
+
+  std::vector< Attempt > attempts;
+  Attempt a;
   if( lzip_level >= 0 )
     for( unsigned char level = '0'; level <= '9'; ++level )
       {
       if( std::isdigit( lzip_level ) && level != lzip_level ) continue;
-      level_str[1] = level;
-      if( verbosity >= 1 && terminator )
-        {
-        std::printf( "Trying level %s %c", level_str, terminator );
-        std::fflush( stdout ); pending_newline = true;
-        }
-      const bool level0 = level == '0';
-      const bool auto0 = ( level0 && lzip_level != '0' );
-      int ret = try_reproduce( mbuffer, msize, dsize, good_dsize, begin, end,
-                               rbuf, rsize, offset, dictionary_size,
-                level0 ? lzip0_argv : lzip_argv, md5sump, terminator, auto0 );
-      if( ret >= 0 )
-        { delete master; munmap( (void *)rbuf, rsize ); return ret; }
+      snprintf( a.option, sizeof a.option, "-%c", level );
+      a.len = 0; a.auto0 = ( level == '0' && lzip_level != '0' );
+      attempts.push_back( a );
       }
   if( lzip_level <= 0 )
-    {
     for( int len = min_match_len_limit; len <= max_match_len; ++len )
       {
       if( lzip_level < -1 && -lzip_level != len ) continue;
-      snprintf( level_str, sizeof level_str, "-m%u", len );
-      if( verbosity >= 1 && terminator )
-        {
-        std::printf( "Trying match length limit %d %c", len, terminator );
-        std::fflush( stdout ); pending_newline = true;
-        }
-      int ret = try_reproduce( mbuffer, msize, dsize, good_dsize, begin, end,
-                               rbuf, rsize, offset, dictionary_size,
-                               lzip_argv, md5sump, terminator );
-      if( ret >= 0 )
-        { delete master; munmap( (void *)rbuf, rsize ); return ret; }
+      snprintf( a.option, sizeof a.option, "-m%u", len );
+      a.len = len; a.auto0 = false;
+      attempts.push_back( a );
       }
-    }
-  delete master;
+
+  char dict_str[16];
+  snprintf( dict_str, sizeof dict_str, "-s%u", dictionary_size );
+  int ret = 2;
+  // each attempt runs a data feeder and lzip with its own dictionary
+  const int workers = limit_workers( std::min( num_workers,
+                        (int)attempts.size() ), 2ULL * dictionary_size );
+  if( workers > 1 )
+    ret = run_attempts_mt( rd, attempts, lzip_name, dict_str, md5sump,
+                           terminator, workers );
+  else
+    for( unsigned k = 0; k < attempts.size(); ++k )
+      {
+      show_attempt( attempts[k], terminator );
+      ret = run_attempt( rd, attempts[k], lzip_name, dict_str, md5sump,
+                         terminator );
+      if( ret >= 0 ) break;
+      ret = 2;
+      }
+  delete[] prefix;
   munmap( (void *)rbuf, rsize );
-  return 2;
+  return ret;
   }
 
 } // end namespace
@@ -520,7 +790,8 @@ int reproduce_file( const std::string & input_filename,
                     const char * const lzip_name,
                     const char * const reference_filename,
                     const Cl_options & cl_opts, const int lzip_level,
-                    const char terminator, const bool force )
+                    const char terminator, const bool force,
+                    const int num_workers )
   {
   const char * const filename = input_filename.c_str();
   struct stat in_stats;
@@ -585,7 +856,8 @@ int reproduce_file( const std::string & input_filename,
       std::fflush( stdout );
       }
     const int ret = reproduce_member( mbuffer, msize, dsize, lzip_name,
-                  reference_filename, begin, size, lzip_level, 0, terminator );
+                  reference_filename, begin, size, lzip_level, 0, terminator,
+                  num_workers );
     if( ret <= 0 ) print_pending_newline( terminator );
     if( ret < 0 ) { show_error( "Can't prepare master." ); return 1; }
     if( ret == 0 )
@@ -639,7 +911,8 @@ int debug_reproduce_file( const char * const input_filename,
                           const char * const lzip_name,
                           const char * const reference_filename,
                           const Cl_options & cl_opts, const Block & range,
-                          const int sector_size, const int lzip_level )
+                          const int sector_size, const int lzip_level,
+                          const int num_workers )
   {
   struct stat in_stats;				// not used
   const int infd = open_instream( input_filename, &in_stats, false, true );
@@ -722,7 +995,8 @@ int debug_reproduce_file( const char * const input_filename,
       if( begin < 0 ) return 2;
       MD5SUM md5sum;
       const int ret = reproduce_member( mbuffer, msize, dsize, lzip_name,
-                    reference_filename, begin, size, lzip_level, &md5sum, 0 );
+                    reference_filename, begin, size, lzip_level, &md5sum, 0,
+                    num_workers );
       if( ret < 0 ) { show_error( "Can't prepare master." ); return 1; }
       if( ret == 0 )
         {
@@ -0,0 +1,24 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 16-byte vectors of GCC and clang, compiled as SSE2 on x86-64, NEON on
+   aarch64, or plain code elsewhere. Requires stdint.h. */
+#if defined __GNUC__ && ( __GNUC__ >= 5 || defined __clang__ )
+#define VECTOR16
+typedef uint8_t v16u8 __attribute__(( vector_size( 16 ) ));
+typedef uint32_t v4u32 __attribute__(( vector_size( 16 ) ));
+#endif
@@ -0,0 +1,166 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "lzip.h"
+
+
+bool stats_enabled = false;
+
+namespace {
+
+// names of the counters in the JSON output, in the order of Stat_counter
+const char * const counter_names[st_counters] = {
+  "bytes_read", "bytes_written", "masters_prepared", "master_bytes_decoded",
+  "master_time_us", "trials", "trial_bytes_decoded", "failed_trials",
+  "failed_trial_bytes_decoded", "buffer_copies", "buffer_bytes_copied",
+  "copy_file_bytes", "child_processes", "dictionaries_allocated",
+  "dictionaries_reused" };
+
+unsigned long long counters[st_counters];
+pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long start_us;
+int stats_fd = -1;
+bool child_stats = false;	// print raw counters for add_child_stats
+
+
+extern "C" void print_stats()
+  {
+  char buf[1024];
+  int len = 0;
+  if( child_stats )
+    {
+    pthread_mutex_lock( &stats_mutex );
+    for( int i = 0; i < st_counters && len < (int)sizeof buf; ++i )
+      len += std::snprintf( buf + len, sizeof buf - len, "%llu\n",
+                            counters[i] );
+    pthread_mutex_unlock( &stats_mutex );
+    }
+  else len = std::snprintf( buf, sizeof buf, "{ \"program\": \"%s\", "
+                           "\"elapsed_time_us\": %llu", program_name,
+                           stat_time_us() - start_us );
+  if( !child_stats )
+    {
+    pthread_mutex_lock( &stats_mutex );
+    for( int i = 0; i < st_counters && len < (int)sizeof buf; ++i )
+      len += std::snprintf( buf + len, sizeof buf - len, ", \"%s\": %llu",
+                            counter_names[i], counters[i] );
+    pthread_mutex_unlock( &stats_mutex );
+    if( len < (int)sizeof buf )
+      len += std::snprintf( buf + len, sizeof buf - len, " }\n" );
+    }
+  if( len >= (int)sizeof buf ) len = sizeof buf - 1;
+  // write directly, as the output must not be counted nor buffered
+  for( int sz = 0; sz < len; )
+    {
+    const int n = write( stats_fd, buf + sz, len - sz );
+    if( n <= 0 ) break;
+    sz += n;
+    }
+  }
+
+} // end namespace
+
+
+void stat_add_locked( const Stat_counter counter, const unsigned long long n )
+  {
+  pthread_mutex_lock( &stats_mutex );
+  counters[counter] += n;
+  pthread_mutex_unlock( &stats_mutex );
+  }
+
+
+unsigned long long stat_time_us()
+  {
+  struct timeval tv;
+  gettimeofday( &tv, 0 );
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+  }
+
+
+/* Start counting, and print the counters in JSON format to fd at exit.
+   Child processes exiting with _exit don't print them. */
+void enable_stats( const int fd )
+  {
+  if( stats_enabled ) { stats_fd = fd; return; }
+  stats_enabled = true;
+  stats_fd = fd;
+  start_us = stat_time_us();
+  std::atexit( print_stats );
+  }
+
+
+// Make a child process count from zero the counters sent to its parent.
+void zero_stats()
+  {
+  pthread_mutex_lock( &stats_mutex );
+  std::memset( counters, 0, sizeof counters );
+  pthread_mutex_unlock( &stats_mutex );
+  }
+
+
+// Copy the st_counters counters to buf.
+void get_stats( unsigned long long buf[] )
+  {
+  pthread_mutex_lock( &stats_mutex );
+  std::memcpy( buf, counters, sizeof counters );
+  pthread_mutex_unlock( &stats_mutex );
+  }
+
+
+// Add the st_counters counters in buf, sent by a child process.
+void add_stats( const unsigned long long buf[] )
+  {
+  pthread_mutex_lock( &stats_mutex );
+  for( int i = 0; i < st_counters; ++i ) counters[i] += buf[i];
+  pthread_mutex_unlock( &stats_mutex );
+  }
+
+
+/* Make a child process started by '--jobs' count from zero and print at
+   exit its raw counters to fd, to be added by the parent. */
+void set_child_stats( const int fd )
+  {
+  if( !stats_enabled ) return;
+  zero_stats();
+  stats_fd = fd;
+  child_stats = true;
+  }
+
+
+// Add the counters printed by a child process to f, and close f.
+void add_child_stats( FILE * const f )
+  {
+  if( !f ) return;
+  std::rewind( f );
+  unsigned long long buf[st_counters] = { 0 };
+  for( int i = 0; i < st_counters && std::fscanf( f, "%llu", &buf[i] ) == 1;
+       ++i ) {}
+  add_stats( buf );
+  std::fclose( f );
+  }
@@ -0,0 +1,152 @@
+#! /bin/sh
+# benchmark script for Lziprecover - Data recovery tool for the lzip format
+# Copyright (C) 2009-2024 Antonio Diaz Diaz.
+#
+# This script is free software: you have unlimited permission
+# to copy, distribute, and modify it.
+#
+# Usage: bench.sh <testdir> <version> [repeats]
+# Print to standard output one CSV line per benchmark with the fields
+# benchmark,version,unit,amount,seconds,rate
+# where 'seconds' is the minimum time of 'repeats' runs (default 3), and
+# 'rate' is amount/seconds.
+
+LC_ALL=C
+export LC_ALL
+objdir=`pwd`
+testdir=`cd "$1" ; pwd`
+version="$2"
+repeats="${3:-3}"
+LZIPRECOVER="${objdir}"/lziprecover
+framework_failure() { echo "failure in benchmark framework" 1>&2 ; exit 1 ; }
+
+if [ ! -f "${LZIPRECOVER}" ] || [ ! -x "${LZIPRECOVER}" ] ; then
+	echo "${LZIPRECOVER}: cannot execute" 1>&2
+	exit 1
+fi
+
+case `date +%N` in
+	[0-9]*) ;;
+	*) echo "$0: 'date +%N' is required to run the benchmarks" 1>&2
+	   exit 1 ;;
+esac
+
+if [ -d tmpbench ] ; then rm -rf tmpbench ; fi
+mkdir tmpbench
+cd "${objdir}"/tmpbench || framework_failure
+
+in_lz="${testdir}"/test.txt.lz
+fox_lz="${testdir}"/fox.lz
+now() { date +%s%N ; }
+
+# min_time <command>...
+# Run the command 'repeats' times and set 'secs' to the minimum time.
+min_time() {
+	best=
+	rep=0
+	while [ ${rep} -lt ${repeats} ] ; do
+		t0=`now`
+		"$@" > /dev/null 2>&1
+		t1=`now`
+		t=`expr $t1 - $t0`
+		if [ -z "${best}" ] || [ $t -lt ${best} ] ; then best=$t ; fi
+		rep=`expr ${rep} + 1`
+	done
+	secs=`awk "BEGIN { printf \"%.6f\", ${best} / 1000000000 }"`
+}
+
+# report <benchmark> <unit> <amount>
+report() {
+	awk "BEGIN { s = ${secs} ; if( s <= 0 ) s = 0.000001 ;
+	printf \"%s,%s,%s,%s,${secs},%.1f\\n\", \"$1\", \"${version}\", \"$2\", $3, $3 / s }"
+}
+
+# set_ds <file> <coded dictionary size> <single-member file>
+# Copy the file changing the dictionary size in the header. The data
+# decode the same with any dictionary size larger than the original.
+set_ds() {
+	{ printf "LZIP\001$2" ; dd if="$3" bs=6 skip=1 2> /dev/null ; } > "$1" ||
+		framework_failure
+}
+
+echo "benchmark,version,unit,amount,seconds,rate"
+
+# decoding speed of LZ_decoder on a multimember file
+i=0 ; : > in100.lz
+while [ $i -lt 100 ] ; do cat "${in_lz}" >> in100.lz ; i=`expr $i + 1` ; done
+dsize=`expr 100 \* \`wc -c < "${testdir}"/test.txt\``
+min_time "${LZIPRECOVER}" -t in100.lz
+report decode_test MB `awk "BEGIN { print ${dsize} / 1000000 }"`
+min_time "${LZIPRECOVER}" -cd in100.lz
+report decode_stdout MB `awk "BEGIN { print ${dsize} / 1000000 }"`
+
+# trials per second of LZ_mtester with several dictionary sizes, on a
+# corpus of 35 MB (larger than all the dictionaries, so that they wrap)
+# compressed with a 64 KiB dictionary by lzip or, if not found, by xz
+i=0 ; : > big
+while [ $i -lt 960 ] ; do cat "${testdir}"/test.txt >> big ; i=`expr $i + 1` ; done
+if [ -z "${LZIP_NAME}" ] ; then LZIP_NAME=lzip ; fi
+if /bin/sh -c "${LZIP_NAME} -0" < big > big.lz 2> /dev/null ||
+   { xz --format=lzma --lzma1=preset=0,dict=64KiB < big > big.lzma 2> /dev/null &&
+     "${LZIPRECOVER}" -A -f big.lzma 2> /dev/null ; } ; then
+for ds in 64KiB:\\020 1MiB:\\024 8MiB:\\027 32MiB:\\031 ; do
+	name=`echo ${ds} | sed -e 's/:.*//'`
+	set_ds in_ds.lz `echo ${ds} | sed -e 's/.*://'` big.lz
+	"${LZIPRECOVER}" -t in_ds.lz 2> /dev/null || framework_failure
+	trials=`"${LZIPRECOVER}" -U1 -v in_ds.lz 2>&1 |
+	        sed -n -e 's/^ *\([0-9]*\) total decompressions.*/\1/p'`
+	[ -n "${trials}" ] || framework_failure
+	min_time "${LZIPRECOVER}" -q -U1 in_ds.lz
+	report mtester_trials_${name} trials ${trials}
+done
+else
+	echo "$0: skipping mtester_trials: neither ${LZIP_NAME} nor xz found" 1>&2
+fi
+rm -f big big.lz big.lzma in_ds.lz
+
+# positions per second tried by --byte-repair on a file with one byte
+# changed at several distances from the end of the member
+for pos in 1000 3000 6000 ; do
+	byte=`od -An -tu1 -j${pos} -N1 "${in_lz}"`
+	byte=`printf "%03o" \`expr \( ${byte} + 1 \) % 256\``
+	{ dd if="${in_lz}" bs=${pos} count=1 2> /dev/null ; printf "\\${byte}" ;
+	  dd if="${in_lz}" bs=1 skip=`expr ${pos} + 1` 2> /dev/null ; } > bad.lz ||
+		framework_failure
+	positions=`"${LZIPRECOVER}" -R -vv -f -o out.lz bad.lz 2>&1 |
+	           tr '\r' '\n' | grep -c 'Trying position'`
+	[ "${positions}" -gt 0 ] || framework_failure
+	min_time "${LZIPRECOVER}" -R -f -o out.lz bad.lz
+	report byte_repair_${pos} positions ${positions}
+done
+rm -f bad.lz out.lz
+
+# variations per second tried by --merge
+# bench_merge <benchmark> <file>...
+bench_merge() {
+	name="$1" ; shift
+	variations=`"${LZIPRECOVER}" -m -vv -f -o out.lz "$@" 2>&1 |
+	            tr '\r' '\n' | grep -c 'Trying variation'`
+	[ "${variations}" -gt 0 ] || framework_failure
+	min_time "${LZIPRECOVER}" -m -f -o out.lz "$@"
+	report "${name}" variations ${variations}
+}
+bench_merge merge_bad1_bad2 "${testdir}"/test_bad1.lz "${testdir}"/test_bad2.lz
+bench_merge merge_bad3_bad4_bad5 "${testdir}"/test_bad3.lz \
+  "${testdir}"/test_bad4.lz "${testdir}"/test_bad5.lz
+rm -f out.lz
+
+# index build time for a file with many members
+cat "${fox_lz}" "${fox_lz}" "${fox_lz}" "${fox_lz}" > fox4.lz
+cat fox4.lz fox4.lz fox4.lz fox4.lz fox4.lz > fox20.lz
+cat fox20.lz fox20.lz fox20.lz fox20.lz fox20.lz > fox100.lz
+i=0 ; : > fox10k.lz
+while [ $i -lt 100 ] ; do cat fox100.lz >> fox10k.lz ; i=`expr $i + 1` ; done
+rm -f fox4.lz fox20.lz fox100.lz
+min_time "${LZIPRECOVER}" -l fox10k.lz
+report index_list members 10000
+printf "garbage" >> fox10k.lz
+min_time "${LZIPRECOVER}" -l -i fox10k.lz
+report index_list_gaps members 10000
+
+cd "${objdir}" && rm -r tmpbench
+exit 0
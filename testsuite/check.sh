@@ -243,7 +243,20 @@ rm -f out.lz || framework_failure
 cmp "${in_lz}" out.lz || test_failed $LINENO
 "${LZIPRECOVER}" -A < "${in_lzma}" > out.lz || test_failed $LINENO
 cmp "${in_lz}" out.lz || test_failed $LINENO
+cat "${in_lzma}" | "${LZIPRECOVER}" -A > out.lz || test_failed $LINENO
+cmp "${in_lz}" out.lz || test_failed $LINENO
 rm -f out.lz || framework_failure
+for i in 13 14 5000 ; do
+	dd if="${in_lzma}" of=trunc.lzma bs=$i count=1 2> /dev/null
+	"${LZIPRECOVER}" -Acq trunc.lzma > out.lz
+	[ $? = 2 ] || test_failed $LINENO $i
+	cat trunc.lzma | "${LZIPRECOVER}" -Aq > out.lz
+	[ $? = 2 ] || test_failed $LINENO $i
+done
+cat "${in_lzma}" in > trunc.lzma || framework_failure
+"${LZIPRECOVER}" -Acq trunc.lzma > out.lz
+[ $? = 2 ] || test_failed $LINENO
+rm -f trunc.lzma out.lz || framework_failure
 cat "${in_lzma}" > out.lzma || framework_failure
 "${LZIPRECOVER}" -Ak out.lzma || test_failed $LINENO
 cmp "${in_lz}" out.lz || test_failed $LINENO
@@ -293,6 +306,22 @@ lines=`"${LZIP}" -lvv "${in_em}" | wc -l` || test_failed $LINENO
 [ "${lines}" -eq 11 ] || test_failed $LINENO "${lines}"
 "${LZIP}" -lq "${in_em}" --empty-error
 [ $? = 2 ] || test_failed $LINENO
+mkdir cache || framework_failure
+"${LZIP}" -lvv "${in_em}" > out || test_failed $LINENO
+"${LZIP}" -lvv --index-cache=cache "${in_em}" > copy || test_failed $LINENO
+cmp out copy || test_failed $LINENO
+"${LZIP}" -lvv --index-cache=cache "${in_em}" > copy || test_failed $LINENO
+cmp out copy || test_failed $LINENO
+"${LZIP}" -lq --index-cache=cache "${in_em}" --empty-error
+[ $? = 2 ] || test_failed $LINENO
+rm -rf cache out copy || framework_failure
+"${LZIP}" -lvv "${in_em}" "${in_lz}" "${fox_lz}" "${in_em}" "${f6s1_lz}" \
+  "${in_lz}" > out || test_failed $LINENO
+"${LZIP}" -n3 -lvv "${in_em}" "${in_lz}" "${fox_lz}" "${in_em}" "${f6s1_lz}" \
+  "${in_lz}" | cmp out - || test_failed $LINENO
+"${LZIP}" -n2 -lq "${in_lz}" nx_file.lz "${in_lz}"
+[ $? = 1 ] || test_failed $LINENO
+rm -f out || framework_failure
 
 cat "${in_lz}" > out.lz || framework_failure
 "${LZIP}" -dk out.lz || test_failed $LINENO
@@ -405,6 +434,10 @@ cmp "${inD}" out || test_failed $LINENO
 cmp "${inD}" out || test_failed $LINENO
 "${LZIPRECOVER}" -D 21723,397 "${in_em}" > out || test_failed $LINENO
 cmp "${inD}" out || test_failed $LINENO
+"${LZIPRECOVER}" -n3 -D 21723,397 "${in_em}" > out || test_failed $LINENO
+cmp "${inD}" out || test_failed $LINENO
+"${LZIPRECOVER}" -n2 -D 0 "${in_em}" > out || test_failed $LINENO
+cmp in out || test_failed $LINENO
 "${LZIPRECOVER}" -q -D 21723,397 --empty-error "${in_em}"
 [ $? = 2 ] || test_failed $LINENO
 "${LZIP}" -D 0 "${in_lz}" -o a/b/c/out || test_failed $LINENO
@@ -426,6 +459,14 @@ cmp -s "${fox6_lz}" f6mk.lz && test_failed $LINENO
 cmp "${fox6_lz}" f6mk.lz || test_failed $LINENO
 cmp "${fox6_lz}" f6mk2.lz || test_failed $LINENO
 rm -f f6mk.lz f6mk2.lz || framework_failure
+# trailing data containing a consistent trailer of a member with marking
+cat "${fox_lz}" > fm.lz || framework_failure
+printf "ABCDEFGHIJKLMNOPQRST\001\002\003\004\144\000\000\000\000\000" >> fm.lz
+printf "\000\000\050\000\000\000\000\000\000\000xyz" >> fm.lz
+"${LZIP}" -l fm.lz > /dev/null || test_failed $LINENO
+"${LZIP}" -lq fm.lz --marking-error
+[ $? = 2 ] || test_failed $LINENO
+rm -f fm.lz || framework_failure
 
 "${LZIP}" -d "${fox_lz}" -o a/b/c/fox || test_failed $LINENO
 cmp fox a/b/c/fox || test_failed $LINENO
@@ -525,6 +566,55 @@ rm -f fox out || framework_failure
 
 cat "${in_lz}" "${in_lz}" > in2.lz || framework_failure
 cat "${in_lz}" "${in_lz}" "${in_lz}" > in3.lz || framework_failure
+cat in in in > in3 || framework_failure
+"${LZIP}" -n2 -t in3.lz || test_failed $LINENO
+"${LZIP}" -n4 -cd in3.lz > out || test_failed $LINENO
+cmp in3 out || test_failed $LINENO
+"${LZIPRECOVER}" --async-io=4096 -cd in3.lz > out || test_failed $LINENO
+cmp in3 out || test_failed $LINENO
+"${LZIPRECOVER}" --async-io=4096 -d < in3.lz > out || test_failed $LINENO
+cmp in3 out || test_failed $LINENO
+"${LZIPRECOVER}" --stats -cd in3.lz > out 2> err || test_failed $LINENO
+cmp in3 out || test_failed $LINENO
+grep -q '"bytes_read": 22128,' err || test_failed $LINENO
+"${LZIPRECOVER}" -t --stats=1 in3.lz > out || test_failed $LINENO
+grep -q '"bytes_written": 0,' out || test_failed $LINENO
+"${LZIPRECOVER}" -n4 --memory-limit=1 -cd in3.lz > out || test_failed $LINENO
+cmp in3 out || test_failed $LINENO
+rm -f out || framework_failure
+"${LZIPRECOVER}" --mmap-io -d -o out in3.lz || test_failed $LINENO
+cmp in3 out || test_failed $LINENO
+"${LZIPRECOVER}" --mmap-io -n2 -df -o out "${in_lz}" || test_failed $LINENO
+cmp in out || test_failed $LINENO
+"${LZIPRECOVER}" -q --mmap-io -df -o out "${f6b1_lz}"
+[ $? = 2 ] || test_failed $LINENO
+[ ! -e out ] || test_failed $LINENO
+"${LZIPRECOVER}" -t --stats=1 in3.lz in3.lz > out || test_failed $LINENO
+grep -q '"dictionaries_reused": [1-9]' out || test_failed $LINENO
+"${LZIPRECOVER}" -t --digests in3.lz > out || test_failed $LINENO
+[ "`grep -c '^a517ae61980eda22f4e1bc281a430054  A2930E54  in3.lz:[1-3]$' out`" = 3 ] ||
+	test_failed $LINENO
+"${LZIPRECOVER}" -cd --digests=digests in3.lz > out || test_failed $LINENO
+cmp in3 out || test_failed $LINENO
+"${LZIPRECOVER}" -n2 -t --digests in3.lz | cmp - digests ||
+	test_failed $LINENO
+[ "`sed -n '4p' digests | cut -c45-`" = "in3.lz" ] || test_failed $LINENO
+rm -f digests || framework_failure
+rm -f err || framework_failure
+rm -f in3 out || framework_failure
+for i in "${f6b1_lz}" "${f6b4_lz}" "${f6b6_lz}" ; do
+	"${LZIPRECOVER}" -cd -i "$i" > out 2> err
+	"${LZIPRECOVER}" -n4 -cd -i "$i" > out2 2> err2
+	cmp out out2 || test_failed $LINENO "$i"
+	cmp err err2 || test_failed $LINENO "$i"
+	"${LZIPRECOVER}" --async-io=5000 -cd -i "$i" > out2 2> err2
+	cmp out out2 || test_failed $LINENO "$i"
+	cmp err err2 || test_failed $LINENO "$i"
+	"${LZIP}" -tv "$i" 2> err
+	"${LZIP}" -n3 -tv "$i" 2> err2
+	cmp err err2 || test_failed $LINENO "$i"
+done
+rm -f out out2 err err2 || framework_failure
 if dd if=in3.lz of=trunc.lz bs=14752 count=1 2> /dev/null &&
    [ -e trunc.lz ] && cmp in2.lz trunc.lz > /dev/null 2>&1 ; then
 	for i in 6 20 14734 14753 14754 14755 14756 14757 14758 ; do
@@ -583,6 +673,11 @@ cmp -s "${f6b1}" out && test_failed $LINENO
 "${LZIPRECOVER}" -D0 -q "${f6b1_lz}" > out
 [ $? = 2 ] || test_failed $LINENO
 cmp -s "${f6b1}" out && test_failed $LINENO
+"${LZIPRECOVER}" -D0 -q "${f6b1_lz}" > copy
+"${LZIPRECOVER}" -n4 -D0 -q "${f6b1_lz}" > out
+[ $? = 2 ] || test_failed $LINENO
+cmp copy out || test_failed $LINENO
+rm -f copy || framework_failure
 "${LZIPRECOVER}" -D0 -iq "${f6b1_lz}" -fo out || test_failed $LINENO
 cmp "${f6b1}" out || test_failed $LINENO
 "${LZIPRECOVER}" -D0 -iq "${f6b1_lz}" > out || test_failed $LINENO
@@ -674,6 +769,18 @@ done
 "${LZIPRECOVER}" -mf -o out.lz "${f6b3_lz}" "${f6b4_lz}" "${f6b5_lz}" ||
 	test_failed $LINENO
 cmp "${fox6_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -n3 -mf -o out.lz "${f6b3_lz}" "${f6b4_lz}" "${f6b5_lz}" ||
+	test_failed $LINENO
+cmp "${fox6_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -n2 -mf -o out.lz "${bad1_lz}" "${bad4_lz}" ||
+	test_failed $LINENO
+cmp "${in_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -n4 -mf -o out.lz "${f6b1_lz}" "${f6b2_lz}" "${f6b3_lz}" ||
+	test_failed $LINENO
+cmp "${fox6_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -n4 -mf -o out.lz "${f6b3_lz}" "${f6b5_lz}" -q
+[ $? = 2 ] || test_failed $LINENO
+[ ! -e out.lz ] || test_failed $LINENO
 "${LZIPRECOVER}" -mf -o out.lz "${f6b1_lz}" "${f6b3_lz}" "${f6b4_lz}" \
 	"${f6b5_lz}" || test_failed $LINENO
 cmp "${fox6_lz}" out.lz || test_failed $LINENO
@@ -688,6 +795,16 @@ cmp "${fox6_lz}" out.lz || test_failed $LINENO
 cmp "${in_lz}" out.lz || test_failed $LINENO
 "${LZIPRECOVER}" -mf -o out.lz "${bad2_lz}" "${bad1_lz}" || test_failed $LINENO
 cmp "${in_lz}" out.lz || test_failed $LINENO
+# merge from the files if the copies of the members don't fit in memory
+"${LZIPRECOVER}" --memory-limit=1 -mf -o out.lz "${bad1_lz}" "${bad2_lz}" ||
+	test_failed $LINENO
+cmp "${in_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -n4 --memory-limit=1 -mf -o out.lz "${f6b1_lz}" "${f6b2_lz}" \
+	"${f6b3_lz}" || test_failed $LINENO
+cmp "${fox6_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" --memory-limit=1 -mf -o out.lz "${f6b3_lz}" "${f6b5_lz}" -q
+[ $? = 2 ] || test_failed $LINENO
+[ ! -e out.lz ] || test_failed $LINENO
 
 cat "${in_lz}" "${in_lz}" "${in_lz}" "${in_lz}" > in4.lz || framework_failure
 cat "${bad1_lz}" "${in_lz}" "${bad1_lz}" "${bad1_lz}" > bad11.lz || framework_failure
@@ -778,6 +895,20 @@ rm -f out.lz || framework_failure
 cmp "${fox6_lz}" out.lz || test_failed $LINENO
 "${LZIPRECOVER}" -Rf -o out.lz "${bad1_lz}" || test_failed $LINENO
 cmp "${in_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -n4 -Rf -o out.lz "${f6b1_lz}" || test_failed $LINENO
+cmp "${fox6_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -n3 -Rf -o out.lz "${bad1_lz}" || test_failed $LINENO
+cmp "${in_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -n2 -Rf -o out.lz "${bad2_lz}" -q
+[ $? = 2 ] || test_failed $LINENO
+"${LZIPRECOVER}" -Rf --repair-strategy=bytes -o out.lz "${f6b1_lz}" ||
+	test_failed $LINENO
+cmp "${fox6_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -n2 -Rf --repair-strategy=bytes -o out.lz "${bad1_lz}" ||
+	test_failed $LINENO
+cmp "${in_lz}" out.lz || test_failed $LINENO
+"${LZIPRECOVER}" -q -Rf --repair-strategy=bit -o out.lz "${bad1_lz}"
+[ $? = 1 ] || test_failed $LINENO
 "${LZIPRECOVER}" -R -o a/b/c/out.lz "${bad1_lz}" || test_failed $LINENO
 cmp "${in_lz}" a/b/c/out.lz || test_failed $LINENO
 rm -rf a || framework_failure
@@ -794,8 +925,74 @@ mv out.tar.lz out.tlz || framework_failure
 rm -f out.tlz out_fixed.lz out_fixed.tar.lz out_fixed.tlz ||
 	framework_failure
 
+cat "${f6b1_lz}" > out.lz || framework_failure
+cat "${bad1_lz}" > copy.lz || framework_failure
+"${LZIPRECOVER}" --jobs=2 -R out.lz copy.lz || test_failed $LINENO
+cmp "${fox6_lz}" out_fixed.lz || test_failed $LINENO
+cmp "${in_lz}" copy_fixed.lz || test_failed $LINENO
+rm -f out_fixed.lz copy_fixed.lz || framework_failure
+"${LZIPRECOVER}" -q --jobs=2 --memory-limit=1 -R out.lz "${bad2_lz}" copy.lz
+[ $? = 2 ] || test_failed $LINENO
+cmp "${fox6_lz}" out_fixed.lz || test_failed $LINENO
+cmp "${in_lz}" copy_fixed.lz || test_failed $LINENO
+"${LZIPRECOVER}" -q -R -o out2.lz out.lz copy.lz
+[ $? = 1 ] || test_failed $LINENO
+[ ! -e out2.lz ] || test_failed $LINENO
+"${LZIPRECOVER}" --jobs=2 -t out_fixed.lz copy_fixed.lz "${fox6_lz}" ||
+	test_failed $LINENO
+"${LZIPRECOVER}" -q --jobs=3 -t out_fixed.lz out.lz copy_fixed.lz
+[ $? = 2 ] || test_failed $LINENO
+"${LZIPRECOVER}" --jobs=2 --stats=1 -t out_fixed.lz copy_fixed.lz \
+	"${fox6_lz}" > out || test_failed $LINENO
+[ "`grep -c '"program"' out`" = 1 ] || test_failed $LINENO
+grep -q '"child_processes": 3,' out || test_failed $LINENO
+files=
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 ; do
+	files="${files} out_fixed.lz copy_fixed.lz"
+done
+( ulimit -n 32 && "${LZIPRECOVER}" --jobs=2 -t ${files} ) ||
+	test_failed $LINENO
+rm -f out || framework_failure
+rm -f out.lz copy.lz out_fixed.lz copy_fixed.lz || framework_failure
+"${LZIPRECOVER}" -U1 "${f6mk_lz}" > out 2> /dev/null || test_failed $LINENO
+"${LZIPRECOVER}" -n3 -U1 "${f6mk_lz}" > copy 2> /dev/null ||
+	test_failed $LINENO
+cmp out copy || test_failed $LINENO
+"${LZIPRECOVER}" -UB10 -v "${fox6_lz}" > out 2> /dev/null || test_failed $LINENO
+"${LZIPRECOVER}" -n2 -UB10 -v "${fox6_lz}" > copy 2> /dev/null ||
+	test_failed $LINENO
+cmp out copy || test_failed $LINENO
+rm -f out copy || framework_failure
+
 printf "\ntesting --reproduce..."
 
+# compressor that ignores its input and always produces test.txt.lz
+printf '#! /bin/sh\ncat > /dev/null\ncat "%s"\n' "${in_lz}" > fake_lzip ||
+	framework_failure
+chmod +x fake_lzip || framework_failure
+rm -f out || framework_failure
+"${LZIPRECOVER}" -q --reproduce --lzip-name=./fake_lzip --lzip-level=6 \
+  --reference-file=in -o out "${bad6_lz}" || test_failed $LINENO
+cmp "${in_lz}" out || test_failed $LINENO
+rm -f out || framework_failure
+# 2 jobs, and the lzip started by the job that succeeds
+"${LZIPRECOVER}" -q --stats -n2 --reproduce --lzip-name=./fake_lzip \
+  --reference-file=in -o out "${bad6_lz}" 2> stats || test_failed $LINENO
+cmp "${in_lz}" out || test_failed $LINENO
+grep -q '"child_processes": 3' stats || test_failed $LINENO
+rm -f out stats fake_lzip || framework_failure
+# the compressor is stopped as soon as its output diverges
+printf '#! /bin/sh\nprintf XZIP\nsleep 1\necho > fake_done\n' > fake_lzip ||
+	framework_failure
+chmod +x fake_lzip || framework_failure
+rm -f out fake_done || framework_failure
+"${LZIPRECOVER}" -q --reproduce --lzip-name=./fake_lzip --lzip-level=6 \
+  --reference-file=in -o out "${bad6_lz}"
+[ $? = 2 ] || test_failed $LINENO
+[ ! -e out ] || test_failed $LINENO
+[ ! -e fake_done ] || test_failed $LINENO
+rm -f fake_lzip || framework_failure
+
 if [ -z "${LZIP_NAME}" ] ; then LZIP_NAME=lzip ; fi
 if /bin/sh -c "${LZIP_NAME} -s18KiB" < in > out 2> /dev/null &&
    cmp "${in_lz}" out > /dev/null 2>&1 ; then
@@ -828,6 +1025,13 @@ if /bin/sh -c "${LZIP_NAME} -s18KiB" < in > out 2> /dev/null &&
       cmp "${in_lz}" out || test_failed $LINENO "${LZIP_NAME} $i $f level=m36"
     done
   done
+  for i in 6 9 ; do
+    rm -f out || framework_failure
+    "${LZIPRECOVER}" -q -n4 --reproduce --lzip-name="${LZIP_NAME}" \
+      --reference-file=in "${testdir}"/test_bad${i}.lz -o out ||
+      test_failed $LINENO "${LZIP_NAME} $i"
+    cmp "${in_lz}" out || test_failed $LINENO "${LZIP_NAME} $i"
+  done
 
   # multimember reproduction using test_bad[6789].txt as reference
   cat "${bad6_lz}" "${bad7_lz}" "${bad8_lz}" "${bad9_lz}" > mm_bad.lz ||
@@ -858,6 +1062,8 @@ if /bin/sh -c "${LZIP_NAME} -s18KiB" < in > out 2> /dev/null &&
 
   "${LZIPRECOVER}" --debug-reproduce=512,5120,512 --lzip-name="${LZIP_NAME}" \
     -q --reference-file=in "${in_lz}" || test_failed $LINENO "${LZIP_NAME}"
+  "${LZIPRECOVER}" --debug-reproduce=512,5120,512 --lzip-name="${LZIP_NAME}" \
+    -q -n3 --reference-file=in "${in_lz}" || test_failed $LINENO "${LZIP_NAME}"
 else
   printf "\nwarning: skipping --reproduce test: ${LZIP_NAME} not found or not the right version.\n"
   ${LZIP_NAME} -V
@@ -1514,6 +1720,20 @@ cat "${in_em}" > test_3m.txt.lz || framework_failure
 "${LZIPRECOVER}" --remove=empty test_3m.txt.lz || test_failed $LINENO
 "${LZIPRECOVER}" -M test_3m.txt.lz | cmp "${testdir}"/test_3m.txt.lz.md5 - ||
 	test_failed $LINENO
+md5f="${testdir}"/test_3m.txt.lz.md5
+cat "${md5f}" "${md5f}" "${md5f}" "${md5f}" "${md5f}" > out || framework_failure
+"${LZIPRECOVER}" -n2 -M test_3m.txt.lz test_3m.txt.lz test_3m.txt.lz \
+  test_3m.txt.lz test_3m.txt.lz | cmp out - || test_failed $LINENO
+"${LZIPRECOVER}" -M in in in in | uniq > out || test_failed $LINENO
+"${LZIPRECOVER}" -M in | cmp out - || test_failed $LINENO
+"${LZIPRECOVER}" -S "${in_lz}" "${in_em}" "${f6s1_lz}" "${in_lz}" > out ||
+	test_failed $LINENO
+grep -q "of '.*fox6_sc1.lz'" out || test_failed $LINENO
+"${LZIPRECOVER}" -n3 -S "${in_lz}" "${in_em}" "${f6s1_lz}" "${in_lz}" |
+	cmp out - || test_failed $LINENO
+"${LZIPRECOVER}" -n2 -S0 "${in_em}" "${in_lz}" > out2 || test_failed $LINENO
+"${LZIPRECOVER}" -S0 "${in_em}" "${in_lz}" | cmp out2 - || test_failed $LINENO
+rm -f out2 || framework_failure
 "${LZIPRECOVER}" --dump=2,4,7 "${in_em}" | cmp test_3m.txt.lz - ||
 	test_failed $LINENO
 "${LZIPRECOVER}" --strip=e "${in_em}" | cmp test_3m.txt.lz - ||
@@ -1527,6 +1747,62 @@ cat "${in_em}" > test_3m.txt.lz || framework_failure
 "${LZIPRECOVER}" --dump=emp "${in_em}" | "${LZIP}" -d | cmp empty - ||
 	test_failed $LINENO
 rm -f test_3m.txt.lz empty out || framework_failure
+# 215 * 80 + 7376 = 24576, a multiple of the usual filesystem block sizes
+i=0 ; : > al.lz
+while [ $i -lt 215 ] ; do cat "${fox_lz}" >> al.lz ; i=`expr $i + 1` ; done
+cat "${in_lz}" "${fox_lz}" > al2.lz || framework_failure
+cat "${in_lz}" al2.lz >> al.lz || framework_failure
+printf "trailing data" >> al.lz
+"${LZIPRECOVER}" --strip=1-216 al.lz > out || test_failed $LINENO
+"${LZIPRECOVER}" --remove=1-216 al.lz || test_failed $LINENO
+cmp out al.lz || test_failed $LINENO
+"${LZIPRECOVER}" --remove=tdata al.lz || test_failed $LINENO
+cmp al2.lz al.lz || test_failed $LINENO
+"${LZIPRECOVER}" --dump=2 al2.lz | cmp "${fox_lz}" - || test_failed $LINENO
+rm -f al.lz al2.lz out || framework_failure
+
+printf "\ntesting unzcrash --internal..."
+
+# the counts of decompressions must be the same as with 'lziprecover -t'
+UNZCRASH="${objdir}"/unzcrash
+if [ -x "${UNZCRASH}" ] ; then
+for mode in "-p20 -s10" -b1,2 "-B8 -d1" "-B8,255 -d3" ; do
+	list=`"${UNZCRASH}" ${mode} -z false "${LZIPRECOVER} -t" "${fox_lz}" 2>&1 |
+	      grep 'decompressions'` || test_failed $LINENO "${mode}"
+	list2=`"${UNZCRASH}" ${mode} -i "${fox_lz}" 2>&1 | grep 'decompressions'` ||
+		test_failed $LINENO "${mode}"
+	[ -n "${list}" ] && [ "${list}" = "${list2}" ] ||
+		test_failed $LINENO "${mode}"
+done
+else
+	printf "\nwarning: skipping unzcrash test: unzcrash not found.\n"
+fi
+
+printf "\ntesting liblziprecover..."
+
+LZRTEST="${objdir}"/lzrtest
+if [ -x "${LZRTEST}" ] ; then
+"${LZRTEST}" d "${in_lz}" > out 2> /dev/null || test_failed $LINENO
+cmp in out || test_failed $LINENO
+for i in t d b ; do
+	"${LZRTEST}" $i "${in_lz}" > /dev/null 2>&1 || test_failed $LINENO $i
+	for f in "${bad1_lz}" "${testdir}"/fox_bcrc.lz "${testdir}"/fox_crc0.lz \
+	         in ; do
+		"${LZRTEST}" $i "$f" > /dev/null 2>&1
+		[ $? = 2 ] || test_failed $LINENO "$i $f"
+	done
+done
+"${LZRTEST}" t "${fox6_lz}" 2> out || test_failed $LINENO
+[ "`cat out`" = "6 members, 270 bytes" ] || test_failed $LINENO
+"${LZRTEST}" r 1000 5000 "${in_lz}" > out 2> /dev/null || test_failed $LINENO
+"${LZIPRECOVER}" -D1000,5000 "${in_lz}" | cmp out - || test_failed $LINENO
+"${LZRTEST}" r 30 150 "${fox6_lz}" > out 2> /dev/null || test_failed $LINENO
+"${LZIPRECOVER}" -D30,150 "${fox6_lz}" | cmp out - || test_failed $LINENO
+"${LZRTEST}" x "${in_lz}" 2> /dev/null && test_failed $LINENO
+rm -f out || framework_failure
+else
+	printf "\nwarning: skipping liblziprecover test: lzrtest not found.\n"
+fi
 
 echo
 if [ ${fail} = 0 ] ; then
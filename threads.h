@@ -0,0 +1,145 @@
+/* Lziprecover - Data recovery tool for the lzip format
+   Copyright (C) 2009-2024 Antonio Diaz Diaz.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+
+enum { max_workers = 1024 };	// upper limit for --threads
+
+// thread wrappers; fail with status 1 on error
+inline void xinit_mutex( pthread_mutex_t * const mutex )
+  {
+  const int errcode = pthread_mutex_init( mutex, 0 );
+  if( errcode )
+    { show_error( "pthread_mutex_init", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xinit_cond( pthread_cond_t * const cond )
+  {
+  const int errcode = pthread_cond_init( cond, 0 );
+  if( errcode )
+    { show_error( "pthread_cond_init", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xdestroy_mutex( pthread_mutex_t * const mutex )
+  {
+  const int errcode = pthread_mutex_destroy( mutex );
+  if( errcode )
+    { show_error( "pthread_mutex_destroy", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xdestroy_cond( pthread_cond_t * const cond )
+  {
+  const int errcode = pthread_cond_destroy( cond );
+  if( errcode )
+    { show_error( "pthread_cond_destroy", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xlock( pthread_mutex_t * const mutex )
+  {
+  const int errcode = pthread_mutex_lock( mutex );
+  if( errcode )
+    { show_error( "pthread_mutex_lock", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xunlock( pthread_mutex_t * const mutex )
+  {
+  const int errcode = pthread_mutex_unlock( mutex );
+  if( errcode )
+    { show_error( "pthread_mutex_unlock", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xwait( pthread_cond_t * const cond, pthread_mutex_t * const mutex )
+  {
+  const int errcode = pthread_cond_wait( cond, mutex );
+  if( errcode )
+    { show_error( "pthread_cond_wait", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xsignal( pthread_cond_t * const cond )
+  {
+  const int errcode = pthread_cond_signal( cond );
+  if( errcode )
+    { show_error( "pthread_cond_signal", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xbroadcast( pthread_cond_t * const cond )
+  {
+  const int errcode = pthread_cond_broadcast( cond );
+  if( errcode )
+    { show_error( "pthread_cond_broadcast", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xcreate( pthread_t * const thread, void *(*routine)(void *),
+                     void * const arg )
+  {
+  const int errcode = pthread_create( thread, 0, routine, arg );
+  if( errcode )
+    { show_error( "Can't create worker threads", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+inline void xjoin( const pthread_t thread )
+  {
+  const int errcode = pthread_join( thread, 0 );
+  if( errcode )
+    { show_error( "Can't join worker threads", errcode ); cleanup_and_fail( 1 ); }
+  }
+
+
+/* Hand out the indexes in [0,size), in ascending order and in steps of
+   'step', to the worker threads sharing the queue. */
+class Work_queue
+  {
+  pthread_mutex_t mutex;
+  unsigned long next_;		// next index to hand out
+  const unsigned long size;
+  const unsigned step;
+
+  Work_queue( const Work_queue & );		// declared as private
+  void operator=( const Work_queue & );		// declared as private
+
+public:
+  explicit Work_queue( const unsigned long s, const unsigned st = 1 )
+    : next_( 0 ), size( s ), step( st ) { xinit_mutex( &mutex ); }
+  ~Work_queue() { xdestroy_mutex( &mutex ); }
+
+  // Set i to the next index and return true, or return false if none left.
+  bool next( unsigned long & i )
+    {
+    xlock( &mutex );
+    i = next_;
+    const bool ok = i < size;
+    if( ok ) next_ += step;
+    xunlock( &mutex );
+    return ok;
+    }
+
+  // Hand out no more indexes.
+  void stop() { xlock( &mutex ); next_ = size; xunlock( &mutex ); }
+  };
+
+
+/* Run 'workers' threads calling worker( &args[i] ), or worker( args ) for
+   all the threads if 'shared', and wait for them to finish. */
+template< typename T >
+void run_workers( void *(*worker)(void *), T * const args, const int workers,
+                  const bool shared = true )
+  {
+  std::vector< pthread_t > worker_threads( workers );
+  for( int i = 0; i < workers; ++i )
+    xcreate( &worker_threads[i], worker, shared ? args : &args[i] );
+  for( int i = 0; i < workers; ++i ) xjoin( worker_threads[i] );
+  }
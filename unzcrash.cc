@@ -38,7 +38,9 @@
 #include <sys/wait.h>
 
 #include "arg_parser.h"
-#include "common.h"
+#include "lzip.h"
+#include "md5.h"
+#include "mtester.h"
 
 #if CHAR_BIT != 8
 #error "Environments where CHAR_BIT != 8 are not supported."
@@ -49,12 +51,13 @@
 #error "Environments where 'size_t' is narrower than 'long' are not supported."
 #endif
 
-namespace {
+int verbosity = 0;
 
 const char * const program_name = "unzcrash";
-const char * invocation_name = program_name;		// default value
 
-int verbosity = 0;
+namespace {
+
+const char * invocation_name = program_name;		// default value
 
 
 void show_help()
@@ -83,7 +86,12 @@ void show_help()
                "\nIn order to compare the outputs, unzcrash needs a 'zcmp' program able to\n"
                "understand the format being tested. For example the zcmp provided by zutils.\n"
                "Use '--zcmp=false' to disable comparisons.\n"
-               "\nUsage: %s [options] 'lzip -t' file.lz\n", invocation_name );
+               "\nIf the option '--internal' is given, unzcrash tests lzip files itself,\n"
+               "without running any child process, and compares the MD5 of the data\n"
+               "instead of running zcmp. This is much faster for small files.\n"
+               "\nUsage: %s [options] 'lzip -t' file.lz\n"
+               "       %s [options] --internal file.lz\n",
+               invocation_name, invocation_name );
   std::printf( "\nOptions:\n"
                "  -h, --help                    display this help and exit\n"
                "  -V, --version                 output version information and exit\n"
@@ -91,6 +99,7 @@ void show_help()
                "  -B, --block[=<size>][,<val>]  test blocks of given size [512,0]\n"
                "  -d, --delta=<n>               test one byte/block/truncation every n bytes\n"
                "  -e, --set-byte=<pos>,<val>    set byte at position <pos> to value <val>\n"
+               "  -i, --internal                test lzip data without a child process\n"
                "  -n, --no-check                skip initial test of file.lz and zcmp\n"
                "  -p, --position=<bytes>        first byte position to test [default 0]\n"
                "  -q, --quiet                   suppress all messages\n"
@@ -113,6 +122,29 @@ void show_help()
 
 #include "main_common.cc"
 
+
+/* Return the number of bytes really written.
+   If (value returned < size), it is always an error.
+*/
+long writeblock( const int fd, const uint8_t * const buf, const long size )
+  {
+  long sz = 0;
+  errno = 0;
+  while( sz < size )
+    {
+    const long n = write( fd, buf + sz, size - sz );
+    if( n > 0 ) sz += n;
+    else if( n < 0 && errno != EINTR ) break;
+    errno = 0;
+    }
+  return sz;
+  }
+
+
+// Called by the wrappers of threads.h if a pthread function fails.
+void cleanup_and_fail( const int retval ) { std::exit( retval ); }
+
+
 namespace {
 
 void parse_block( const char * const arg, const char * const option_name,
@@ -239,24 +271,6 @@ int differing_bits( const uint8_t byte1, const uint8_t byte2 )
   }
 
 
-/* Return the number of bytes really written.
-   If (value returned < size), it is always an error.
-*/
-long writeblock( const int fd, const uint8_t * const buf, const long size )
-  {
-  long sz = 0;
-  errno = 0;
-  while( sz < size )
-    {
-    const long n = write( fd, buf + sz, size - sz );
-    if( n > 0 ) sz += n;
-    else if( n < 0 && errno != EINTR ) break;
-    errno = 0;
-    }
-  return sz;
-  }
-
-
 void show_exec_error( const char * const prog_name )
   {
   if( verbosity >= 0 )
@@ -348,6 +362,66 @@ int fork_and_feed( const uint8_t * const buffer, const long buffer_size,
   return wait_for_child( pid, argv[0] );
   }
 
+
+/* Test the lzip data in buffer like 'lzip -t' does, and compute the MD5
+   of the decompressed data. Return 0 if OK, 2 if the data are corrupt. */
+int test_internal( const uint8_t * const buffer, const long size,
+                   md5_type & digest )
+  {
+  MD5SUM md5sum;
+  for( long pos = 0; ; )
+    {
+    const long rest = size - pos;
+    const Lzip_header & header = *(const Lzip_header *)( buffer + pos );
+    if( rest < Lzip_header::size )
+      { if( pos == 0 || header.check_prefix( rest ) ) return 2; break; }
+    if( !header.check_magic() )				// trailing data
+      { if( pos == 0 || header.check_corrupt() ) return 2; break; }
+    const unsigned dictionary_size = header.dictionary_size();
+    if( !header.check_version() || !isvalid_ds( dictionary_size ) ||
+        rest < min_member_size ) return 2;
+    LZ_mtester mtester( buffer + pos, rest, dictionary_size, -1, &md5sum );
+    if( mtester.test_member() != 0 ) return 2;
+    pos += mtester.member_position();
+    }
+  md5sum.md5_finish( digest );
+  return 0;
+  }
+
+
+/* Run the decompressor and zcmp on the data, or test the data internally
+   (if command_argv is null) keeping the result of the last test for the
+   comparison. The return values are those of wait_for_child. */
+class Tester
+  {
+  const char ** const command_argv;
+  const char ** const zcmp_argv;
+  md5_type orig_digest;		// MD5 of the original data
+  md5_type digest;		// MD5 of the data last tested internally
+
+public:
+  Tester( const char ** const cargv, const char ** const zargv )
+    : command_argv( cargv ), zcmp_argv( zargv ) {}
+
+  bool internal() const { return !command_argv; }
+  void set_original() { orig_digest = digest; }
+
+  int test( const uint8_t * const buffer, const long size,
+            const bool check = false )
+    {
+    if( internal() ) return test_internal( buffer, size, digest );
+    return fork_and_feed( buffer, size, command_argv, check );
+    }
+
+  // call only after test returns 0
+  int compare( const uint8_t * const buffer, const long size,
+               const bool check = false )
+    {
+    if( internal() ) return ( digest == orig_digest ) ? 0 : 1;
+    return fork_and_feed( buffer, size, zcmp_argv, check );
+    }
+  };
+
 } // end namespace
 
 
@@ -365,6 +439,7 @@ int main( const int argc, const char * const argv[] )
   Mode program_mode = m_byte;
   uint8_t block_value = 0;
   bool check = true;
+  bool internal = false;	// test lzip data without a child process
   if( argc > 0 ) invocation_name = argv[0];
 
   const Arg_parser::Option options[] =
@@ -374,6 +449,7 @@ int main( const int argc, const char * const argv[] )
     { 'B', "block",     Arg_parser::maybe },
     { 'd', "delta",     Arg_parser::yes },
     { 'e', "set-byte",  Arg_parser::yes },
+    { 'i', "internal",  Arg_parser::no  },
     { 'n', "no-check",  Arg_parser::no  },
     { 'n', "no-verify", Arg_parser::no  },
     { 'p', "position",  Arg_parser::yes },
@@ -404,6 +480,7 @@ int main( const int argc, const char * const argv[] )
                 program_mode = m_block; break;
       case 'd': delta = getnum( arg, pn, block_size, 1, INT_MAX ); break;
       case 'e': bad_byte.parse_bb( arg, pn ); break;
+      case 'i': internal = true; break;
       case 'n': check = false; break;
       case 'p': pos = getnum( arg, pn, block_size, -LONG_MAX, LONG_MAX ); break;
       case 'q': verbosity = -1; break;
@@ -416,32 +493,40 @@ int main( const int argc, const char * const argv[] )
       }
     } // end process options
 
-  if( parser.arguments() - argind != 2 )
+  if( parser.arguments() - argind != ( internal ? 1 : 2 ) )
     {
     if( verbosity >= 0 )
-      std::fprintf( stderr, "Usage: %s 'lzip -t' file.lz\n", invocation_name );
+      std::fprintf( stderr, internal ? "Usage: %s --internal file.lz\n" :
+                    "Usage: %s 'lzip -t' file.lz\n", invocation_name );
     return 1;
     }
 
   if( delta <= 0 ) delta = ( program_mode == m_block ) ? block_size : 1;
 
-  const char * const command = parser.argument( argind ).c_str();
+  const char * const command =
+    internal ? "internal" : parser.argument( argind++ ).c_str();
   std::vector< std::string > command_args;
-  if( !word_split( command, command_args ) )
-    { show_file_error( command, "Invalid command." ); return 1; }
-  const char ** const command_argv = new const char *[command_args.size()+1];
-  for( unsigned i = 0; i < command_args.size(); ++i )
-    command_argv[i] = command_args[i].c_str();
-  command_argv[command_args.size()] = 0;
-
-  const char * const filename = parser.argument( argind + 1 ).c_str();
+  const char ** command_argv = 0;
+  if( !internal )
+    {
+    if( !word_split( command, command_args ) )
+      { show_file_error( command, "Invalid command." ); return 1; }
+    command_argv = new const char *[command_args.size()+1];
+    for( unsigned i = 0; i < command_args.size(); ++i )
+      command_argv[i] = command_args[i].c_str();
+    command_argv[command_args.size()] = 0;
+    }
+
+  const char * const filename = parser.argument( argind ).c_str();
   long file_size = 0;
   uint8_t * const buffer = read_file( filename, &file_size );
   if( !buffer ) return 1;
   std::string zcmp_command;
   std::vector< std::string > zcmp_args;
   const char ** zcmp_argv = 0;
-  if( std::strcmp( zcmp_program, "false" ) != 0 )
+  if( internal ) { if( std::strcmp( zcmp_program, "false" ) != 0 )
+                     zcmp_command = "md5"; }	// compare internally
+  else if( std::strcmp( zcmp_program, "false" ) != 0 )
     {
     zcmp_command = zcmp_program;
     zcmp_command += " '"; zcmp_command += filename; zcmp_command += "' -";
@@ -454,11 +539,13 @@ int main( const int argc, const char * const argv[] )
     zcmp_argv[zcmp_args.size()] = 0;
     }
 
-  // check original file
+  Tester tester( command_argv, zcmp_argv );
+
+  // check original file (always in internal mode, to get its MD5)
   if( verbosity >= 1 ) fprintf( stderr, "Testing file '%s'\n", filename );
-  if( check )
+  if( check || internal )
     {
-    const int ret = fork_and_feed( buffer, file_size, command_argv, true );
+    const int ret = tester.test( buffer, file_size, true );
     if( ret != 0 )
       {
       if( verbosity >= 0 )
@@ -471,9 +558,10 @@ int main( const int argc, const char * const argv[] )
         }
       return 1;
       }
-    if( zcmp_command.size() )
+    if( tester.internal() ) tester.set_original();
+    else if( zcmp_command.size() )
       {
-      const int ret = fork_and_feed( buffer, file_size, zcmp_argv, true );
+      const int ret = tester.compare( buffer, file_size, true );
       if( ret != 0 )
         {
         if( verbosity >= 0 )
@@ -510,7 +598,7 @@ int main( const int argc, const char * const argv[] )
       {
       if( verbosity >= 1 ) std::fprintf( stderr, "length %ld\n", i );
       ++positions; ++decompressions;
-      const int ret = fork_and_feed( buffer, i, command_argv );
+      const int ret = tester.test( buffer, i );
       if( ret < 0 ) return 1;
       if( ret == 0 )
         {
@@ -519,7 +607,7 @@ int main( const int argc, const char * const argv[] )
           std::fprintf( stderr, "length %ld passed the test\n", i );
         if( zcmp_command.size() )
           {
-          const int ret = fork_and_feed( buffer, i, zcmp_argv );
+          const int ret = tester.compare( buffer, i );
           if( ret < 0 ) return 1;
           if( ret > 0 )
             {
@@ -541,7 +629,7 @@ int main( const int argc, const char * const argv[] )
       ++positions; ++decompressions;
       std::memcpy( block, buffer + i, size );
       std::memset( buffer + i, block_value, size );
-      const int ret = fork_and_feed( buffer, file_size, command_argv );
+      const int ret = tester.test( buffer, file_size );
       if( ret < 0 ) return 1;
       if( ret == 0 )
         {
@@ -550,7 +638,7 @@ int main( const int argc, const char * const argv[] )
           std::fprintf( stderr, "block %ld,%ld passed the test\n", i, size );
         if( zcmp_command.size() )
           {
-          const int ret = fork_and_feed( buffer, file_size, zcmp_argv );
+          const int ret = tester.compare( buffer, file_size );
           if( ret < 0 ) return 1;
           if( ret > 0 )
             {
@@ -581,7 +669,7 @@ int main( const int argc, const char * const argv[] )
           if( verbosity >= 2 )
             std::fprintf( stderr, "0x%02X (0x%02X+0x%02X) ",
                           buffer[i], byte, j );
-          const int ret = fork_and_feed( buffer, file_size, command_argv );
+          const int ret = tester.test( buffer, file_size );
           if( ret < 0 ) return 1;
           if( ret == 0 )
             {
@@ -593,7 +681,7 @@ int main( const int argc, const char * const argv[] )
                 std::fprintf( stderr, "byte %ld passed the test\n", i ); }
             if( zcmp_command.size() )
               {
-              const int ret = fork_and_feed( buffer, file_size, zcmp_argv );
+              const int ret = tester.compare( buffer, file_size );
               if( ret < 0 ) return 1;
               if( ret > 0 )
                 {